@@ -54,6 +54,7 @@ typedef struct {
 typedef struct ri_tbuf_s {
 	void *km;
 	int rep_len, frag_gap;
+	size_t peak_km; // largest size of km while mapping a read
 }ri_tbuf_t;
 
 /**
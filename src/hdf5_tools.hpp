@@ -1845,6 +1845,8 @@ public:
     bool is_rw() const { return _rw; }
     /// Get file name.
     std::string const & file_name() const { return _file_name; }
+    /// Get HDF5 file id.
+    hid_t id() const { return _file_id; }
 
     /**
      * Create file.
@@ -90,6 +90,21 @@ static ko_longopt_t long_options[] = {
 	{ (char*)"fine-max",			ko_required_argument, 	365 },
 	{ (char*)"fine-range",			ko_required_argument, 	366 },
 	{ (char*)"version",				ko_no_argument, 	  	367 },
+	{ (char*)"io-threads",			ko_required_argument, 	368 },
+	{ (char*)"prefetch-files",		ko_required_argument, 	369 },
+	{ (char*)"full-signal",			ko_no_argument, 		370 },
+	{ (char*)"decode-threads",		ko_required_argument, 	371 },
+	{ (char*)"mem-budget",			ko_required_argument, 	372 },
+	{ (char*)"serve",				ko_required_argument, 	373 },
+	{ (char*)"unblock-mapped",		ko_no_argument, 		374 },
+	{ (char*)"event-batch",			ko_required_argument, 	375 },
+	{ (char*)"seg-fixed",			ko_no_argument, 		376 },
+	{ (char*)"seg-robust",			ko_no_argument, 		377 },
+	{ (char*)"trim-stall",			ko_no_argument, 		378 },
+	{ (char*)"trim-max",			ko_required_argument, 	379 },
+	{ (char*)"trim-sd",				ko_required_argument, 	380 },
+	{ (char*)"syncmer",				ko_required_argument, 	381 },
+	{ (char*)"syncmer-offset",		ko_required_argument, 	382 },
 	{ 0, 0, 0 }
 };
 
@@ -184,6 +199,86 @@ const char* ri_maptopt_dtw_mode_to_string(uint32_t dtw_border_constraint){
 	}
 }
 
+static int ri_main_pack(int argc, char *argv[])
+{
+	static ko_longopt_t pack_options[] = {
+		{ (char*)"prefix",	ko_required_argument, 	300 },
+		{ 0, 0, 0 }
+	};
+	ketopt_t o = KETOPT_INIT;
+	int c, n_threads = 3;
+	uint32_t max_sig = 0;
+	int64_t n_reads;
+
+	while ((c = ketopt(&o, argc, argv, 1, "t:", pack_options)) >= 0) {
+		if (c == 't') n_threads = atoi(o.arg);
+		else if (c == 300) max_sig = strtoul(o.arg, 0, 10);// --prefix
+		else if (c == ':') {
+			fprintf(stderr, "[ERROR] missing option argument\n");
+			return 1;
+		} else {
+			fprintf(stderr, "[ERROR] unknown option in \"%s\"\n", argv[o.i - 1]);
+			return 1;
+		}
+	}
+
+	if (argc - o.ind < 2) {
+		fprintf(stderr, "Usage: rawhash pack [options] <out.rhsp> <query.fast5|query.pod5|query.slow5|dir> [...]\n");
+		fprintf(stderr, "Converts the signal files into a single signal pack that can be mapped without decoding the original files.\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "    -t INT     number of threads to read the signal files [%d]\n", n_threads);
+		fprintf(stderr, "    --prefix INT     store at most INT signal values of each read (0: entire signals). Reads are truncated at INT signal values when mapped [%u]\n", max_sig);
+		return 1;
+	}
+
+	n_reads = ri_pack_sigs(argc - (o.ind + 1), (const char**)&argv[o.ind + 1], argv[o.ind], max_sig, n_threads);
+	if (n_reads < 0) return 1;
+	if (ri_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] packed %ld reads into %s\n", __func__, ri_realtime() - ri_realtime0, ri_cputime() / (ri_realtime() - ri_realtime0), (long)n_reads, argv[o.ind]);
+	return 0;
+}
+
+static int ri_main_simulate(int argc, char *argv[])
+{
+	static ko_longopt_t sim_options[] = {
+		{ 0, 0, 0 }
+	};
+	ketopt_t o = KETOPT_INIT;
+	int c, n_threads = 3, n_channels = 512;
+	uint32_t sample_rate = 4000;
+	float chunk_sec = 0.4f;
+	int64_t max_reads = 0;
+
+	while ((c = ketopt(&o, argc, argv, 1, "t:c:r:b:n:", sim_options)) >= 0) {
+		if (c == 't') n_threads = atoi(o.arg);
+		else if (c == 'c') n_channels = atoi(o.arg);
+		else if (c == 'r') sample_rate = strtoul(o.arg, 0, 10);
+		else if (c == 'b') chunk_sec = atof(o.arg);
+		else if (c == 'n') max_reads = mm_parse_num(o.arg);
+		else if (c == ':') {
+			fprintf(stderr, "[ERROR] missing option argument\n");
+			return 1;
+		} else {
+			fprintf(stderr, "[ERROR] unknown option in \"%s\"\n", argv[o.i - 1]);
+			return 1;
+		}
+	}
+
+	if (argc - o.ind < 2) {
+		fprintf(stderr, "Usage: rawhash simulate [options] <socket> <query.fast5|query.pod5|query.slow5|query.rhsp|dir> [...]\n");
+		fprintf(stderr, "Replays the reads as if they were sequenced on a flow cell and streams them to 'rawhash --serve <socket>'. Reports the latency of the decisions.\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "    -c INT     number of channels that sequence at the same time (e.g., 512 for MinION and 3000 for a PromethION flow cell) [%d]\n", n_channels);
+		fprintf(stderr, "    -r INT     sample rate in Hz [%u]\n", sample_rate);
+		fprintf(stderr, "    -b FLOAT     seconds of signal sent in a chunk [%g]\n", chunk_sec);
+		fprintf(stderr, "    -n NUM     replay at most NUM reads (0: all reads) [%ld]\n", (long)max_reads);
+		fprintf(stderr, "    -t INT     number of threads to read the signal files [%d]\n", n_threads);
+		return 1;
+	}
+
+	return ri_simulate(argv[o.ind], argc - (o.ind + 1), (const char**)&argv[o.ind + 1], n_channels, sample_rate, chunk_sec, max_reads, n_threads) < 0? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
 	const char *opt_str = "k:d:p:e:q:w:n:o:t:K:x:h";
@@ -192,7 +287,7 @@ int main(int argc, char *argv[])
   	ri_idxopt_t ipt;
 	int c, n_threads = 3;
 	// int n_parts;
-	char *fnw = 0, *fpore = 0, *s;
+	char *fnw = 0, *fpore = 0, *fserve = 0, *s;
 	FILE *fp_help = stderr;
 	ri_idx_reader_t *idx_rdr;
 	ri_idx_t *ri;
@@ -200,6 +295,8 @@ int main(int argc, char *argv[])
 	ri_verbose = 3;
 	liftrlimit();
 	ri_realtime0 = ri_realtime();
+	if (argc > 1 && strcmp(argv[1], "pack") == 0) return ri_main_pack(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "simulate") == 0) return ri_main_simulate(argc - 1, argv + 1);
 	ri_set_opt(0, &ipt, &opt);
 
 	// test command line options and apply option -x/preset first
@@ -346,11 +443,28 @@ int main(int argc, char *argv[])
 		else if (c == 365) {ipt.fine_max = atof(o.arg);}// --fine-max
 		else if (c == 366) {ipt.fine_range = atof(o.arg);}// --fine-range
 		else if (c == 367) {puts(RH_VERSION); return 0;}// --version
+		else if (c == 368) {opt.n_io_threads = atoi(o.arg);}// --io-threads
+		else if (c == 369) {opt.n_prefetch_files = atoi(o.arg);}// --prefetch-files
+		else if (c == 370) {opt.flag |= RI_M_FULL_SIGNAL;}// --full-signal
+		else if (c == 371) {opt.n_decode_threads = atoi(o.arg);}// --decode-threads
+		else if (c == 372) {opt.mem_budget = mm_parse_num(o.arg);}// --mem-budget
+		else if (c == 373) {fserve = o.arg;}// --serve
+		else if (c == 374) {opt.flag |= RI_M_UNBLOCK_MAPPED;}// --unblock-mapped
+		else if (c == 375) {opt.event_batch = atoi(o.arg);}// --event-batch
+		else if (c == 376) {opt.flag |= RI_M_SEG_FIXED;}// --seg-fixed
+		else if (c == 377) {opt.flag |= RI_M_SEG_ROBUST;}// --seg-robust
+		else if (c == 378) {opt.flag |= RI_M_TRIM_STALL;}// --trim-stall
+		else if (c == 379) {opt.trim_max = (uint32_t)atoi(o.arg);}// --trim-max
+		else if (c == 380) {opt.trim_sd = atof(o.arg);}// --trim-sd
+		else if (c == 381) {ipt.s = atoi(o.arg); ipt.flag |= RI_I_SYNCMER;}// --syncmer
+		else if (c == 382) {ipt.t = atoi(o.arg);}// --syncmer-offset
 		else if (c == 'V') {puts(RH_VERSION); return 0;}
 	}
 
 	if (argc == o.ind || fp_help == stdout) {
 		fprintf(fp_help, "Usage: rawhash [options] <target.fa>|<target.idx> [query.fast5] [...]\n");
+		fprintf(fp_help, "       rawhash pack [options] <out.rhsp> <query.fast5> [...]   (converts signal files into a signal pack, see 'rawhash pack')\n");
+		fprintf(fp_help, "       rawhash --serve <socket> [options] <target.idx>   (maps the reads streamed by Read Until clients, see 'rawhash simulate')\n");
 		fprintf(fp_help, "Options:\n");
 		
 		fprintf(fp_help, "  K-mer (pore) Model:\n");
@@ -363,11 +477,13 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -e INT     number of events concatanated in a single hash (usually no larger than 10). Also applies during mapping [%d].\n", ipt.e);
 		fprintf(fp_help, "    -q INT     Number of bits to use for quantization [%d]. Number of quantized buckets are created accordingly (2^INT).\n", ipt.q);
 		fprintf(fp_help, "    -w INT     minimizer window size [%d]. Enables minimizer-based seeding in indexing and mapping (may reduce accuracy but improves the performance and memory space efficiency).\n", ipt.w);
+		fprintf(fp_help, "    --syncmer INT     Enables syncmer-based seeding in indexing and mapping: keeps only the hashes whose smallest hash of INT consecutive events within them is at their start or end (closed syncmers). Samples the hashes more uniformly than minimizers at the same density. Should not be larger than -e.\n");
+		fprintf(fp_help, "    --syncmer-offset INT     Keeps the open syncmers whose smallest hash of --syncmer events is at offset INT instead of the closed syncmers.\n");
 		fprintf(fp_help, "    --store-sig      Stores the target signal in the index file.\n");
 		fprintf(fp_help, "    --sig-target     The target sequence (reference) contains signals rather than base characters.\n");
 		fprintf(fp_help, "    --sig-diff FLOAT    [Advanced] Signal value (FLOAT) difference between two consecutive events to be packed together in a single hash value [%g].\n", ipt.diff);
 
-		// fprintf(fp_help, "    -n NUM     number of consecutive seeds to use for BLEND-based seeding [%d]. Enables the BLEND mechanism (may improve accuracy but reduces the performance at the moment)\n", ipt.n);
+		fprintf(fp_help, "    -n INT     number of consecutive hashes combined into a single hash with SimHash for BLEND-based (fuzzy) seeding [%d]. Enables the BLEND mechanism when larger than 1. Can be used with or without -w. Allows larger -e values with fewer but more specific seeds.\n", ipt.n);
 		
 		fprintf(fp_help, "\n  Seeding:\n");
 		fprintf(fp_help, "    --q-mid-occ INT1[,INT2]     Lower and upper bounds of k-mer occurrences [%d, %d]. The final k-mer occurrence threshold is max{INT1, min{INT2, --occ-frac}}. This option prevents excessively small or large -f estimated from the input reference.\n", opt.min_mid_occ, opt.max_mid_occ);
@@ -403,6 +519,8 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    --max-chunks INT     stop mapping (read not mapped) after sequencing INT number of chunks [%u]\n", opt.max_num_chunk);
 		fprintf(fp_help, "    --min-mapq INT     map the read if there is only one chain and its MAPQ > INT [%d]\n", opt.min_mapq);
 		fprintf(fp_help, "    --disable-adaptive     Disables stopping the read early and rather lets the read to be sequenced fully to make the analysis. This is not activated by default.\n");
+		fprintf(fp_help, "    --serve FILE     runs as a daemon that maps the chunks streamed by clients over the Unix domain socket FILE instead of mapping query files, until it is interrupted. Mapped reads are kept and the others are ejected\n");
+		fprintf(fp_help, "    --unblock-mapped     with --serve, ejects the mapped reads and keeps the others (e.g., to deplete a genome)\n");
 		
 		fprintf(fp_help, "\n  Nanopore Parameters:\n");
 		fprintf(fp_help, "    --bp-per-sec INT     DNA molecules transiting through the pore (bp per second) [%u]\n", opt.bp_per_sec);
@@ -414,6 +532,12 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    --seg-threshold1 FLOAT     [Advanced] Peak value threshold for the first window in segmentation [%g]\n", opt.threshold1);
 		fprintf(fp_help, "    --seg-threshold2 FLOAT     [Advanced] Peak value threshold for the first window in segmentation [%g]\n", opt.threshold2);
 		fprintf(fp_help, "    --seg-peak_height FLOAT     [Advanced] Peak height than the current signal to confirm the peak point in segmentation [%g]\n", opt.peak_height);
+		fprintf(fp_help, "    --event-batch INT     [Advanced] Detects the events of INT reads together, chunk by chunk. The mt:f tag includes the time of the other reads [%d]\n", opt.event_batch);
+		fprintf(fp_help, "    --seg-fixed     [Advanced] Segments the raw integer samples with fixed-point arithmetic rather than the pA values (ignores --event-batch)\n");
+		fprintf(fp_help, "    --seg-robust     [Advanced] Normalizes the signal without the values far from its running median in MADs (ignores --seg-fixed)\n");
+		fprintf(fp_help, "    --trim-stall     [Advanced] Skips the flat stall (e.g., adapter) at the start of a read before chunking. The ts:i tag reports the skipped signal values\n");
+		fprintf(fp_help, "    --trim-max INT     [Advanced] Skips at most INT signal values with --trim-stall [%u]\n", opt.trim_max);
+		fprintf(fp_help, "    --trim-sd FLOAT     [Advanced] Largest standard deviation (in pA) of the stall with --trim-stall [%g]\n", opt.trim_sd);
 
 		fprintf(fp_help, "\n  Sequence Until Parameters:\n");
 		fprintf(fp_help, "    --sequence-until     Activates Sequence Until and performs real-time relative abundance calculations. The computation will stop as soon as an estimation with high confidence is reached without processing further reads from the set.\n");
@@ -426,6 +550,11 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -o FILE     output mappings to FILE [stdout]\n");
 		fprintf(fp_help, "    -t INT      number of threads [%d]\n", n_threads);
 		fprintf(fp_help, "    -K NUM      minibatch size for mapping [500M]. Increasing this value may increase thread utilization. If there are many larger FAST5 files, it is recommended to keep this value between 500M - 5G to use less memory while utilizing threads nicely.\n");
+		fprintf(fp_help, "    --io-threads INT     number of threads that read the signal files ahead of mapping. Set to 0 to read the files in the mapping pipeline [%d]\n", opt.n_io_threads);
+		fprintf(fp_help, "    --prefetch-files INT     maximum number of signal files to read ahead of the file being mapped [%d]\n", opt.n_prefetch_files);
+		fprintf(fp_help, "    --mem-budget NUM     memory for the reads in flight and the mapping buffers, excluding the index. Batches are made smaller than -K if needed. 0 uses half of the memory available after the index is loaded [0]\n");
+		fprintf(fp_help, "    --decode-threads INT     number of threads that decode a batch of reads within a POD5 or S/BLOW5 file [%d]\n", opt.n_decode_threads);
+		fprintf(fp_help, "    --full-signal     read the entire signal of each read. By default, only the signal values that can be used within --max-chunks are read and the rest is read on demand\n");
 //		fprintf(fp_help, "    -v INT     verbose level [%d]\n", ri_verbose);
 		fprintf(fp_help, "    --version     show version number\n");
 		
@@ -443,8 +572,22 @@ int main(int argc, char *argv[])
 		return fp_help == stdout? 0 : 1;
 	}
 
-	if(ipt.w && ipt.n){
-		fprintf(stderr, "[ERROR] minimizer window 'w' ('%d') and BLEND 'neighbor' ('%d') values cannot be set together. At least one of them must be zero to enable one of the seeding options: %s\n", ipt.w, ipt.n, strerror(errno));
+	if(ipt.n < 0 || ipt.e + ipt.n - 1 > 64){
+		fprintf(stderr, "[ERROR] BLEND 'neighbor' ('%d') value must be within [0, %d] so that a seed spans at most 64 events (e: '%d')\n", ipt.n, 65 - ipt.e, ipt.e);
+		return 1;
+	}
+
+	if(ipt.flag&RI_I_SYNCMER){
+		if(ipt.w || ipt.n > 1){
+			fprintf(stderr, "[ERROR] minimizer window 'w' ('%d') or BLEND 'neighbor' ('%d') and syncmer length ('%d') values cannot be set together. Syncmers are enabled only when both are zero\n", ipt.w, ipt.n, ipt.s);
+			return 1;
+		}
+		if(ipt.s <= 0 || ipt.s > ipt.e || ipt.t < -1 || ipt.t > ipt.e - ipt.s){
+			fprintf(stderr, "[ERROR] syncmer length ('%d') must be within [1, e] and its offset ('%d') must be -1 for closed syncmers or within [0, e-s] for open syncmers (e: '%d')\n", ipt.s, ipt.t, ipt.e);
+			return 1;
+		}
+	}else if(ipt.t != -1){
+		fprintf(stderr, "[ERROR] syncmer offset ('%d') requires the syncmer length to be set with --syncmer\n", ipt.t);
 		return 1;
 	}
 
@@ -454,7 +597,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (!idx_rdr->is_idx && fnw == 0 && argc - o.ind < 2) {
+	if (!idx_rdr->is_idx && fnw == 0 && !fserve && argc - o.ind < 2) {
 		fprintf(stderr, "[ERROR] missing input: please specify a query FAST5/SLOW5 file(s) to map or option -d to store the index in a file before running the mapping\n");
 		ri_idx_reader_close(idx_rdr);
 		return 1;
@@ -484,8 +627,18 @@ int main(int argc, char *argv[])
 		if (ri_verbose >= 3)
 			fprintf(stderr, "[M::%s::%.3f*%.2f] loaded/built the index for %d target sequence(s)\n",
 					__func__, ri_realtime() - ri_realtime0, ri_cputime() / (ri_realtime() - ri_realtime0), ri->n_seq);
-		if (argc != o.ind + 1) ri_mapopt_update(&opt, ri);
+		if (argc != o.ind + 1 || fserve) ri_mapopt_update(&opt, ri);
 		if (ri_verbose >= 3) ri_idx_stat(ri);
+		if (fserve) {
+			//the daemon maps the reads to the first part of the index only
+			ret = ri_serve(ri, &opt, fserve, n_threads);
+			ri_idx_destroy(ri);
+			if (ret < 0) {
+				ri_idx_reader_close(idx_rdr);
+				return 1;
+			}
+			break;
+		}
 		if (argc - (o.ind + 1) == 0) {
 			fprintf(stderr, "[INFO] No files to query index on. Only the index is constructed.\n");
 			ri_idx_destroy(ri);
@@ -15,6 +15,7 @@
  **************/
 
 #include "rsig.h"
+#include "rpack.h"
 
 /*************
  * index     *
@@ -33,5 +34,6 @@
  *************/
 
 #include "rmap.h"
+#include "rserve.h"
 
 #endif // RAWHASH_H
@@ -4,14 +4,15 @@
 #include <float.h>
 #include <math.h>
 #include "rutils.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 //Some of the functions here are adopted from the Sigmap implementation (https://github.com/haowenz/sigmap/tree/c9a40483264c9514587a36555b5af48d3f054f6f). We have optimized the Sigmap implementation to work with the hash tables efficiently.
 
 typedef struct ri_detect_s {
 	int DEF_PEAK_POS;
 	float DEF_PEAK_VAL;
-	float *sig;
-	uint32_t s_len;
 	float threshold;
 	uint32_t window_length;
 	uint32_t masked_to;
@@ -20,57 +21,310 @@ typedef struct ri_detect_s {
 	int valid_peak;
 }ri_detect_t;
 
-static inline void comp_prefix_prefixsq(const float *sig,
-										const uint32_t s_len,
-										float* prefix_sum,
-										float* prefix_sum_square)
+#define RI_EVDETECT_BLOCK 32 //number of positions whose t-statistics are computed together
+#define RI_EVDETECT_LANES 16 //number of reads segmented together by ri_evdetect_push_batch
+#define RI_SORTNET_MAX 32 //segments up to this length are sorted with a sorting network
+#define RI_EVDETECT_HIST_SCALE 16 //bins per pA of the histogram of the robust normalization (see robust_normalize_signal)
+#define RI_EVDETECT_HIST_BINS 4096 //the histogram covers the signal values from 0 to 256 pA
+#define RI_EVDETECT_ROBUST_K 8 //the robust normalization ignores the values farther than this many scaled MADs from the median
+
+//Normalization of a chunk of samples that starts at signal value $start (see ri_evdetect_push_i16)
+typedef struct ri_evnorm_s {
+	uint32_t start;
+	double mean, std_dev;
+} ri_evnorm_t;
+
+struct ri_evdetect_s {
+	ri_detect_t det[2]; //short and long detectors
+	float peak_height;
+	uint32_t w_max; //larger window length. A position is segmented once w_max values after it are available
+
+	double mean_sum, std_dev_sum; //running sums to normalize the signal (see normalize_signal)
+	uint32_t n_sum;
+	uint32_t *hist; //histogram of the signal values if they are normalized with the median and the MAD instead
+
+	uint32_t n; //number of normalized signal values so far
+	uint32_t pos; //next position to segment
+	uint32_t seg_start; //position where the current segment starts (i.e., the last peak)
+
+	float *sig; //normalized signal values from $sig_start to $n. Values before $seg_start are not needed anymore
+	uint32_t sig_start, m_sig;
+
+	//Prefix sums of the normalized values and their squares from $pre_start to $n (inclusive). Segmenting the positions
+	//from $pos needs the sums from $pos-$w_max, so the buffers slide forward and never hold more than
+	//2*$w_max+RI_EVDETECT_BLOCK+1 sums
+	double *pre_sum, *pre_sq;
+	uint32_t pre_start, m_pre;
+
+	//Fixed-point input (see ri_evdetect_push_i16). The samples are centered at $ref and kept as integers: the
+	//normalization sums are exact, and the prefix sums are 32-bit sums that wrap around, which still give exact window
+	//statistics (see comp_tstat_fixed). $sig is only a buffer to convert a segment into normalized values when its event
+	//is appended
+	int fixed;
+	int32_t ref, lo, hi; //the centered samples outside [$lo, $hi] are not segmented (see ri_evdetect_set_fixed)
+	int64_t isum, isum_sq; //normalization sums of the centered samples
+	int16_t *isig; //centered samples from $sig_start to $n
+	uint32_t *ipre_sum, *ipre_sq; //prefix sums from $pre_start to $n (the same layout as $pre_sum and $pre_sq)
+	float var_min; //smallest window variance, in squared samples (see comp_tstat_fixed)
+	ri_evnorm_t *nrm; //normalization of the chunks that the samples from $sig_start belong to
+	uint32_t n_nrm, m_nrm;
+};
+
+//One value per read of a batch (see ri_evdetect_push_batch). GCC vector extensions are lowered to the SIMD width of
+//the target
+typedef float ri_lanef_t __attribute__((vector_size(RI_EVDETECT_LANES * sizeof(float))));
+typedef int32_t ri_lanei_t __attribute__((vector_size(RI_EVDETECT_LANES * sizeof(int32_t))));
+typedef uint32_t ri_laneu_t __attribute__((vector_size(RI_EVDETECT_LANES * sizeof(uint32_t))));
+
+//Peak detector of a batch of reads in structure-of-arrays layout, one read per lane (see gen_peak_lanes)
+typedef struct ri_detect_lanes_s {
+	ri_lanei_t peak_pos, valid_peak;
+	ri_lanef_t peak_value;
+	ri_laneu_t masked_to;
+} ri_detect_lanes_t;
+
+//c-a*b. Fused if the target has FMA so that the result does not depend on whether the compiler contracts it
+#ifdef __FMA__
+#define RI_FNMADD(a, b, c) fmaf(-(a), (b), (c))
+#else
+#define RI_FNMADD(a, b, c) ((c) - (a)*(b))
+#endif
+
+/**
+ * t-statistic between the windows of length $w_len before and after a position
+ *
+ * @param pre_sum			prefix sums of the signal values. pre_sum[0] is the prefix sum at the position
+ * @param pre_sum_square	prefix sums of the squares of the signal values
+ * @param stride			distance between the prefix sums of consecutive positions (1 unless the prefix sums of
+ * 							several reads are interleaved)
+ */
+static inline float comp_tstat1(const double *pre_sum, const double *pre_sum_square, const uint32_t w_len, const int64_t stride)
 {
-	assert(s_len > 0);
+	const float eta = FLT_MIN;
+	const int64_t d = w_len * stride;
+	//prefix sums are kept in double so that long signals do not lose precision
+	float sum1 = (float)(pre_sum[0] - pre_sum[-d]);
+	float sumsq1 = (float)(pre_sum_square[0] - pre_sum_square[-d]);
+	float sum2 = (float)(pre_sum[d] - pre_sum[0]);
+	float sumsq2 = (float)(pre_sum_square[d] - pre_sum_square[0]);
+	float mean1 = sum1 / w_len;
+	float mean2 = sum2 / w_len;
+	float combined_var = (RI_FNMADD(mean2, mean2, RI_FNMADD(mean1, mean1, sumsq1/w_len) + sumsq2/w_len))/w_len;
+	// Prevent problem due to very small variances
+	combined_var = fmaxf(combined_var, eta);
+	// t-stat
+	//  Formula is a simplified version of Student's t-statistic for the
+	//  special case where there are two samples of equal size with
+	//  differing variance
+	const float delta_mean = mean2 - mean1;
+	return fabs(delta_mean) / sqrt(combined_var);
+}
 
-	prefix_sum[0] = 0.0f;
-	prefix_sum_square[0] = 0.0f;
-	for (uint32_t i = 0; i < s_len; ++i) {
-		prefix_sum[i+1] = prefix_sum[i] + sig[i];
-		prefix_sum_square[i+1] = prefix_sum_square[i] + sig[i]*sig[i];
+//t-statistic kernels: compute the t-statistics of $n_pos consecutive positions for the windows of length $w_len1 and
+//$w_len2 (only $w_len1 if $tstat2 is NULL). $pre_sum and $pre_sum_square start at the prefix sums of the first position.
+//The vector kernels use the same operations as comp_tstat1, including fusing the multiply-subtracts only if the build
+//targets FMA. Divisions and square roots are exact in IEEE arithmetic, so all kernels produce identical values.
+typedef void (*ri_tstat_f)(const double *pre_sum, const double *pre_sum_square, uint32_t n_pos, uint32_t w_len1, uint32_t w_len2, float *tstat1, float *tstat2);
+
+static void comp_tstat_scalar(const double *pre_sum, const double *pre_sum_square, uint32_t n_pos, uint32_t w_len1, uint32_t w_len2, float *tstat1, float *tstat2)
+{
+	for (uint32_t b = 0; b < n_pos; ++b) tstat1[b] = comp_tstat1(pre_sum + b, pre_sum_square + b, w_len1, 1);
+	if (tstat2) for (uint32_t b = 0; b < n_pos; ++b) tstat2[b] = comp_tstat1(pre_sum + b, pre_sum_square + b, w_len2, 1);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#ifdef __FMA__
+#define RI_TSTAT_TARGET(t) __attribute__((target(t ",fma")))
+#define RI_FNMADD256(a, b, c) _mm256_fnmadd_ps((a), (b), (c))
+#define RI_FNMADD512(a, b, c) _mm512_fnmadd_ps((a), (b), (c))
+#else //AVX-512 implies FMA, which the compiler would otherwise use to contract the multiply-subtracts
+#define RI_TSTAT_TARGET(t) __attribute__((target(t), optimize("fp-contract=off")))
+#define RI_FNMADD256(a, b, c) _mm256_sub_ps((c), _mm256_mul_ps((a), (b)))
+#define RI_FNMADD512(a, b, c) _mm512_sub_ps((c), _mm512_mul_ps((a), (b)))
+#endif
+
+RI_TSTAT_TARGET("avx2")
+static inline __m256 comp_tstat_avx2_w(const double *ps, const double *pq, const int64_t w)
+{
+	const __m256 eta = _mm256_set1_ps(FLT_MIN), wv = _mm256_set1_ps((float)w);
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256d p0 = _mm256_loadu_pd(ps - w), p1 = _mm256_loadu_pd(ps), p2 = _mm256_loadu_pd(ps + w);
+	__m256d q0 = _mm256_loadu_pd(pq - w), q1 = _mm256_loadu_pd(pq), q2 = _mm256_loadu_pd(pq + w);
+	__m256d r0 = _mm256_loadu_pd(ps - w + 4), r1 = _mm256_loadu_pd(ps + 4), r2 = _mm256_loadu_pd(ps + w + 4);
+	__m256d s0 = _mm256_loadu_pd(pq - w + 4), s1 = _mm256_loadu_pd(pq + 4), s2 = _mm256_loadu_pd(pq + w + 4);
+	__m256 sum1 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(r1, r0)), _mm256_cvtpd_ps(_mm256_sub_pd(p1, p0)));
+	__m256 sumsq1 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(s1, s0)), _mm256_cvtpd_ps(_mm256_sub_pd(q1, q0)));
+	__m256 sum2 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(r2, r1)), _mm256_cvtpd_ps(_mm256_sub_pd(p2, p1)));
+	__m256 sumsq2 = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(s2, s1)), _mm256_cvtpd_ps(_mm256_sub_pd(q2, q1)));
+	__m256 mean1 = _mm256_div_ps(sum1, wv), mean2 = _mm256_div_ps(sum2, wv);
+	__m256 var = RI_FNMADD256(mean1, mean1, _mm256_div_ps(sumsq1, wv));
+	var = RI_FNMADD256(mean2, mean2, _mm256_add_ps(var, _mm256_div_ps(sumsq2, wv)));
+	var = _mm256_max_ps(_mm256_div_ps(var, wv), eta); //eta if NaN, as fmaxf
+	return _mm256_div_ps(_mm256_and_ps(_mm256_sub_ps(mean2, mean1), abs_mask), _mm256_sqrt_ps(var));
+}
+
+RI_TSTAT_TARGET("avx2")
+static void comp_tstat_avx2(const double *pre_sum, const double *pre_sum_square, uint32_t n_pos, uint32_t w_len1, uint32_t w_len2, float *tstat1, float *tstat2)
+{
+	uint32_t b = 0;
+	//both windows are computed in the same pass over the prefix sums
+	for (; b + 8 <= n_pos; b += 8) {
+		_mm256_storeu_ps(tstat1 + b, comp_tstat_avx2_w(pre_sum + b, pre_sum_square + b, w_len1));
+		if (tstat2) _mm256_storeu_ps(tstat2 + b, comp_tstat_avx2_w(pre_sum + b, pre_sum_square + b, w_len2));
 	}
+	if (b < n_pos) comp_tstat_scalar(pre_sum + b, pre_sum_square + b, n_pos - b, w_len1, w_len2, tstat1 + b, tstat2? tstat2 + b : 0);
 }
 
-static inline float* comp_tstat(void *km,
-							 	const float *prefix_sum,
-								const float *prefix_sum_square,
-								const uint32_t s_len,
-								const uint32_t w_len)
-{
-  	const float eta = FLT_MIN;
-	float* tstat = (float*)ri_kcalloc(km, s_len+1, sizeof(float));
-	if (s_len < 2*w_len || w_len < 2) return tstat;
-	memset(tstat, 0, w_len*sizeof(float));
-	
-	for (uint32_t i = w_len; i <= s_len - w_len; ++i) {
-		float sum1 = prefix_sum[i];
-		float sumsq1 = prefix_sum_square[i];
-		if (i > w_len) {
-			sum1 -= prefix_sum[i - w_len];
-			sumsq1 -= prefix_sum_square[i - w_len];
-		}
-		float sum2 = prefix_sum[i + w_len] - prefix_sum[i];
-		float sumsq2 = prefix_sum_square[i + w_len] - prefix_sum_square[i];
-		float mean1 = sum1 / w_len;
-		float mean2 = sum2 / w_len;
-		float combined_var = (sumsq1/w_len - mean1*mean1 + sumsq2/w_len - mean2*mean2)/w_len;
-		// Prevent problem due to very small variances
-		combined_var = fmaxf(combined_var, eta);
-		// t-stat
-		//  Formula is a simplified version of Student's t-statistic for the
-		//  special case where there are two samples of equal size with
-		//  differing variance
-		const float delta_mean = mean2 - mean1;
-		tstat[i] = fabs(delta_mean) / sqrt(combined_var);
+RI_TSTAT_TARGET("avx512f")
+static inline __m512 comp_tstat_avx512_w(const double *ps, const double *pq, const int64_t w)
+{
+	const __m512 eta = _mm512_set1_ps(FLT_MIN), wv = _mm512_set1_ps((float)w);
+	__m512d p0 = _mm512_loadu_pd(ps - w), p1 = _mm512_loadu_pd(ps), p2 = _mm512_loadu_pd(ps + w);
+	__m512d q0 = _mm512_loadu_pd(pq - w), q1 = _mm512_loadu_pd(pq), q2 = _mm512_loadu_pd(pq + w);
+	__m512d r0 = _mm512_loadu_pd(ps - w + 8), r1 = _mm512_loadu_pd(ps + 8), r2 = _mm512_loadu_pd(ps + w + 8);
+	__m512d s0 = _mm512_loadu_pd(pq - w + 8), s1 = _mm512_loadu_pd(pq + 8), s2 = _mm512_loadu_pd(pq + w + 8);
+#define RI_CVT2(lo, hi) _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(lo))), _mm256_castps_pd(_mm512_cvtpd_ps(hi)), 1))
+	__m512 sum1 = RI_CVT2(_mm512_sub_pd(p1, p0), _mm512_sub_pd(r1, r0));
+	__m512 sumsq1 = RI_CVT2(_mm512_sub_pd(q1, q0), _mm512_sub_pd(s1, s0));
+	__m512 sum2 = RI_CVT2(_mm512_sub_pd(p2, p1), _mm512_sub_pd(r2, r1));
+	__m512 sumsq2 = RI_CVT2(_mm512_sub_pd(q2, q1), _mm512_sub_pd(s2, s1));
+#undef RI_CVT2
+	__m512 mean1 = _mm512_div_ps(sum1, wv), mean2 = _mm512_div_ps(sum2, wv);
+	__m512 var = RI_FNMADD512(mean1, mean1, _mm512_div_ps(sumsq1, wv));
+	var = RI_FNMADD512(mean2, mean2, _mm512_add_ps(var, _mm512_div_ps(sumsq2, wv)));
+	var = _mm512_max_ps(_mm512_div_ps(var, wv), eta); //eta if NaN, as fmaxf
+	return _mm512_div_ps(_mm512_abs_ps(_mm512_sub_ps(mean2, mean1)), _mm512_sqrt_ps(var));
+}
+
+RI_TSTAT_TARGET("avx512f")
+static void comp_tstat_avx512(const double *pre_sum, const double *pre_sum_square, uint32_t n_pos, uint32_t w_len1, uint32_t w_len2, float *tstat1, float *tstat2)
+{
+	uint32_t b = 0;
+	for (; b + 16 <= n_pos; b += 16) {
+		_mm512_storeu_ps(tstat1 + b, comp_tstat_avx512_w(pre_sum + b, pre_sum_square + b, w_len1));
+		if (tstat2) _mm512_storeu_ps(tstat2 + b, comp_tstat_avx512_w(pre_sum + b, pre_sum_square + b, w_len2));
+	}
+	if (b < n_pos) comp_tstat_avx2(pre_sum + b, pre_sum_square + b, n_pos - b, w_len1, w_len2, tstat1 + b, tstat2? tstat2 + b : 0);
+}
+#undef RI_TSTAT_TARGET
+#undef RI_FNMADD256
+#undef RI_FNMADD512
+#pragma GCC diagnostic pop
+#endif
+
+//Selects the fastest kernel supported by the CPU
+static ri_tstat_f comp_tstat_select(void)
+{
+	#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return comp_tstat_avx512;
+	if (__builtin_cpu_supports("avx2")) return comp_tstat_avx2;
+	#endif
+	return comp_tstat_scalar;
+}
+
+static inline void comp_tstat(const double *pre_sum, const double *pre_sum_square, uint32_t n_pos, uint32_t w_len1, uint32_t w_len2, float *tstat1, float *tstat2)
+{
+	static const ri_tstat_f tstat = comp_tstat_select();
+	tstat(pre_sum, pre_sum_square, n_pos, w_len1, w_len2, tstat1, tstat2);
+}
+
+/**
+ * t-statistics between the windows of length $w_len before and after consecutive positions from the prefix sums of
+ * integer samples (see ri_evdetect_push_i16). The statistic does not change under a linear transformation of the
+ * samples, so it is computed on the samples rather than the normalized values. With the window sums $S and the window
+ * sums of squares $Q, the t-statistic is |$S2-$S1| / sqrt($V/$w_len), where $V = $w_len*$Q1-$S1^2 + $w_len*$Q2-$S2^2.
+ * $w_len*$Q-$S^2 is the sum of the squared differences between the samples of a window, so it does not depend on the
+ * magnitude of the samples and is exact in 32-bit arithmetic that wraps around (see ri_evdetect_set_fixed)
+ *
+ * @param pre_sum			32-bit prefix sums of the samples. pre_sum[0] is the prefix sum at the first position
+ * @param pre_sum_square	32-bit prefix sums of the squares of the samples
+ * @param var_min			smallest window variance in squared samples (FLT_MIN in normalized values)
+ */
+static inline void comp_tstat_fixed_body(const uint32_t *pre_sum, const uint32_t *pre_sum_square, const uint32_t n_pos, const uint32_t w_len, const float var_min, float *tstat)
+{
+	const float inv_w = 1.0f / w_len, v_min = var_min * (float)w_len * (float)w_len;
+	pre_sum -= w_len, pre_sum_square -= w_len;
+	for (uint32_t b = 0; b < n_pos; ++b) {
+		uint32_t s1 = pre_sum[b + w_len] - pre_sum[b], s2 = pre_sum[b + 2*w_len] - pre_sum[b + w_len];
+		uint32_t q1 = pre_sum_square[b + w_len] - pre_sum_square[b], q2 = pre_sum_square[b + 2*w_len] - pre_sum_square[b + w_len];
+		float var = (float)(int32_t)(w_len*q1 - s1*s1 + w_len*q2 - s2*s2) * inv_w;
+		var = var > v_min? var : v_min;
+		tstat[b] = fabsf((float)(int32_t)(s2 - s1)) / sqrtf(var);
+	}
+}
+
+typedef void (*ri_tstat_fixed_f)(const uint32_t *pre_sum, const uint32_t *pre_sum_square, uint32_t n_pos, uint32_t w_len, float var_min, float *tstat);
+
+static void comp_tstat_fixed_scalar(const uint32_t *pre_sum, const uint32_t *pre_sum_square, uint32_t n_pos, uint32_t w_len, float var_min, float *tstat)
+{
+	comp_tstat_fixed_body(pre_sum, pre_sum_square, n_pos, w_len, var_min, tstat);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+//The same arithmetic on 8 positions per register rather than 4 in double. The operations are correctly rounded, so
+//all kernels produce identical t-statistics
+__attribute__((target("avx2")))
+static void comp_tstat_fixed_avx2(const uint32_t *pre_sum, const uint32_t *pre_sum_square, uint32_t n_pos, uint32_t w_len, float var_min, float *tstat)
+{
+	const __m256i w = _mm256_set1_epi32(w_len);
+	const __m256 inv_w = _mm256_set1_ps(1.0f / w_len), v_min = _mm256_set1_ps(var_min * (float)w_len * (float)w_len);
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const uint32_t *ps = pre_sum - w_len, *pq = pre_sum_square - w_len;
+	uint32_t b = 0;
+	for (; b + 8 <= n_pos; b += 8) {
+		__m256i p0 = _mm256_loadu_si256((const __m256i*)(ps + b)), p1 = _mm256_loadu_si256((const __m256i*)(ps + b + w_len)), p2 = _mm256_loadu_si256((const __m256i*)(ps + b + 2*w_len));
+		__m256i r0 = _mm256_loadu_si256((const __m256i*)(pq + b)), r1 = _mm256_loadu_si256((const __m256i*)(pq + b + w_len)), r2 = _mm256_loadu_si256((const __m256i*)(pq + b + 2*w_len));
+		__m256i s1 = _mm256_sub_epi32(p1, p0), s2 = _mm256_sub_epi32(p2, p1);
+		__m256i v = _mm256_sub_epi32(_mm256_mullo_epi32(w, _mm256_sub_epi32(r1, r0)), _mm256_mullo_epi32(s1, s1));
+		v = _mm256_add_epi32(v, _mm256_sub_epi32(_mm256_mullo_epi32(w, _mm256_sub_epi32(r2, r1)), _mm256_mullo_epi32(s2, s2)));
+		__m256 var = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), inv_w), v_min);
+		__m256 d = _mm256_and_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(s2, s1)), abs_mask);
+		_mm256_storeu_ps(tstat + b, _mm256_div_ps(d, _mm256_sqrt_ps(var)));
 	}
-	// fudge boundaries
-	memset(tstat+s_len-w_len+1, 0, (w_len)*sizeof(float));
+	if (b < n_pos) comp_tstat_fixed_body(pre_sum + b, pre_sum_square + b, n_pos - b, w_len, var_min, tstat + b);
+}
+
+__attribute__((target("avx512f")))
+static void comp_tstat_fixed_avx512(const uint32_t *pre_sum, const uint32_t *pre_sum_square, uint32_t n_pos, uint32_t w_len, float var_min, float *tstat)
+{
+	const __m512i w = _mm512_set1_epi32(w_len);
+	const __m512 inv_w = _mm512_set1_ps(1.0f / w_len), v_min = _mm512_set1_ps(var_min * (float)w_len * (float)w_len);
+	const uint32_t *ps = pre_sum - w_len, *pq = pre_sum_square - w_len;
+	uint32_t b = 0;
+	for (; b + 16 <= n_pos; b += 16) {
+		__m512i p0 = _mm512_loadu_si512(ps + b), p1 = _mm512_loadu_si512(ps + b + w_len), p2 = _mm512_loadu_si512(ps + b + 2*w_len);
+		__m512i r0 = _mm512_loadu_si512(pq + b), r1 = _mm512_loadu_si512(pq + b + w_len), r2 = _mm512_loadu_si512(pq + b + 2*w_len);
+		__m512i s1 = _mm512_sub_epi32(p1, p0), s2 = _mm512_sub_epi32(p2, p1);
+		__m512i v = _mm512_sub_epi32(_mm512_mullo_epi32(w, _mm512_sub_epi32(r1, r0)), _mm512_mullo_epi32(s1, s1));
+		v = _mm512_add_epi32(v, _mm512_sub_epi32(_mm512_mullo_epi32(w, _mm512_sub_epi32(r2, r1)), _mm512_mullo_epi32(s2, s2)));
+		__m512 var = _mm512_max_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(v), inv_w), v_min);
+		__m512 d = _mm512_cvtepi32_ps(_mm512_abs_epi32(_mm512_sub_epi32(s2, s1)));
+		_mm512_storeu_ps(tstat + b, _mm512_div_ps(d, _mm512_sqrt_ps(var)));
+	}
+	if (b < n_pos) comp_tstat_fixed_avx2(pre_sum + b, pre_sum_square + b, n_pos - b, w_len, var_min, tstat + b);
+}
+#pragma GCC diagnostic pop
+#endif
 
-	return tstat;
+static ri_tstat_fixed_f comp_tstat_fixed_select(void)
+{
+	#if defined(__x86_64__) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return comp_tstat_fixed_avx512;
+	if (__builtin_cpu_supports("avx2")) return comp_tstat_fixed_avx2;
+	#endif
+	return comp_tstat_fixed_scalar;
+}
+
+static inline void comp_tstat_fixed(const uint32_t *pre_sum, const uint32_t *pre_sum_square, uint32_t n_pos, uint32_t w_len, float var_min, float *tstat)
+{
+	static const ri_tstat_fixed_f tstat_f = comp_tstat_fixed_select();
+	tstat_f(pre_sum, pre_sum_square, n_pos, w_len, var_min, tstat);
 }
 
 // static inline float calculate_adaptive_peak_height(const float *prefix_sum, const float *prefix_sum_square, uint32_t current_index, uint32_t window_length, float base_peak_height) {
@@ -88,65 +342,120 @@ static inline float* comp_tstat(void *km,
 //     return base_peak_height * (1 + stddev);
 // }
 
-static inline uint32_t gen_peaks(ri_detect_t **detectors,
-								 const uint32_t n_detectors,
-								 const float peak_height,
-								 const float *prefix_sum,
-								 const float *prefix_sum_square,
-								 uint32_t* peaks) {
-
-	uint32_t curInd = 0;
-	for (uint32_t i = 0; i < detectors[0]->s_len; i++) {
-		for (uint32_t k = 0; k < n_detectors; k++) {
-			ri_detect_t *detector = detectors[k];
-			if (detector->masked_to >= i) continue;
-
-			float current_value = detector->sig[i];
-			// float adaptive_peak_height = calculate_adaptive_peak_height(prefix_sum, prefix_sum_square, i, detector->window_length, peak_height);
-
-			if (detector->peak_pos == detector->DEF_PEAK_POS) {
-				// CASE 1: We've not yet recorded any maximum
-				if (current_value < detector->peak_value) { // A deeper minimum:
-					detector->peak_value = current_value;
-				} else if (current_value - detector->peak_value > peak_height) {
-					// ...or a qualifying maximum:
-					detector->peak_value = current_value;
-					detector->peak_pos = i;
-					// otherwise, wait to rise high enough to be considered a peak
-				}
-			} else {
-				// CASE 2: In an existing peak, waiting to see if it is good
-				if (current_value > detector->peak_value) {
-					// Update the peak
-					detector->peak_value = current_value;
-					detector->peak_pos = i;
-				}
-				// Tell other detectors no need to check for a peak until a certain point
-				if (detector->peak_value > detector->threshold) {
-					for(int n_d = k+1; n_d < n_detectors; n_d++){
-						detectors[n_d]->masked_to = detector->peak_pos + detectors[0]->window_length;
-						detectors[n_d]->peak_pos = detectors[n_d]->DEF_PEAK_POS;
-						detectors[n_d]->peak_value = detectors[n_d]->DEF_PEAK_VAL;
-						detectors[n_d]->valid_peak = 0;
-					}
-				}
-				// There is a good peak
-				if (detector->peak_value - current_value > peak_height && 
-					detector->peak_value > detector->threshold) {
-					detector->valid_peak = 1;
-				}
-				// Check if we are now further away from the current peak
-				if (detector->valid_peak && (i - detector->peak_pos) > detector->window_length / 2) {
-					peaks[curInd++] = detector->peak_pos;
-					detector->peak_pos = detector->DEF_PEAK_POS;
-					detector->peak_value = current_value;
-					detector->valid_peak = 0;
-				}
+/**
+ * Runs a peak detector on a single position
+ *
+ * @param detectors		peak detectors. A detector masks the later detectors while it is in a high peak
+ * @param k				index of the detector to run. The detector must not be masked at $i
+ * @param current_value	t-statistic of the detector at position $i
+ * @param peak			detected peak (output)
+ *
+ * @return				1 if a peak is detected. 0, otherwise
+ */
+static inline int gen_peak(ri_detect_t *detectors,
+						   const uint32_t n_detectors,
+						   const uint32_t k,
+						   const float peak_height,
+						   const uint32_t i,
+						   const float current_value,
+						   uint32_t* peak) {
+
+	ri_detect_t *detector = &detectors[k];
+	// float adaptive_peak_height = calculate_adaptive_peak_height(prefix_sum, prefix_sum_square, i, detector->window_length, peak_height);
+
+	if (detector->peak_pos == detector->DEF_PEAK_POS) {
+		// CASE 1: We've not yet recorded any maximum
+		// A deeper minimum or a qualifying maximum. Otherwise, wait to rise high enough to be considered a peak.
+		// The updates are selected rather than branched on as the t-statistics are noisy
+		int lower = current_value < detector->peak_value;
+		int rise = !lower && current_value - detector->peak_value > peak_height;
+		detector->peak_value = (lower | rise)? current_value : detector->peak_value;
+		detector->peak_pos = rise? (int)i : detector->peak_pos;
+	} else {
+		// CASE 2: In an existing peak, waiting to see if it is good
+		// Update the peak
+		int higher = current_value > detector->peak_value;
+		detector->peak_value = higher? current_value : detector->peak_value;
+		detector->peak_pos = higher? (int)i : detector->peak_pos;
+		int above = detector->peak_value > detector->threshold;
+		// Tell other detectors no need to check for a peak until a certain point
+		if (above) {
+			for(uint32_t n_d = k+1; n_d < n_detectors; n_d++){
+				detectors[n_d].masked_to = detector->peak_pos + detectors[0].window_length;
+				detectors[n_d].peak_pos = detectors[n_d].DEF_PEAK_POS;
+				detectors[n_d].peak_value = detectors[n_d].DEF_PEAK_VAL;
+				detectors[n_d].valid_peak = 0;
 			}
 		}
+		// There is a good peak
+		detector->valid_peak |= above & (detector->peak_value - current_value > peak_height);
+		// Check if we are now further away from the current peak
+		if (detector->valid_peak && (i - detector->peak_pos) > detector->window_length / 2) {
+			(*peak) = detector->peak_pos;
+			detector->peak_pos = detector->DEF_PEAK_POS;
+			detector->peak_value = current_value;
+			detector->valid_peak = 0;
+			return 1;
+		}
 	}
 
-	return curInd;
+	return 0;
+}
+
+/**
+ * Runs gen_peak on a position of each lane. The updates are selected per lane rather than branched on
+ *
+ * @param lanes			states of the short and the long detectors of the lanes. valid_peak is -1 or 0
+ * @param det			parameters of the short and the long detectors. The same for all lanes
+ * @param k				index of the detector to run. The short detector masks the long detector as in gen_peak
+ * @param i				position of each lane
+ * @param current_value	t-statistic of the detector at position $i of each lane
+ * @param active		-1 if the detector runs on the lane (i.e., the lane has a position and is not masked), 0 otherwise
+ * @param peak			detected peak of each lane where the return value is set (output)
+ *
+ * @return				-1 for the lanes where a peak is detected, 0 otherwise
+ */
+static inline ri_lanei_t gen_peak_lanes(ri_detect_lanes_t *lanes,
+										const ri_detect_t *det,
+										const uint32_t k,
+										const float peak_height,
+										const ri_laneu_t i,
+										const ri_lanef_t current_value,
+										const ri_lanei_t active,
+										ri_laneu_t *peak)
+{
+	ri_detect_lanes_t *d = &lanes[k];
+	const ri_lanef_t cv = current_value, pv = d->peak_value;
+	const ri_lanei_t pp = d->peak_pos, vp = d->valid_peak, pos = (ri_lanei_t)i;
+	const ri_lanei_t none = pp == det[k].DEF_PEAK_POS;
+
+	// CASE 1: a deeper minimum or a qualifying maximum
+	const ri_lanei_t lower = cv < pv, rise = ~lower & (cv - pv > peak_height);
+	// CASE 2: update the peak, check if it is good and if we are now further away from it
+	const ri_lanei_t higher = cv > pv;
+	const ri_lanef_t pv2 = higher? cv : pv;
+	const ri_lanei_t pp2 = higher? pos : pp;
+	const ri_lanei_t above = pv2 > det[k].threshold;
+	const ri_lanei_t vp2 = vp | (above & (pv2 - cv > peak_height));
+	const ri_lanei_t fire = (vp2 != 0) & (i - (ri_laneu_t)pp2 > det[k].window_length / 2);
+
+	const ri_lanei_t zero = {}, def_pos = zero + det[k].DEF_PEAK_POS;
+	d->peak_value = active? (none? ((lower | rise)? cv : pv) : (fire? cv : pv2)) : pv;
+	d->peak_pos = active? (none? (rise? pos : pp) : (fire? def_pos : pp2)) : pp;
+	d->valid_peak = active? (none? vp : (fire? zero : vp2)) : vp;
+	*peak = (ri_laneu_t)pp2;
+
+	// Tell the long detector no need to check for a peak until a certain point
+	if (k == 0) {
+		ri_detect_lanes_t *m = &lanes[1];
+		const ri_lanei_t masking = active & ~none & above;
+		m->masked_to = masking? (ri_laneu_t)pp2 + det[0].window_length : m->masked_to;
+		const ri_lanef_t zero_f = {};
+		m->peak_pos = masking? zero + det[1].DEF_PEAK_POS : m->peak_pos;
+		m->peak_value = masking? zero_f + det[1].DEF_PEAK_VAL : m->peak_value;
+		m->valid_peak = masking? zero : m->valid_peak;
+	}
+	return active & ~none & fire;
 }
 
 int compare_floats(const void* a, const void* b) {
@@ -155,11 +464,135 @@ int compare_floats(const void* a, const void* b) {
     return (*da > *db) - (*da < *db);
 }
 
+//Sorting networks of Batcher's odd-even merge sort. Compare-exchanges are min/max operations without branches
+#define RI_CSWAP(a, i, j) { float x_ = (a)[i], y_ = (a)[j]; (a)[i] = x_ < y_? x_ : y_; (a)[j] = x_ < y_? y_ : x_; }
+
+static inline void sortnet8(float *a)
+{
+	RI_CSWAP(a, 0, 1); RI_CSWAP(a, 2, 3); RI_CSWAP(a, 4, 5); RI_CSWAP(a, 6, 7); RI_CSWAP(a, 0, 2); RI_CSWAP(a, 1, 3);
+	RI_CSWAP(a, 4, 6); RI_CSWAP(a, 5, 7); RI_CSWAP(a, 1, 2); RI_CSWAP(a, 5, 6); RI_CSWAP(a, 0, 4); RI_CSWAP(a, 1, 5);
+	RI_CSWAP(a, 2, 6); RI_CSWAP(a, 3, 7); RI_CSWAP(a, 2, 4); RI_CSWAP(a, 3, 5); RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4);
+	RI_CSWAP(a, 5, 6);
+}
+
+static inline void sortnet16(float *a)
+{
+	RI_CSWAP(a, 0, 1); RI_CSWAP(a, 2, 3); RI_CSWAP(a, 4, 5); RI_CSWAP(a, 6, 7); RI_CSWAP(a, 8, 9); RI_CSWAP(a, 10, 11);
+	RI_CSWAP(a, 12, 13); RI_CSWAP(a, 14, 15); RI_CSWAP(a, 0, 2); RI_CSWAP(a, 1, 3); RI_CSWAP(a, 4, 6); RI_CSWAP(a, 5, 7);
+	RI_CSWAP(a, 8, 10); RI_CSWAP(a, 9, 11); RI_CSWAP(a, 12, 14); RI_CSWAP(a, 13, 15); RI_CSWAP(a, 1, 2);
+	RI_CSWAP(a, 5, 6); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 13, 14); RI_CSWAP(a, 0, 4); RI_CSWAP(a, 1, 5); RI_CSWAP(a, 2, 6);
+	RI_CSWAP(a, 3, 7); RI_CSWAP(a, 8, 12); RI_CSWAP(a, 9, 13); RI_CSWAP(a, 10, 14); RI_CSWAP(a, 11, 15);
+	RI_CSWAP(a, 2, 4); RI_CSWAP(a, 3, 5); RI_CSWAP(a, 10, 12); RI_CSWAP(a, 11, 13); RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4);
+	RI_CSWAP(a, 5, 6); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 11, 12); RI_CSWAP(a, 13, 14); RI_CSWAP(a, 0, 8);
+	RI_CSWAP(a, 1, 9); RI_CSWAP(a, 2, 10); RI_CSWAP(a, 3, 11); RI_CSWAP(a, 4, 12); RI_CSWAP(a, 5, 13);
+	RI_CSWAP(a, 6, 14); RI_CSWAP(a, 7, 15); RI_CSWAP(a, 4, 8); RI_CSWAP(a, 5, 9); RI_CSWAP(a, 6, 10); RI_CSWAP(a, 7, 11);
+	RI_CSWAP(a, 2, 4); RI_CSWAP(a, 3, 5); RI_CSWAP(a, 6, 8); RI_CSWAP(a, 7, 9); RI_CSWAP(a, 10, 12); RI_CSWAP(a, 11, 13);
+	RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4); RI_CSWAP(a, 5, 6); RI_CSWAP(a, 7, 8); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 11, 12);
+	RI_CSWAP(a, 13, 14);
+}
+
+static inline void sortnet32(float *a)
+{
+	RI_CSWAP(a, 0, 1); RI_CSWAP(a, 2, 3); RI_CSWAP(a, 4, 5); RI_CSWAP(a, 6, 7); RI_CSWAP(a, 8, 9); RI_CSWAP(a, 10, 11);
+	RI_CSWAP(a, 12, 13); RI_CSWAP(a, 14, 15); RI_CSWAP(a, 16, 17); RI_CSWAP(a, 18, 19); RI_CSWAP(a, 20, 21);
+	RI_CSWAP(a, 22, 23); RI_CSWAP(a, 24, 25); RI_CSWAP(a, 26, 27); RI_CSWAP(a, 28, 29); RI_CSWAP(a, 30, 31);
+	RI_CSWAP(a, 0, 2); RI_CSWAP(a, 1, 3); RI_CSWAP(a, 4, 6); RI_CSWAP(a, 5, 7); RI_CSWAP(a, 8, 10); RI_CSWAP(a, 9, 11);
+	RI_CSWAP(a, 12, 14); RI_CSWAP(a, 13, 15); RI_CSWAP(a, 16, 18); RI_CSWAP(a, 17, 19); RI_CSWAP(a, 20, 22);
+	RI_CSWAP(a, 21, 23); RI_CSWAP(a, 24, 26); RI_CSWAP(a, 25, 27); RI_CSWAP(a, 28, 30); RI_CSWAP(a, 29, 31);
+	RI_CSWAP(a, 1, 2); RI_CSWAP(a, 5, 6); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 13, 14); RI_CSWAP(a, 17, 18);
+	RI_CSWAP(a, 21, 22); RI_CSWAP(a, 25, 26); RI_CSWAP(a, 29, 30); RI_CSWAP(a, 0, 4); RI_CSWAP(a, 1, 5);
+	RI_CSWAP(a, 2, 6); RI_CSWAP(a, 3, 7); RI_CSWAP(a, 8, 12); RI_CSWAP(a, 9, 13); RI_CSWAP(a, 10, 14);
+	RI_CSWAP(a, 11, 15); RI_CSWAP(a, 16, 20); RI_CSWAP(a, 17, 21); RI_CSWAP(a, 18, 22); RI_CSWAP(a, 19, 23);
+	RI_CSWAP(a, 24, 28); RI_CSWAP(a, 25, 29); RI_CSWAP(a, 26, 30); RI_CSWAP(a, 27, 31); RI_CSWAP(a, 2, 4);
+	RI_CSWAP(a, 3, 5); RI_CSWAP(a, 10, 12); RI_CSWAP(a, 11, 13); RI_CSWAP(a, 18, 20); RI_CSWAP(a, 19, 21);
+	RI_CSWAP(a, 26, 28); RI_CSWAP(a, 27, 29); RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4); RI_CSWAP(a, 5, 6);
+	RI_CSWAP(a, 9, 10); RI_CSWAP(a, 11, 12); RI_CSWAP(a, 13, 14); RI_CSWAP(a, 17, 18); RI_CSWAP(a, 19, 20);
+	RI_CSWAP(a, 21, 22); RI_CSWAP(a, 25, 26); RI_CSWAP(a, 27, 28); RI_CSWAP(a, 29, 30); RI_CSWAP(a, 0, 8);
+	RI_CSWAP(a, 1, 9); RI_CSWAP(a, 2, 10); RI_CSWAP(a, 3, 11); RI_CSWAP(a, 4, 12); RI_CSWAP(a, 5, 13);
+	RI_CSWAP(a, 6, 14); RI_CSWAP(a, 7, 15); RI_CSWAP(a, 16, 24); RI_CSWAP(a, 17, 25); RI_CSWAP(a, 18, 26);
+	RI_CSWAP(a, 19, 27); RI_CSWAP(a, 20, 28); RI_CSWAP(a, 21, 29); RI_CSWAP(a, 22, 30); RI_CSWAP(a, 23, 31);
+	RI_CSWAP(a, 4, 8); RI_CSWAP(a, 5, 9); RI_CSWAP(a, 6, 10); RI_CSWAP(a, 7, 11); RI_CSWAP(a, 20, 24);
+	RI_CSWAP(a, 21, 25); RI_CSWAP(a, 22, 26); RI_CSWAP(a, 23, 27); RI_CSWAP(a, 2, 4); RI_CSWAP(a, 3, 5);
+	RI_CSWAP(a, 6, 8); RI_CSWAP(a, 7, 9); RI_CSWAP(a, 10, 12); RI_CSWAP(a, 11, 13); RI_CSWAP(a, 18, 20);
+	RI_CSWAP(a, 19, 21); RI_CSWAP(a, 22, 24); RI_CSWAP(a, 23, 25); RI_CSWAP(a, 26, 28); RI_CSWAP(a, 27, 29);
+	RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4); RI_CSWAP(a, 5, 6); RI_CSWAP(a, 7, 8); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 11, 12);
+	RI_CSWAP(a, 13, 14); RI_CSWAP(a, 17, 18); RI_CSWAP(a, 19, 20); RI_CSWAP(a, 21, 22); RI_CSWAP(a, 23, 24);
+	RI_CSWAP(a, 25, 26); RI_CSWAP(a, 27, 28); RI_CSWAP(a, 29, 30); RI_CSWAP(a, 0, 16); RI_CSWAP(a, 1, 17);
+	RI_CSWAP(a, 2, 18); RI_CSWAP(a, 3, 19); RI_CSWAP(a, 4, 20); RI_CSWAP(a, 5, 21); RI_CSWAP(a, 6, 22);
+	RI_CSWAP(a, 7, 23); RI_CSWAP(a, 8, 24); RI_CSWAP(a, 9, 25); RI_CSWAP(a, 10, 26); RI_CSWAP(a, 11, 27);
+	RI_CSWAP(a, 12, 28); RI_CSWAP(a, 13, 29); RI_CSWAP(a, 14, 30); RI_CSWAP(a, 15, 31); RI_CSWAP(a, 8, 16);
+	RI_CSWAP(a, 9, 17); RI_CSWAP(a, 10, 18); RI_CSWAP(a, 11, 19); RI_CSWAP(a, 12, 20); RI_CSWAP(a, 13, 21);
+	RI_CSWAP(a, 14, 22); RI_CSWAP(a, 15, 23); RI_CSWAP(a, 4, 8); RI_CSWAP(a, 5, 9); RI_CSWAP(a, 6, 10);
+	RI_CSWAP(a, 7, 11); RI_CSWAP(a, 12, 16); RI_CSWAP(a, 13, 17); RI_CSWAP(a, 14, 18); RI_CSWAP(a, 15, 19);
+	RI_CSWAP(a, 20, 24); RI_CSWAP(a, 21, 25); RI_CSWAP(a, 22, 26); RI_CSWAP(a, 23, 27); RI_CSWAP(a, 2, 4);
+	RI_CSWAP(a, 3, 5); RI_CSWAP(a, 6, 8); RI_CSWAP(a, 7, 9); RI_CSWAP(a, 10, 12); RI_CSWAP(a, 11, 13);
+	RI_CSWAP(a, 14, 16); RI_CSWAP(a, 15, 17); RI_CSWAP(a, 18, 20); RI_CSWAP(a, 19, 21); RI_CSWAP(a, 22, 24);
+	RI_CSWAP(a, 23, 25); RI_CSWAP(a, 26, 28); RI_CSWAP(a, 27, 29); RI_CSWAP(a, 1, 2); RI_CSWAP(a, 3, 4);
+	RI_CSWAP(a, 5, 6); RI_CSWAP(a, 7, 8); RI_CSWAP(a, 9, 10); RI_CSWAP(a, 11, 12); RI_CSWAP(a, 13, 14);
+	RI_CSWAP(a, 15, 16); RI_CSWAP(a, 17, 18); RI_CSWAP(a, 19, 20); RI_CSWAP(a, 21, 22); RI_CSWAP(a, 23, 24);
+	RI_CSWAP(a, 25, 26); RI_CSWAP(a, 27, 28); RI_CSWAP(a, 29, 30);
+}
+
+#undef RI_CSWAP
+
+//Sorts up to RI_SORTNET_MAX values with the smallest network that fits them. The unused inputs are padded with FLT_MAX
+static inline void sort_segment_small(float* segment, const uint32_t segment_length)
+{
+	float a[RI_SORTNET_MAX];
+	uint32_t l_net = segment_length <= 8? 8 : (segment_length <= 16? 16 : 32), i;
+	for (i = 0; i < segment_length; ++i) a[i] = segment[i];
+	for (; i < l_net; ++i) a[i] = FLT_MAX;
+	if (l_net == 8) sortnet8(a);
+	else if (l_net == 16) sortnet16(a);
+	else sortnet32(a);
+	for (i = 0; i < segment_length; ++i) segment[i] = a[i];
+}
+
+/**
+ * Sorts a segment in ascending order. Long segments are partitioned around the median of three values until the
+ * partitions are small enough for the sorting networks
+ *
+ * @param depth		maximum number of partitioning rounds before falling back to qsort
+ */
+static void sort_segment(float* segment, uint32_t segment_length, int depth)
+{
+	while (segment_length > RI_SORTNET_MAX) {
+		if (depth-- == 0) {
+			qsort(segment, segment_length, sizeof(float), compare_floats);
+			return;
+		}
+		float *lo = segment, *hi = segment + segment_length - 1, *mid = segment + segment_length/2, t;
+		if (*mid < *lo) t = *mid, *mid = *lo, *lo = t;
+		if (*hi < *mid) {
+			t = *hi, *hi = *mid, *mid = t;
+			if (*mid < *lo) t = *mid, *mid = *lo, *lo = t;
+		}
+		const float pivot = *mid;
+		for (;;) {
+			while (*lo < pivot) ++lo;
+			while (pivot < *hi) --hi;
+			if (lo >= hi) break;
+			t = *lo, *lo++ = *hi, *hi-- = t;
+		}
+		//recursion on the shorter partition bounds the stack depth
+		uint32_t l = hi - segment + 1;
+		if (l < segment_length - l) {
+			sort_segment(segment, l, depth);
+			segment += l, segment_length -= l;
+		} else {
+			sort_segment(segment + l, segment_length - l, depth);
+			segment_length = l;
+		}
+	}
+	sort_segment_small(segment, segment_length);
+}
+
 float calculate_mean_of_filtered_segment(float* segment,
 										 const uint32_t segment_length)
 {
     // Calculate median and IQR
-    qsort(segment, segment_length, sizeof(float), compare_floats); // Assuming compare_floats is already defined
+    // The values are summed in ascending order below, so the segment is sorted rather than only selecting the quartiles
+    sort_segment(segment, segment_length, 64);
     float q1 = segment[segment_length / 4];
     float q3 = segment[3 * segment_length / 4];
     float iqr = q3 - q1;
@@ -169,10 +602,10 @@ float calculate_mean_of_filtered_segment(float* segment,
     float sum = 0.0;
     uint32_t count = 0;
     for (uint32_t i = 0; i < segment_length; i++) {
-        if (segment[i] >= lower_bound && segment[i] <= upper_bound) {
-            sum += segment[i];
-            ++count;
-        }
+        // Adding 0 for the filtered values does not change the sum
+        int in_range = segment[i] >= lower_bound && segment[i] <= upper_bound;
+        sum += in_range? segment[i] : 0.0f;
+        count += in_range;
     }
 
     // Return the mean of the filtered segment
@@ -180,108 +613,113 @@ float calculate_mean_of_filtered_segment(float* segment,
 }
 
 /**
- * @brief Generates events from peaks, prefix sums and s_len.
- * 
- * @param km Pointer to memory manager.
- * @param peaks Array of peak positions.
- * @param peak_size Size of peaks array.
- * @param prefix_sum Array of prefix sums.
- * @param s_len Length of the signal.
- * @param n_events Pointer to the number of events generated.
- * @return float* Pointer to the array of generated events.
+ * Adds a chunk of signal values to the running sums and computes the mean and the standard deviation of all the
+ * signal values so far
  */
-static inline float* gen_events(void *km,
-								float* sig,
-								const uint32_t *peaks,
-								const uint32_t peak_size,
-								const uint32_t s_len,
-								uint32_t* n_events)
+static inline void normalize_signal(const float* sig,
+									const uint32_t s_len,
+									double* mean_sum,
+									double* std_dev_sum,
+									uint32_t* n_events_sum,
+									double* mean,
+									double* std_dev)
 {
-	uint32_t n_ev = 0;
-
-	for (uint32_t pi = 0; pi < peak_size; ++pi)
-		if (peaks[pi] > 0 && peaks[pi] < s_len) n_ev++;
-
-	float* events = (float*)ri_kmalloc(km, n_ev*sizeof(float));
+	double sum = (*mean_sum), sum2 = (*std_dev_sum);
 
-	uint32_t start_idx = 0, segment_length = 0;
+	for (uint32_t i = 0; i < s_len; ++i) {
+		sum += sig[i];
+		sum2 += sig[i]*sig[i];
+	}
 
-	for (uint32_t pi = 0, i = 0; pi < peak_size && i < n_ev; pi++){
-		if (!(peaks[pi] > 0 && peaks[pi] < s_len)) continue;
+	(*n_events_sum) += s_len;
+	(*mean_sum) = sum;
+	(*std_dev_sum) = sum2;
 
-    	segment_length = peaks[pi] - start_idx;
-		events[i++] = calculate_mean_of_filtered_segment(sig + start_idx, segment_length);
-		start_idx = peaks[pi];
-	}
+	(*mean) = sum/(*n_events_sum);
+	(*std_dev) = sqrt(sum2/(*n_events_sum) - (*mean)*(*mean));
+}
 
-	(*n_events) = n_ev;
-	return events;
+//Interpolated number of the values in the histogram below $v (in bins)
+static inline double hist_rank(const uint32_t *hist, const uint32_t *cum, const double v)
+{
+	if (v <= 0) return 0;
+	if (v >= RI_EVDETECT_HIST_BINS) return cum[RI_EVDETECT_HIST_BINS];
+	const uint32_t b = (uint32_t)v;
+	return cum[b] + (v - b) * hist[b];
 }
 
-static inline float* normalize_signal(void *km,
-									  const float* sig,
-									  const uint32_t s_len,
-									  double* mean_sum,
-									  double* std_dev_sum,
-									  uint32_t* n_events_sum,
-									  uint32_t* n_sig)
+/**
+ * Adds a chunk of signal values to the running sums and to a histogram, and computes the mean and the standard
+ * deviation of the signal values so far that are within RI_EVDETECT_ROBUST_K scaled median absolute deviations (MAD)
+ * from their median. A few extreme values in the early chunks neither shift nor widen the normalization. The sums of
+ * the values outside that range are taken from the histogram and subtracted from the exact running sums, so the
+ * normalization is the same as normalize_signal if there are no such values. The histogram is updated in constant time
+ * per value and only read once per chunk
+ */
+static void robust_normalize_signal(uint32_t *hist,
+									const float* sig,
+									const uint32_t s_len,
+									double* mean_sum,
+									double* std_dev_sum,
+									uint32_t* n_sum,
+									double* mean,
+									double* std_dev)
 {
-	double sum = (*mean_sum), sum2 = (*std_dev_sum);
-	double mean = 0, std_dev = 0;
-	float* events = (float*)ri_kcalloc(km, s_len, sizeof(float));
+	uint32_t cum[RI_EVDETECT_HIST_BINS + 1];
 
+	normalize_signal(sig, s_len, mean_sum, std_dev_sum, n_sum, mean, std_dev);
 	for (uint32_t i = 0; i < s_len; ++i) {
-		sum += sig[i];
-		sum2 += sig[i]*sig[i];
+		float v = sig[i] * RI_EVDETECT_HIST_SCALE;
+		++hist[v > 0? (v < RI_EVDETECT_HIST_BINS? (uint32_t)v : RI_EVDETECT_HIST_BINS - 1) : 0];
 	}
 
-	(*n_events_sum) += s_len;
-	(*mean_sum) = sum;
-	(*std_dev_sum) = sum2;
+	cum[0] = 0;
+	for (uint32_t b = 0; b < RI_EVDETECT_HIST_BINS; ++b) cum[b + 1] = cum[b] + hist[b];
 
-	mean = sum/(*n_events_sum);
-	std_dev = sqrt(sum2/(*n_events_sum) - (mean)*(mean));
+	//the values are spread evenly within a bin
+	const double half = cum[RI_EVDETECT_HIST_BINS] / 2.0;
+	uint32_t b = 0;
+	while (b + 1 < RI_EVDETECT_HIST_BINS && cum[b + 1] < half) ++b;
+	const double m = hist[b]? b + (half - cum[b]) / hist[b] : b;
 
-	float norm_val = 0;
-	int k = 0;
-	for(uint32_t i = 0; i < s_len; ++i){
-		norm_val = (sig[i]-mean)/std_dev;
-		if(norm_val < 3 && norm_val > -3) events[k++] = norm_val;
+	//half of the values are within the MAD from the median
+	double lo = 0, hi = RI_EVDETECT_HIST_BINS;
+	for (int it = 0; it < 40; ++it) {
+		double d = (lo + hi) / 2;
+		if (hist_rank(hist, cum, m + d) - hist_rank(hist, cum, m - d) >= half) hi = d;
+		else lo = d;
 	}
 
-	(*n_sig) = k;
+	//the values outside [$b0, $b1] are approximated with the centers of their bins
+	const double r = RI_EVDETECT_ROBUST_K * 1.4826 * hi + 1;
+	const uint32_t b0 = m - r > 0? (uint32_t)(m - r) : 0, b1 = m + r < RI_EVDETECT_HIST_BINS - 1? (uint32_t)(m + r) : RI_EVDETECT_HIST_BINS - 1;
+	if (cum[b0] == 0 && cum[b1 + 1] == cum[RI_EVDETECT_HIST_BINS]) return;
+	double n = 0, sum = 0, sum2 = 0;
+	for (b = b0? 0 : b1 + 1; b < RI_EVDETECT_HIST_BINS; b = b + 1 == b0? b1 + 1 : b + 1) {
+		const double c = (b + 0.5) / RI_EVDETECT_HIST_SCALE;
+		n += hist[b], sum += hist[b] * c, sum2 += hist[b] * c * c;
+	}
+	n = (*n_sum) - n;
+	(*mean) = ((*mean_sum) - sum) / n;
+	(*std_dev) = sqrt(((*std_dev_sum) - sum2) / n - (*mean) * (*mean));
+}
 
-	return events;
+//Normalization of the signal values so far with either the mean and the standard deviation or the median and the MAD
+static inline void evdetect_normalize(ri_evdetect_t *ed, const float* sig, const uint32_t s_len, double* mean, double* std_dev)
+{
+	if (ed->hist) robust_normalize_signal(ed->hist, sig, s_len, &ed->mean_sum, &ed->std_dev_sum, &ed->n_sum, mean, std_dev);
+	else normalize_signal(sig, s_len, &ed->mean_sum, &ed->std_dev_sum, &ed->n_sum, mean, std_dev);
 }
 
-float* detect_events(void *km,
-					 const uint32_t s_len,
-					 const float* sig,
-					 const uint32_t window_length1,
-					 const uint32_t window_length2,
-					 const float threshold1,
-					 const float threshold2,
-					 const float peak_height,
-					 double* mean_sum,
-					 double* std_dev_sum,
-					 uint32_t* n_events_sum,
-					 uint32_t* n_events)
+ri_evdetect_t *ri_evdetect_init(const uint32_t window_length1,
+								const uint32_t window_length2,
+								const float threshold1,
+								const float threshold2,
+								const float peak_height)
 {
-	float* prefix_sum = (float*)ri_kcalloc(km, s_len+1, sizeof(float));
-	float* prefix_sum_square = (float*)ri_kcalloc(km, s_len+1, sizeof(float));
-
-	//Normalize the signal
-	uint32_t n_signals = 0;
-	float* norm_signals = normalize_signal(km, sig, s_len, mean_sum, std_dev_sum, n_events_sum, &n_signals);
-	if(n_signals == 0) return 0;
-	comp_prefix_prefixsq(norm_signals, n_signals, prefix_sum, prefix_sum_square);
-	
-	float* tstat1 = comp_tstat(km, prefix_sum, prefix_sum_square, n_signals, window_length1);
-	float* tstat2 = comp_tstat(km, prefix_sum, prefix_sum_square, n_signals, window_length2);
+	ri_evdetect_t *ed = (ri_evdetect_t*)calloc(1, sizeof(ri_evdetect_t));
 	ri_detect_t short_detector = {.DEF_PEAK_POS = -1,
 								  .DEF_PEAK_VAL = FLT_MAX,
-								  .sig = tstat1,
-								  .s_len = n_signals,
 								  .threshold = threshold1,
 								  .window_length = window_length1,
 								  .masked_to = 0,
@@ -291,23 +729,497 @@ float* detect_events(void *km,
 
 	ri_detect_t long_detector = {.DEF_PEAK_POS = -1,
 								 .DEF_PEAK_VAL = FLT_MAX,
-								 .sig = tstat2,
-								 .s_len = n_signals,
 								 .threshold = threshold2,
 								 .window_length = window_length2,
 								 .masked_to = 0,
 								 .peak_pos = -1,
 								 .peak_value = FLT_MAX,
 								 .valid_peak = 0};
+	ed->det[0] = short_detector;
+	ed->det[1] = long_detector;
+	ed->peak_height = peak_height;
+	ed->w_max = window_length1 > window_length2? window_length1 : window_length2;
+	if (ed->w_max == 0) ed->w_max = 1;
+
+	ed->m_pre = 2*ed->w_max + RI_EVDETECT_BLOCK + 1;
+	ed->pre_sum = (double*)calloc(ed->m_pre, sizeof(double));
+	ed->pre_sq = (double*)calloc(ed->m_pre, sizeof(double));
+	return ed;
+}
+
+void ri_evdetect_destroy(ri_evdetect_t *ed)
+{
+	if (!ed) return;
+	free(ed->sig); free(ed->pre_sum); free(ed->pre_sq);
+	free(ed->isig); free(ed->ipre_sum); free(ed->ipre_sq); free(ed->nrm); free(ed->hist);
+	free(ed);
+}
+
+//Converts the samples from $ed->seg_start to $p into normalized values in $ed->sig. Each sample is normalized with the
+//mean and the standard deviation of the chunk it arrived in, as ri_evdetect_push does
+static inline float *evdetect_normalize_segment(ri_evdetect_t *ed, const uint32_t p)
+{
+	float *seg = ed->sig;
+	uint32_t k = 0;
+	for (uint32_t i = ed->seg_start; i < p;) {
+		while (k + 1 < ed->n_nrm && ed->nrm[k + 1].start <= i) ++k;
+		const uint32_t e = k + 1 < ed->n_nrm && ed->nrm[k + 1].start < p? ed->nrm[k + 1].start : p;
+		const double mean = ed->nrm[k].mean, std_dev = ed->nrm[k].std_dev;
+		for (; i < e; ++i) seg[i - ed->seg_start] = (ed->isig[i - ed->sig_start] - mean)/std_dev;
+	}
+	return seg;
+}
+
+//Appends the event that ends at peak $p, which is the mean of the signal values between two consecutive peaks
+static inline void evdetect_emit(ri_evdetect_t *ed, void *km, const uint32_t p, float **events, uint32_t *n_ev, uint32_t *m_ev)
+{
+	if (!(p > 0 && p >= ed->seg_start)) return;
+	if (*n_ev == *m_ev) {
+		*m_ev = *m_ev? *m_ev << 1 : 16;
+		*events = (float*)ri_krealloc(km, *events, *m_ev * sizeof(float));
+	}
+	uint32_t l_seg = p - ed->seg_start;
+	float *seg = l_seg && ed->fixed? evdetect_normalize_segment(ed, p) : ed->sig + (ed->seg_start - ed->sig_start);
+	(*events)[(*n_ev)++] = l_seg? calculate_mean_of_filtered_segment(seg, l_seg) : 0.0f;
+	ed->seg_start = p;
+}
+
+/**
+ * Computes the t-statistics of both detectors for the positions from $i0 to $i1 (at most RI_EVDETECT_BLOCK positions)
+ *
+ * @param n		number of signal values if the end of the signal is known (0 otherwise). The positions within a window
+ * 				from the start and the end of the signal do not have a t-statistic and get 0
+ */
+static inline void evdetect_tstat(const ri_evdetect_t *ed, const uint32_t i0, const uint32_t i1, const uint32_t n, float tstat[2][RI_EVDETECT_BLOCK])
+{
+	uint32_t s[2], e[2]; //positions with a t-statistic
+	for (uint32_t k = 0; k < 2; ++k) {
+		const uint32_t w_len = ed->det[k].window_length;
+		s[k] = i0 < w_len? w_len : i0, e[k] = i1;
+		if (n) e[k] = n < 2*w_len? 0 : (e[k] < n - w_len + 1? e[k] : n - w_len + 1);
+		if (w_len < 2) e[k] = 0;
+		if (s[k] >= e[k]) s[k] = e[k] = i0;
+		memset(tstat[k], 0, (i1 - i0) * sizeof(float));
+	}
+
+	if (ed->fixed) {
+		for (uint32_t k = 0; k < 2; ++k)
+			if (s[k] < e[k]) comp_tstat_fixed(ed->ipre_sum + (s[k] - ed->pre_start), ed->ipre_sq + (s[k] - ed->pre_start), e[k] - s[k], ed->det[k].window_length, ed->var_min, tstat[k] + (s[k] - i0));
+		return;
+	}
+
+	//Both windows are computed together unless the block is at the start or the end of the signal
+	if (s[0] == s[1] && e[0] == e[1]) {
+		if (s[0] < e[0]) comp_tstat(ed->pre_sum + (s[0] - ed->pre_start), ed->pre_sq + (s[0] - ed->pre_start), e[0] - s[0], ed->det[0].window_length, ed->det[1].window_length, tstat[0] + (s[0] - i0), tstat[1] + (s[0] - i0));
+	} else {
+		for (uint32_t k = 0; k < 2; ++k)
+			if (s[k] < e[k]) comp_tstat(ed->pre_sum + (s[k] - ed->pre_start), ed->pre_sq + (s[k] - ed->pre_start), e[k] - s[k], ed->det[k].window_length, 0, tstat[k] + (s[k] - i0), 0);
+	}
+}
+
+/**
+ * Segments the positions from $ed->pos to $end. The t-statistics of a block of positions are computed first, then
+ * the detectors that are not masked run on each position and an event is appended for each peak
+ *
+ * @param n		number of signal values if the end of the signal is known (0 otherwise). See evdetect_tstat
+ */
+static void evdetect_segment(ri_evdetect_t *ed, void *km, const uint32_t end, const uint32_t n, float **events, uint32_t *n_ev, uint32_t *m_ev)
+{
+	float tstat[2][RI_EVDETECT_BLOCK];
+
+	while (ed->pos < end) {
+		const uint32_t i0 = ed->pos, i1 = end - i0 < RI_EVDETECT_BLOCK? end : i0 + RI_EVDETECT_BLOCK;
+		evdetect_tstat(ed, i0, i1, n, tstat);
+
+		for (uint32_t i = i0; i < i1; ++i) {
+			for (uint32_t k = 0; k < 2; ++k) {
+				uint32_t p;
+				if (ed->det[k].masked_to >= i) continue;
+				if (gen_peak(ed->det, 2, k, ed->peak_height, i, tstat[k][i - i0], &p)) evdetect_emit(ed, km, p, events, n_ev, m_ev);
+			}
+		}
+		ed->pos = i1;
+	}
+}
+
+/**
+ * Segments the positions of a batch of reads from $ed[r]->pos to $end[r], one read per lane. The same as evdetect_segment
+ * on each read, but the peak detectors run on a position of all the reads at once. The t-statistics of a block of each
+ * read are computed first and transposed so that the t-statistics of a position are contiguous across the reads
+ *
+ * @param ed		event detectors of the reads. The detectors must have the same parameters
+ * @param n_lanes	number of reads (at most RI_EVDETECT_LANES)
+ * @param last		1 if the signals of the reads end at $ed[r]->n (see evdetect_tstat)
+ */
+static void evdetect_segment_lanes(ri_evdetect_t **ed, const uint32_t n_lanes, void *km, const uint32_t *end, const int last, float **events, uint32_t *n_ev, uint32_t *m_ev)
+{
+	float tstat[2][RI_EVDETECT_BLOCK];
+	ri_lanef_t tstat_lanes[2][RI_EVDETECT_BLOCK];
+	ri_laneu_t i0, n_pos, peak;
+	ri_detect_lanes_t lanes[2];
+	const ri_laneu_t zero = {};
+
+	for (;;) {
+		uint32_t T = 0;
+		i0 = n_pos = zero;
+		for (uint32_t r = 0; r < n_lanes; ++r) {
+			i0[r] = ed[r]->pos;
+			n_pos[r] = end[r] > i0[r]? (end[r] - i0[r] < RI_EVDETECT_BLOCK? end[r] - i0[r] : RI_EVDETECT_BLOCK) : 0;
+			T = n_pos[r] > T? n_pos[r] : T;
+		}
+		if (T == 0) break;
+
+		memset(tstat_lanes, 0, sizeof(tstat_lanes));
+		for (uint32_t r = 0; r < n_lanes; ++r) {
+			if (!n_pos[r]) continue;
+			evdetect_tstat(ed[r], i0[r], i0[r] + n_pos[r], last? ed[r]->n : 0, tstat);
+			for (uint32_t k = 0; k < 2; ++k)
+				for (uint32_t t = 0; t < n_pos[r]; ++t) tstat_lanes[k][t][r] = tstat[k][t];
+		}
+
+		for (uint32_t k = 0; k < 2; ++k) {
+			memset(&lanes[k], 0, sizeof(ri_detect_lanes_t));
+			for (uint32_t r = 0; r < n_lanes; ++r) {
+				const ri_detect_t *det = &ed[r]->det[k];
+				lanes[k].peak_pos[r] = det->peak_pos, lanes[k].peak_value[r] = det->peak_value;
+				lanes[k].valid_peak[r] = det->valid_peak? -1 : 0, lanes[k].masked_to[r] = det->masked_to;
+			}
+		}
+		for (uint32_t t = 0; t < T; ++t) {
+			const ri_laneu_t pos = i0 + t;
+			const ri_lanei_t in = n_pos > t;
+			for (uint32_t k = 0; k < 2; ++k) {
+				const ri_lanei_t active = in & (lanes[k].masked_to < pos);
+				const ri_lanei_t fired = gen_peak_lanes(lanes, ed[0]->det, k, ed[0]->peak_height, pos, tstat_lanes[k][t], active, &peak);
+				int32_t any = 0;
+				for (uint32_t r = 0; r < RI_EVDETECT_LANES; ++r) any |= fired[r];
+				if (!any) continue;
+				for (uint32_t r = 0; r < n_lanes; ++r)
+					if (fired[r]) evdetect_emit(ed[r], km, peak[r], &events[r], &n_ev[r], &m_ev[r]);
+			}
+		}
+
+		for (uint32_t r = 0; r < n_lanes; ++r) {
+			for (uint32_t k = 0; k < 2; ++k) {
+				ri_detect_t *det = &ed[r]->det[k];
+				det->peak_pos = lanes[k].peak_pos[r], det->peak_value = lanes[k].peak_value[r];
+				det->valid_peak = lanes[k].valid_peak[r] != 0, det->masked_to = lanes[k].masked_to[r];
+			}
+			ed[r]->pos += n_pos[r];
+		}
+	}
+}
+
+//Makes room for $s_len more signal values
+static inline void evdetect_reserve(ri_evdetect_t *ed, const uint32_t s_len)
+{
+	uint32_t l_sig = ed->n - ed->sig_start;
+	if (l_sig + s_len > ed->m_sig) {
+		ed->m_sig = l_sig + s_len;
+		ed->sig = (float*)realloc(ed->sig, ed->m_sig * sizeof(float));
+		if (ed->fixed) ed->isig = (int16_t*)realloc(ed->isig, ed->m_sig * sizeof(int16_t));
+	}
+}
+
+//Slides the prefix sums that are not needed anymore out
+static inline void evdetect_slide(ri_evdetect_t *ed)
+{
+	uint32_t d = ed->pos - ed->w_max - ed->pre_start;
+	if (ed->fixed) {
+		memmove(ed->ipre_sum, ed->ipre_sum + d, (ed->m_pre - d) * sizeof(uint32_t));
+		memmove(ed->ipre_sq, ed->ipre_sq + d, (ed->m_pre - d) * sizeof(uint32_t));
+	} else {
+		memmove(ed->pre_sum, ed->pre_sum + d, (ed->m_pre - d) * sizeof(double));
+		memmove(ed->pre_sq, ed->pre_sq + d, (ed->m_pre - d) * sizeof(double));
+	}
+	ed->pre_start += d;
+}
+
+/**
+ * Normalizes the signal values from $sig[$j] and appends the ones that are kept until a block of positions is ready to
+ * be segmented. A value that is kept completes the windows of the position $w_max values before it. Normalized
+ * values outside [-3,3] are discarded
+ *
+ * @return	index of the next signal value to normalize
+ */
+static inline uint32_t evdetect_ingest(ri_evdetect_t *ed, const uint32_t s_len, const float* sig, uint32_t j, const double mean, const double std_dev)
+{
+	const uint32_t w_max = ed->w_max;
+	//the running sums are kept in registers rather than reloaded from the prefix sums
+	double sum = ed->pre_sum[ed->n - ed->pre_start], sum_sq = ed->pre_sq[ed->n - ed->pre_start];
+	while (j < s_len) {
+		float norm_val = (sig[j++]-mean)/std_dev;
+		if (!(norm_val < 3 && norm_val > -3)) continue;
+
+		if (ed->n + 1 - ed->pre_start == ed->m_pre) evdetect_slide(ed);
+		uint32_t l = ed->n - ed->pre_start;
+		sum += norm_val, sum_sq += norm_val*norm_val;
+		ed->pre_sum[l + 1] = sum;
+		ed->pre_sq[l + 1] = sum_sq;
+		ed->sig[ed->n - ed->sig_start] = norm_val;
+		++ed->n;
+
+		if (ed->n >= w_max && ed->n - w_max + 1 - ed->pos == RI_EVDETECT_BLOCK) break;
+	}
+	return j;
+}
+
+/**
+ * The same as evdetect_ingest for centered integer samples (see ri_evdetect_push_i16)
+ *
+ * @param lo	smallest centered sample that is kept (see evdetect_keep_range)
+ * @param hi	largest centered sample that is kept. Must not be smaller than $lo
+ */
+static inline uint32_t evdetect_ingest_fixed(ri_evdetect_t *ed, const uint32_t s_len, const int16_t* sig, uint32_t j, const int32_t lo, const int32_t hi)
+{
+	const uint32_t w_max = ed->w_max;
+	uint32_t sum = ed->ipre_sum[ed->n - ed->pre_start], sum_sq = ed->ipre_sq[ed->n - ed->pre_start];
+	while (j < s_len) {
+		int32_t x = sig[j++] - ed->ref;
+		if ((uint32_t)(x - lo) > (uint32_t)(hi - lo)) continue;
 
-	uint32_t* peaks = (uint32_t*)ri_kmalloc(km, n_signals * sizeof(uint32_t));
-	ri_detect_t *detectors[2] = {&short_detector, &long_detector};
-	uint32_t n_peaks = gen_peaks(detectors, 2, peak_height, prefix_sum, prefix_sum_square, peaks);
-	ri_kfree(km, tstat1); ri_kfree(km, tstat2); ri_kfree(km, prefix_sum); ri_kfree(km, prefix_sum_square);
+		if (ed->n + 1 - ed->pre_start == ed->m_pre) evdetect_slide(ed);
+		uint32_t l = ed->n - ed->pre_start;
+		sum += (uint32_t)x, sum_sq += (uint32_t)x*(uint32_t)x;
+		ed->ipre_sum[l + 1] = sum;
+		ed->ipre_sq[l + 1] = sum_sq;
+		ed->isig[ed->n - ed->sig_start] = (int16_t)x;
+		++ed->n;
+
+		if (ed->n >= w_max && ed->n - w_max + 1 - ed->pos == RI_EVDETECT_BLOCK) break;
+	}
+	return j;
+}
+
+//Kept if the normalized value is within (-3,3), computed as in evdetect_ingest
+static inline int evdetect_keep(const int32_t x, const double mean, const double std_dev)
+{
+	float norm_val = (x-mean)/std_dev;
+	return norm_val < 3 && norm_val > -3;
+}
+
+/**
+ * Finds the range of the centered samples that are kept after normalization. The normalized value increases with the
+ * sample, so the kept samples form a range and are tested with two integer comparisons
+ *
+ * @param lo	smallest centered sample (input) and smallest kept sample (output)
+ * @param hi	largest centered sample (input) and largest kept sample (output). Smaller than $lo if none is kept
+ */
+static inline void evdetect_keep_range(const double mean, const double std_dev, int32_t *lo, int32_t *hi)
+{
+	const int32_t l = *lo, h = *hi;
+	int32_t a, b;
+	if (!(std_dev > 0)) {*lo = 1, *hi = 0; return;}
+	double c = mean - 3*std_dev, d = mean + 3*std_dev;
+	a = c < l? l : (c > h? h : (int32_t)floor(c));
+	while (a > l && evdetect_keep(a - 1, mean, std_dev)) --a;
+	while (a <= h && !evdetect_keep(a, mean, std_dev)) ++a;
+	b = d > h? h : (d < a? a : (int32_t)ceil(d));
+	while (b < h && evdetect_keep(b + 1, mean, std_dev)) ++b;
+	while (b >= a && !evdetect_keep(b, mean, std_dev)) --b;
+	*lo = a, *hi = b;
+}
+
+//Segmentable end: the positions whose windows are complete
+static inline uint32_t evdetect_end(const ri_evdetect_t *ed)
+{
+	return ed->n >= ed->w_max? ed->n - ed->w_max + 1 : ed->pos;
+}
+
+//Drops the signal values before the current segment
+static inline void evdetect_trim(ri_evdetect_t *ed)
+{
+	if (ed->seg_start > ed->sig_start) {
+		if (ed->fixed) memmove(ed->isig, ed->isig + (ed->seg_start - ed->sig_start), (ed->n - ed->seg_start) * sizeof(int16_t));
+		else memmove(ed->sig, ed->sig + (ed->seg_start - ed->sig_start), (ed->n - ed->seg_start) * sizeof(float));
+		ed->sig_start = ed->seg_start;
+	}
+	if (ed->fixed) {
+		uint32_t k = 0;
+		while (k + 1 < ed->n_nrm && ed->nrm[k + 1].start <= ed->seg_start) ++k;
+		if (k) memmove(ed->nrm, ed->nrm + k, (ed->n_nrm - k) * sizeof(ri_evnorm_t));
+		ed->n_nrm -= k;
+	}
+}
+
+float* ri_evdetect_push(ri_evdetect_t *ed,
+						void *km,
+						const uint32_t s_len,
+						const float* sig,
+						const int last,
+						uint32_t *n_events)
+{
+	uint32_t n_ev = 0, m_ev = 0;
+	float *events = 0;
+	double mean, std_dev;
+
+	evdetect_normalize(ed, sig, s_len, &mean, &std_dev);
+	evdetect_reserve(ed, s_len);
+
+	//Single pass over the chunk. The positions are segmented once a block of them is complete
+	for (uint32_t j = 0; j < s_len;) {
+		j = evdetect_ingest(ed, s_len, sig, j, mean, std_dev);
+		evdetect_segment(ed, km, evdetect_end(ed), 0, &events, &n_ev, &m_ev);
+	}
+
+	//The positions within a window from the end of the signal are segmented once the end is known
+	if (last) evdetect_segment(ed, km, ed->n, ed->n, &events, &n_ev, &m_ev);
+	evdetect_trim(ed);
+
+	(*n_events) = n_ev;
+	return events;
+}
+
+void ri_evdetect_set_robust(ri_evdetect_t *ed)
+{
+	if (ed->n_sum || ed->fixed || ed->hist) return;
+	ed->hist = (uint32_t*)calloc(RI_EVDETECT_HIST_BINS, sizeof(uint32_t));
+}
+
+int ri_evdetect_set_fixed(ri_evdetect_t *ed, const int16_t lo, const int16_t hi)
+{
+	if (ed->n_sum || ed->fixed || ed->hist || lo > hi) return ed->fixed;
+	//The sums of the squared differences of two windows are at most ($w_max*($hi-$lo))^2/2 and must fit in int32_t (see
+	//comp_tstat_fixed)
+	const int64_t d = (int64_t)ed->w_max * (hi - lo);
+	if (d * d > INT32_MAX) return 0;
+
+	const int32_t ref = ((int32_t)lo + hi) / 2;
+	ed->fixed = 1, ed->ref = ref, ed->lo = lo - ref, ed->hi = hi - ref;
+	ed->ipre_sum = (uint32_t*)calloc(ed->m_pre, sizeof(uint32_t));
+	ed->ipre_sq = (uint32_t*)calloc(ed->m_pre, sizeof(uint32_t));
+	return 1;
+}
+
+float* ri_evdetect_push_i16(ri_evdetect_t *ed,
+							void *km,
+							const uint32_t s_len,
+							const int16_t* sig,
+							const int last,
+							uint32_t *n_events)
+{
+	uint32_t n_ev = 0, m_ev = 0;
+	float *events = 0;
+	assert(ed->fixed);
+
+	//The normalization sums of the integer samples are exact
+	int64_t sum = ed->isum, sum_sq = ed->isum_sq;
+	for (uint32_t j = 0; j < s_len; ++j) {
+		int32_t x = sig[j] - ed->ref;
+		sum += x, sum_sq += (int64_t)x*x;
+	}
+	ed->isum = sum, ed->isum_sq = sum_sq, ed->n_sum += s_len;
+	const double mean = (double)sum/ed->n_sum, std_dev = sqrt((double)sum_sq/ed->n_sum - mean*mean);
+	float var_min = (float)(FLT_MIN*std_dev*std_dev);
+	ed->var_min = var_min > FLT_MIN? var_min : FLT_MIN;
+
+	if (ed->n_nrm == ed->m_nrm) {
+		ed->m_nrm = ed->m_nrm? ed->m_nrm << 1 : 4;
+		ed->nrm = (ri_evnorm_t*)realloc(ed->nrm, ed->m_nrm * sizeof(ri_evnorm_t));
+	}
+	ed->nrm[ed->n_nrm].start = ed->n, ed->nrm[ed->n_nrm].mean = mean, ed->nrm[ed->n_nrm++].std_dev = std_dev;
+
+	int32_t lo = ed->lo, hi = ed->hi;
+	evdetect_keep_range(mean, std_dev, &lo, &hi);
+	evdetect_reserve(ed, s_len);
+
+	if (lo <= hi) {
+		for (uint32_t j = 0; j < s_len;) {
+			j = evdetect_ingest_fixed(ed, s_len, sig, j, lo, hi);
+			evdetect_segment(ed, km, evdetect_end(ed), 0, &events, &n_ev, &m_ev);
+		}
+	}
+
+	if (last) evdetect_segment(ed, km, ed->n, ed->n, &events, &n_ev, &m_ev);
+	evdetect_trim(ed);
+
+	(*n_events) = n_ev;
+	return events;
+}
+
+void ri_evdetect_push_batch(ri_evdetect_t **ed,
+							void *km,
+							const uint32_t n_reads,
+							const uint32_t *s_len,
+							const float **sig,
+							const int last,
+							float **events,
+							uint32_t *n_events)
+{
+	const uint32_t L = RI_EVDETECT_LANES;
+	double mean[RI_EVDETECT_LANES], std_dev[RI_EVDETECT_LANES];
+	uint32_t j[RI_EVDETECT_LANES], end[RI_EVDETECT_LANES], m_ev[RI_EVDETECT_LANES];
+	if (n_reads == 0) return;
+
+	for (uint32_t r0 = 0; r0 < n_reads; r0 += L) {
+		const uint32_t n_lanes = n_reads - r0 < L? n_reads - r0 : L;
+		ri_evdetect_t **e = ed + r0;
+		for (uint32_t r = 0; r < n_lanes; ++r) {
+			assert(!e[r]->fixed && e[r]->w_max == ed[0]->w_max && e[r]->det[0].window_length == ed[0]->det[0].window_length);
+			evdetect_normalize(e[r], sig[r0 + r], s_len[r0 + r], &mean[r], &std_dev[r]);
+			evdetect_reserve(e[r], s_len[r0 + r]);
+			j[r] = 0, m_ev[r] = n_events[r0 + r] = 0, events[r0 + r] = 0;
+		}
+
+		//The reads are normalized one by one until each has a block of positions, and the blocks are segmented together
+		for (int more = 1; more;) {
+			more = 0;
+			for (uint32_t r = 0; r < n_lanes; ++r) {
+				j[r] = evdetect_ingest(e[r], s_len[r0 + r], sig[r0 + r], j[r], mean[r], std_dev[r]);
+				end[r] = evdetect_end(e[r]);
+				more |= j[r] < s_len[r0 + r];
+			}
+			evdetect_segment_lanes(e, n_lanes, km, end, 0, events + r0, n_events + r0, m_ev);
+		}
+
+		if (last) {
+			for (uint32_t r = 0; r < n_lanes; ++r) end[r] = e[r]->n;
+			evdetect_segment_lanes(e, n_lanes, km, end, 1, events + r0, n_events + r0, m_ev);
+		}
+		for (uint32_t r = 0; r < n_lanes; ++r) evdetect_trim(e[r]);
+	}
+}
+
+uint32_t ri_detect_stall(const float* sig, const uint32_t s_len, const uint32_t w_len, const float max_sd)
+{
+	if (w_len == 0) return 0;
+	const double max_var = (double)max_sd * max_sd;
+	double level = 0;
+	uint32_t i = 0;
+	for (; i + w_len <= s_len; i += w_len) {
+		double sum = 0, sum_sq = 0;
+		for (uint32_t j = i; j < i + w_len; ++j) sum += sig[j], sum_sq += (double)sig[j] * sig[j];
+		const double mean = sum / w_len, var = sum_sq / w_len - mean * mean;
+		if (var > max_var) break;
+		//The stall stays at a single level. A window at another level is a low-variance event of the read
+		if (i == 0) level = mean;
+		else if (fabs(mean - level) > 2 * max_sd) break;
+	}
+	return i;
+}
+
+float* detect_events(void *km,
+					 const uint32_t s_len,
+					 const float* sig,
+					 const uint32_t window_length1,
+					 const uint32_t window_length2,
+					 const float threshold1,
+					 const float threshold2,
+					 const float peak_height,
+					 const int robust,
+					 double* mean_sum,
+					 double* std_dev_sum,
+					 uint32_t* n_events_sum,
+					 uint32_t* n_events)
+{
+	ri_evdetect_t *ed = ri_evdetect_init(window_length1, window_length2, threshold1, threshold2, peak_height);
+	//the histogram of the robust normalization starts from $sig, so the running sums start from it as well
+	if (robust) ri_evdetect_set_robust(ed);
+	else ed->mean_sum = *mean_sum, ed->std_dev_sum = *std_dev_sum, ed->n_sum = *n_events_sum;
 
-	float* events = 0;
-	if(n_peaks > 0) events = gen_events(km, norm_signals, peaks, n_peaks, n_signals, n_events);
-	ri_kfree(km, norm_signals); ri_kfree(km, peaks);
+	float* events = ri_evdetect_push(ed, km, s_len, sig, 1, n_events);
 
+	if (!robust) *mean_sum = ed->mean_sum, *std_dev_sum = ed->std_dev_sum, *n_events_sum = ed->n_sum;
+	ri_evdetect_destroy(ed);
 	return events;
 }
@@ -8,6 +8,135 @@
 extern "C" {
 #endif
 
+typedef struct ri_evdetect_s ri_evdetect_t;
+
+/**
+ * Initializes an event detector that segments the signal of a read as its chunks arrive. The detector keeps the
+ * normalization sums, the state of the peak detectors, and the signal values that a later chunk may still need.
+ * Pushing the signal in any chunking produces the same events as pushing the whole signal at once.
+ *
+ * @param window_length1	window length of the short detector
+ * @param window_length2	window length of the long detector
+ * @param threshold1		peak threshold of the short detector
+ * @param threshold2		peak threshold of the long detector
+ * @param peak_height		minimum peak height
+ *
+ * @return					event detector. Must be destroyed with ri_evdetect_destroy
+ */
+ri_evdetect_t *ri_evdetect_init(const uint32_t window_length1,
+								const uint32_t window_length2,
+								const float threshold1,
+								const float threshold2,
+								const float peak_height);
+
+void ri_evdetect_destroy(ri_evdetect_t *ed);
+
+/**
+ * Detects the events in the next chunk of signal values
+ *
+ * @param ed		event detector (see ri_evdetect_init)
+ * @param km		thread-local memory pool for the returned events; using NULL falls back to malloc()
+ * @param s_len		length of $sig
+ * @param sig		next chunk of signal values
+ * @param last		1 if $sig is the last chunk of the read. Otherwise, the positions within the longer window from
+ * 					the end of the chunk are segmented once the next chunk arrives
+ * @param n_events	number of events (output)
+ *
+ * @return			events that end in the signal values received so far, of length $n_events
+ */
+float* ri_evdetect_push(ri_evdetect_t *ed,
+						void *km,
+						const uint32_t s_len,
+						const float* sig,
+						const int last,
+						uint32_t *n_events);
+
+/**
+ * Switches a new event detector to a robust normalization: the mean and the standard deviation are computed without
+ * the signal values that are far from the median in terms of the median absolute deviation (MAD). The median and the
+ * MAD come from a histogram of the signal values (in pA), so a few outliers in the early chunks do not pull the
+ * normalization. Without such outliers, the normalization is the same as the default one
+ *
+ * @param ed	event detector (see ri_evdetect_init). No chunk must be pushed yet. Cannot be combined with
+ * 				ri_evdetect_set_fixed
+ */
+void ri_evdetect_set_robust(ri_evdetect_t *ed);
+
+/**
+ * Switches a new event detector to fixed-point segmentation of integer samples (see ri_evdetect_push_i16)
+ *
+ * @param ed	event detector (see ri_evdetect_init). No chunk must be pushed yet and the detector must not be
+ * 				switched to the robust normalization
+ * @param lo	smallest sample that is segmented
+ * @param hi	largest sample that is segmented. The samples outside [$lo, $hi] still count in the normalization
+ *
+ * @return		1 if the detector segments integer samples. 0 if the range is too wide for the 32-bit window statistics,
+ * 				in which case the detector stays as it is
+ */
+int ri_evdetect_set_fixed(ri_evdetect_t *ed, const int16_t lo, const int16_t hi);
+
+/**
+ * Detects the events in the next chunk of integer samples (e.g., raw ADC samples) with fixed-point arithmetic. The
+ * samples are normalized, filtered, and segmented as integers; the t-statistics do not change under the linear
+ * transformation into pA and are computed from exact integer window sums. Only the samples of a segment are
+ * converted into normalized values to compute its event. The events match ri_evdetect_push on the samples
+ * converted into pA up to floating-point rounding
+ *
+ * @param ed		event detector switched with ri_evdetect_set_fixed
+ * @param km		thread-local memory pool for the returned events; using NULL falls back to malloc()
+ * @param s_len		length of $sig
+ * @param sig		next chunk of samples
+ * @param last		1 if $sig is the last chunk of the read (see ri_evdetect_push)
+ * @param n_events	number of events (output)
+ *
+ * @return			events that end in the samples received so far, of length $n_events
+ */
+float* ri_evdetect_push_i16(ri_evdetect_t *ed,
+							void *km,
+							const uint32_t s_len,
+							const int16_t* sig,
+							const int last,
+							uint32_t *n_events);
+
+/**
+ * Detects the events in the next chunks of a batch of reads. Produces the same events as calling ri_evdetect_push on
+ * each read, but the reads are segmented together (e.g., the current chunks of many channels)
+ *
+ * @param ed		event detectors of the reads (see ri_evdetect_init). Must be initialized with the same parameters
+ * 					and must not be switched to fixed-point segmentation
+ * @param km		thread-local memory pool for the returned events; using NULL falls back to malloc()
+ * @param n_reads	number of reads
+ * @param s_len		length of the next chunk of each read
+ * @param sig		next chunk of each read
+ * @param last		1 if the chunks are the last chunks of the reads (see ri_evdetect_push)
+ * @param events	events of each read (output)
+ * @param n_events	number of events of each read (output)
+ */
+void ri_evdetect_push_batch(ri_evdetect_t **ed,
+							void *km,
+							const uint32_t n_reads,
+							const uint32_t *s_len,
+							const float **sig,
+							const int last,
+							float **events,
+							uint32_t *n_events);
+
+/**
+ * Finds the stall at the start of a read (e.g., the adapter or the open pore before the strand enters the pore). The
+ * stall is a flat signal: the signal values stay at a single level with a much smaller deviation than the strand.
+ * The signal is scanned in windows of $w_len values until a window is not flat or moves away from the level of the
+ * first window
+ *
+ * @param sig		signal values (in pA) from the start of the read
+ * @param s_len		length of $sig
+ * @param w_len		window length
+ * @param max_sd	largest standard deviation of the signal values in a window of the stall (in pA)
+ *
+ * @return			length of the stall, a multiple of $w_len. 0 if the read does not start with a stall. $s_len
+ * 					rounded down to $w_len if the whole $sig is flat
+ */
+uint32_t ri_detect_stall(const float* sig, const uint32_t s_len, const uint32_t w_len, const float max_sd);
+
 /**
  * Detects events from signals
  *
@@ -15,6 +144,8 @@ extern "C" {
  * @param s_len	length of $sig
  * @param sig	signal values
  * @param opt	mapping options @TODO: Should be decoupled from the mapping options
+ * @param robust	1 to normalize without the outliers of $sig (see ri_evdetect_set_robust). The running sums
+ * 					are then neither used nor updated
  * @param n		number of events
  * 
  * @return		list of event values of length $n
@@ -27,6 +158,7 @@ float* detect_events(void *km,
 					 const float threshold1,
 					 const float threshold2,
 					 const float peak_height,
+					 const int robust,
 					 double* mean_sum,
 					 double* std_dev_sum,
 					 uint32_t* n_events_sum,
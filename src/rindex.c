@@ -48,6 +48,7 @@ typedef struct {
 void ri_idx_stat(const ri_idx_t *ri)
 {
 	fprintf(stderr, "[M::%s] pore kmer size: %d; concatanated events: %d; quantization bits: %d; w: %d; n: %d; #seq: %d\n", __func__, ri->k, ri->e, ri->q, ri->w, ri->n, ri->n_seq);
+	if (ri->flag & RI_I_SYNCMER) fprintf(stderr, "[M::%s] %s syncmers; s: %d; t: %d\n", __func__, ri->t < 0? "closed" : "open", ri->s, ri->t);
 }
 
 ri_idx_t* ri_idx_init(float diff, int b, int w, int e, int n, int q, int k, float fine_min, float fine_max, float fine_range, int flag){
@@ -138,14 +139,14 @@ static void *worker_pipeline(void *shared, int step, void *in)
 					float* s_values = p->ri->F[r_id];
 
 					ri_seq_to_sig(t->seq, t->l_seq, p->ri->pore, p->ri->k, 0, &s_len, s_values);
-					ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
+					ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->s, p->ri->t, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
 					p->ri->f_l_sig[r_id] = s_len;
 
 					if(!(p->ri->flag&RI_I_REV_QUERY)){
 						p->ri->R[r_id] = (float*)ri_kcalloc(p->ri->km, t->l_seq, sizeof(float));
 						s_values = p->ri->R[r_id];
 						ri_seq_to_sig(t->seq, t->l_seq, p->ri->pore, p->ri->k, 1, &s_len, s_values);
-						ri_sketch(0, s_values, t->rid, 1, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
+						ri_sketch(0, s_values, t->rid, 1, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->s, p->ri->t, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
 						p->ri->r_l_sig[r_id] = s_len;
 					}
 				}
@@ -159,11 +160,11 @@ static void *worker_pipeline(void *shared, int step, void *in)
 					float* s_values = (float*)calloc(t->l_seq, sizeof(float));
 
 					ri_seq_to_sig(t->seq, t->l_seq, p->ri->pore, p->ri->k, 0, &s_len, s_values);
-					ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
+					ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->s, p->ri->t, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
 
 					if(!(p->ri->flag&RI_I_REV_QUERY)){
 						ri_seq_to_sig(t->seq, t->l_seq, p->ri->pore, p->ri->k, 1, &s_len, s_values);
-						ri_sketch(0, s_values, t->rid, 1, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
+						ri_sketch(0, s_values, t->rid, 1, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->s, p->ri->t, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
 					}
 
 					free(s_values);
@@ -208,8 +209,10 @@ ri_sig_t** ri_sig_read(pipeline_t *pl,
 		if(!pl->sfp || pl->sfp->cur_read == pl->sfp->num_read) break;
 		
 		ri_sig_t *s = (ri_sig_t*)calloc(1, sizeof(ri_sig_t));
-		rh_kv_push(ri_sig_t*, 0, rsigv, s);
 		ri_read_sig(pl->sfp, s);
+		//no read is left if the last reads of the file could not be decoded
+		if(!s->name){ri_sig_destroy(s); continue;}
+		rh_kv_push(ri_sig_t*, 0, rsigv, s);
 		size += s->l_sig;
 
 		if(size >= chunk_size) break;
@@ -266,13 +269,17 @@ static void *worker_sig_pipeline(void *shared, int step, void *in)
 				uint32_t s_len = 0;
 				double s_sum = 0, s_std = 0;
 				uint32_t n_events_sum = 0;
-				float* s_values = detect_events(0, t->l_sig, t->sig, p->ri->window_length1, p->ri->window_length2, p->ri->threshold1, p->ri->threshold2, p->ri->peak_height, &s_sum, &s_std, &n_events_sum, &s_len);
+				uint64_t raw_pos = 0;
+				float* sig = (float*)malloc(t->l_sig*sizeof(float));
+				ri_sig_convert(t, &raw_pos, t->l_sig, sig);
+				float* s_values = detect_events(0, t->l_sig, sig, p->ri->window_length1, p->ri->window_length2, p->ri->threshold1, p->ri->threshold2, p->ri->peak_height, 0, &s_sum, &s_std, &n_events_sum, &s_len);
 
-				ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
+				ri_sketch(0, s_values, t->rid, 0, s_len, p->ri->diff, p->ri->w, p->ri->e, p->ri->n, p->ri->s, p->ri->t, p->ri->q, p->ri->k, p->ri->fine_min, p->ri->fine_max, p->ri->fine_range, &s->a);
 
 				if(s_values)free(s_values);
+				free(sig);
 			}
-			free(t->sig); free(t->name); 
+			ri_sig_destroy(t);
 		}
 		free(s->sig); s->sig = 0;
 		return s;
@@ -373,6 +380,10 @@ void ri_idx_dump(FILE* idx_file, const ri_idx_t* ri){
 	
 	fwrite(RI_IDX_MAGIC, 1, RI_IDX_MAGIC_BYTE, idx_file);
 	fwrite(pars, sizeof(uint32_t), 7, idx_file);
+	if (ri->flag & RI_I_SYNCMER) {
+		fwrite(&ri->s, sizeof(int32_t), 1, idx_file);
+		fwrite(&ri->t, sizeof(int32_t), 1, idx_file);
+	}
 	fwrite(&ri->diff, sizeof(float), 1, idx_file);
 	fwrite(&ri->fine_min, sizeof(float), 1, idx_file);
 	fwrite(&ri->fine_max, sizeof(float), 1, idx_file);
@@ -463,6 +474,8 @@ ri_idx_t* ri_idx_load(FILE* idx_file){
 	if (strncmp(magic, RI_IDX_MAGIC, RI_IDX_MAGIC_BYTE) != 0) return 0;
 	int pars[7];
 	fread(&pars[0], sizeof(int), 7, idx_file);
+	int32_t sync[2] = {0, -1};
+	if (pars[6] & RI_I_SYNCMER) fread(sync, sizeof(int32_t), 2, idx_file);
 
 	float diff, fine_min, fine_max, fine_range;
 	fread(&diff, sizeof(float), 1, idx_file);
@@ -472,6 +485,7 @@ ri_idx_t* ri_idx_load(FILE* idx_file){
 
 	ri = ri_idx_init(diff, 14, pars[0], pars[1], pars[2], pars[3], pars[4], fine_min, fine_max, fine_range, pars[6]);
 	ri->n_seq = pars[5];
+	ri->s = sync[0], ri->t = sync[1];
 	if(ri->flag&RI_I_SIG_TARGET) ri->sig = (ri_sig_t*)ri_kcalloc(ri->km, ri->n_seq, sizeof(ri_sig_t));
 	else ri->seq = (ri_idx_seq_t*)ri_kcalloc(ri->km, ri->n_seq, sizeof(ri_idx_seq_t));
 
@@ -596,7 +610,7 @@ void ri_idx_reader_close(ri_idx_reader_t* r){
 	free(r);
 }
 
-ri_idx_t* ri_idx_gen(mm_bseq_file_t* fp, ri_pore_t* pore, float diff, int b, int w, int e, int n, int q, int k, float fine_min, float fine_max, float fine_range, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
+ri_idx_t* ri_idx_gen(mm_bseq_file_t* fp, ri_pore_t* pore, float diff, int b, int w, int e, int n, int s, int t, int q, int k, float fine_min, float fine_max, float fine_range, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
 {
 
 	if(flag&RI_I_SIG_TARGET) return 0;
@@ -608,6 +622,7 @@ ri_idx_t* ri_idx_gen(mm_bseq_file_t* fp, ri_pore_t* pore, float diff, int b, int
 	pl.batch_size = batch_size;
 	pl.fp = fp;
 	pl.ri = ri_idx_init(diff, b, w, e, n, q, k, fine_min, fine_max, fine_range, flag);
+	if (flag&RI_I_SYNCMER) pl.ri->s = s, pl.ri->t = t;
 	
 	pl.ri->pore = (ri_pore_t*)ri_kmalloc(pl.ri->km, sizeof(ri_pore_t));
 	memcpy(pl.ri->pore, pore, sizeof(ri_pore_t));
@@ -622,7 +637,7 @@ ri_idx_t* ri_idx_gen(mm_bseq_file_t* fp, ri_pore_t* pore, float diff, int b, int
 	return pl.ri;
 }
 
-ri_idx_t* ri_idx_siggen(ri_sig_file_t** fp, char **f, int &cur_f, int n_f, ri_pore_t* pore, float diff, int b, int w, int e, int n, int q, int k, float fine_min, float fine_max, float fine_range, uint32_t window_length1, uint32_t window_length2, float threshold1, float threshold2, float peak_height, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
+ri_idx_t* ri_idx_siggen(ri_sig_file_t** fp, char **f, int &cur_f, int n_f, ri_pore_t* pore, float diff, int b, int w, int e, int n, int s, int t, int q, int k, float fine_min, float fine_max, float fine_range, uint32_t window_length1, uint32_t window_length2, float threshold1, float threshold2, float peak_height, int flag, int mini_batch_size, int n_threads, uint64_t batch_size)
 {
 
 	if(!(flag&RI_I_SIG_TARGET)) return 0;
@@ -637,6 +652,7 @@ ri_idx_t* ri_idx_siggen(ri_sig_file_t** fp, char **f, int &cur_f, int n_f, ri_po
 	pl.n_f = n_f;
 	pl.cur_f = cur_f;
 	pl.ri = ri_idx_init(diff, b, w, e, n, q, k, fine_min, fine_max, fine_range, flag);
+	if (flag&RI_I_SYNCMER) pl.ri->s = s, pl.ri->t = t;
 
 	pl.ri->pore = (ri_pore_t*)ri_kmalloc(pl.ri->km, sizeof(ri_pore_t));
 	memcpy(pl.ri->pore, pore, sizeof(ri_pore_t));
@@ -667,9 +683,9 @@ ri_idx_t* ri_idx_reader_read(ri_idx_reader_t* r, ri_pore_t* pore, int n_threads)
 	if (r->is_idx) {
 		ri = ri_idx_load(r->fp.idx);
 	} else if(r->opt.flag&RI_I_SIG_TARGET) {
-		ri = ri_idx_siggen(&(r->sfp), r->sf, r->cur_f, r->n_f, pore, r->opt.diff, r->opt.b, r->opt.w, r->opt.e, r->opt.n, r->opt.q, r->opt.k, r->opt.fine_min, r->opt.fine_max, r->opt.fine_range, r->opt.window_length1, r->opt.window_length2, r->opt.threshold1, r->opt.threshold2, r->opt.peak_height, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size);
+		ri = ri_idx_siggen(&(r->sfp), r->sf, r->cur_f, r->n_f, pore, r->opt.diff, r->opt.b, r->opt.w, r->opt.e, r->opt.n, r->opt.s, r->opt.t, r->opt.q, r->opt.k, r->opt.fine_min, r->opt.fine_max, r->opt.fine_range, r->opt.window_length1, r->opt.window_length2, r->opt.threshold1, r->opt.threshold2, r->opt.peak_height, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size);
 	} else{
-		ri = ri_idx_gen(r->fp.seq, pore, r->opt.diff, r->opt.b, r->opt.w, r->opt.e, r->opt.n, r->opt.q, r->opt.k, r->opt.fine_min, r->opt.fine_max, r->opt.fine_range, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size);
+		ri = ri_idx_gen(r->fp.seq, pore, r->opt.diff, r->opt.b, r->opt.w, r->opt.e, r->opt.n, r->opt.s, r->opt.t, r->opt.q, r->opt.k, r->opt.fine_min, r->opt.fine_max, r->opt.fine_range, r->opt.flag, r->opt.mini_batch_size, n_threads, r->opt.batch_size);
 	}
 
 	if (ri) {
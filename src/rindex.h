@@ -28,6 +28,7 @@ typedef struct ri_idx_seq_s{
 
 typedef struct ri_idx_s{
 	int32_t b, w, e, n, q, k, flag;
+	int32_t s, t; // syncmers if the flag has RI_I_SYNCMER; otherwise s=0 (see ri_sketch)
 	int32_t index;
 	float diff;
 	float fine_min, fine_max, fine_range;
@@ -115,7 +116,7 @@ int64_t ri_idx_is_idx(const char* fn);
  * @param b		defines the number of buckets to use in a hash table (2^b buckets). Usually this value is around 14.
  * @param w		window length. if w=0, the minimizer-based seeding is disabled
  * @param e		number of events to concatanate in a single hash value
- * @param n		[Currently disabled] number of items in a seed to generate a hash value for the seed using the BLEND mechanism.
+ * @param n		if n>1, number of consecutive hash values combined into the hash value of a seed using the BLEND mechanism (SimHash).
  * @param q		Most significant Q bits to use in the quantization technique. See the RawHash manuscript for details.
  * @param lq    least significant lq bits within the most significant Q bits extracted from the normalized event values.
  * 				If you want to use n as described in the RawHash manuscript, calculate lq as follows: $lq = $Q - 2 - n
@@ -13,8 +13,13 @@
 #include <math.h>
 #include <float.h>  // for FLT_MAX
 
+#define RI_MIN_BATCH_BYTES (16LL<<20) //batches are never limited below this size by the memory budget
+#define RI_ARENA_BYTES_INIT (32LL<<20) //initial estimate of the mapping buffers of a thread until a batch is mapped
+
 #ifdef PROFILERH
 double ri_filereadtime = 0.0;
+double ri_convtime = 0.0;
+uint64_t ri_convsamples = 0;
 double ri_signaltime = 0.0;
 double ri_sketchtime = 0.0;
 double ri_seedtime = 0.0;
@@ -23,7 +28,7 @@ double ri_maptime = 0.0;
 double ri_maptime_multithread = 0.0;
 #endif
 
-static ri_tbuf_t *ri_tbuf_init(void)
+ri_tbuf_t *ri_tbuf_init(void)
 {
 	ri_tbuf_t *b;
 	b = (ri_tbuf_t*)calloc(1, sizeof(ri_tbuf_t));
@@ -31,7 +36,7 @@ static ri_tbuf_t *ri_tbuf_init(void)
 	return b;
 }
 
-static void ri_tbuf_destroy(ri_tbuf_t *b)
+void ri_tbuf_destroy(ri_tbuf_t *b)
 {
 	if (b == 0) return;
 	ri_km_destroy(b->km);
@@ -188,28 +193,20 @@ void align_chain(mm_reg1_t *chain, mm128_t* anchors, const ri_idx_t *ri, const f
 	}
 }
 
-void ri_map_frag(const ri_idx_t *ri,
-				const uint32_t s_len,
-				const float *sig,
-				ri_reg1_t* reg,
-				ri_tbuf_t *b,
-				const ri_mapopt_t *opt,
-				const char *qname,
-				double* mean_sum,
-				double* std_dev_sum,
-				uint32_t* n_events_sum,
-				const uint32_t c_count = 0)
-{	
-	uint32_t n_events = 0;
-
-	#ifdef PROFILERH
-	double signal_t = ri_realtime();
-	#endif
-	float* events = detect_events(b->km, s_len, sig, opt->window_length1, opt->window_length2, opt->threshold1, opt->threshold2, opt->peak_height, mean_sum, std_dev_sum, n_events_sum, &n_events);
-	#ifdef PROFILERH
-	ri_signaltime += ri_realtime() - signal_t;
-	#endif
-
+/**
+ * Maps the events of the next chunk of a read (see ri_map_frag)
+ *
+ * @param n_events	number of events in the chunk
+ * @param events	events in the chunk. Freed with ri_kfree(b->km, ...)
+ */
+static void ri_map_events(const ri_idx_t *ri,
+						  uint32_t n_events,
+						  float *events,
+						  ri_reg1_t* reg,
+						  ri_tbuf_t *b,
+						  const ri_mapopt_t *opt,
+						  const char *qname)
+{
 	if(n_events < opt->min_events) {
 		if(events){ri_kfree(b->km, events); events = NULL;}
 		return;
@@ -227,7 +224,7 @@ void ri_map_frag(const ri_idx_t *ri,
 
 	//Sketching
 	mm128_v riv = {0,0,0};
-	ri_sketch(b->km, events, 0, 0, n_events, ri->diff, ri->w, ri->e, ri->n, ri->q, ri->k, ri->fine_min, ri->fine_max, ri->fine_range, &riv);
+	ri_sketch(b->km, events, 0, 0, n_events, ri->diff, ri->w, ri->e, ri->n, ri->s, ri->t, ri->q, ri->k, ri->fine_min, ri->fine_max, ri->fine_range, &riv);
 	
 	if(events){ri_kfree(b->km, events); events = NULL;}
 	// if (opt->q_occ_frac > 0.0f) ri_seed_mz_flt(b->km, &riv, opt->mid_occ, opt->q_occ_frac);
@@ -326,124 +323,142 @@ void ri_map_frag(const ri_idx_t *ri,
 	reg->offset += n_events;
 }
 
-static void map_worker_for(void *_data,
-						   long i,
-						   int tid) // kt_for() callback
-{
-    step_mt *s = (step_mt*)_data; //s->sig and s->n_sig (signals read in this step and num of them)
-	const ri_mapopt_t *opt = s->p->opt;
-	ri_tbuf_t* b = s->buf[tid];
-	ri_reg1_t* reg0 = s->reg[i];
-	reg0->prev_anchors = NULL, reg0->creg = NULL, reg0->events = NULL;
-	reg0->offset = 0, reg0->n_prev_anchors = 0, reg0->n_cregs = 0;
-
-	ri_sig_t* sig = s->sig[i];
-
-	uint32_t qlen = sig->l_sig;
-	uint32_t l_chunk = (opt->chunk_size > qlen)?qlen:opt->chunk_size;
-	uint32_t max_chunk =  (opt->flag&RI_M_NO_ADAPTIVE)?(qlen/(l_chunk+1))+1:opt->max_num_chunk;
-	uint32_t s_qs, s_qe = l_chunk;
-
-	uint32_t c_count = 0;
-	reg0->n_maps = 0;
-
-	double t = ri_realtime();
-
-	double mean_sum = 0, std_dev_sum = 0;
-	uint32_t n_events_sum = 0;
-
-	for (s_qs = c_count = 0; s_qs < qlen && c_count < max_chunk; s_qs += l_chunk, ++c_count) {
-		s_qe = s_qs + l_chunk;
-		if(s_qe > qlen) s_qe = qlen;
+void ri_map_frag(const ri_idx_t *ri,
+				const uint32_t s_len,
+				const float *sig,
+				ri_reg1_t* reg,
+				ri_tbuf_t *b,
+				const ri_mapopt_t *opt,
+				const char *qname,
+				ri_evdetect_t *ed,
+				const uint32_t c_count = 0)
+{	
+	uint32_t n_events = 0;
 
-		if(reg0->creg){free(reg0->creg); reg0->creg = NULL; reg0->n_cregs = 0;}
+	#ifdef PROFILERH
+	double signal_t = ri_realtime();
+	#endif
+	float* events = ri_evdetect_push(ed, b->km, s_len, sig, 0, &n_events);
+	#ifdef PROFILERH
+	ri_signaltime += ri_realtime() - signal_t;
+	#endif
 
-		ri_map_frag(s->p->ri, (const uint32_t)s_qe-s_qs, (const float*)&(sig->sig[s_qs]), reg0, b, opt, sig->name, &mean_sum, &std_dev_sum, &n_events_sum);
+	ri_map_events(ri, n_events, events, reg, b, opt, qname);
+}
 
-		int n_chains = (opt->flag&RI_M_ALL_CHAINS || reg0->n_cregs < 1)?reg0->n_cregs:1;
+/**
+ * Decides if the chains found so far are good enough to report the read as mapped
+ *
+ * @param opt	mapping options
+ * @param reg0	mapping state of the read. The chosen chains are added to reg0->maps
+ *
+ * @return		1 if the read is mapped (i.e., no more chunks are needed), 0 otherwise
+ */
+static int ri_map_decide(const ri_mapopt_t *opt, ri_reg1_t *reg0)
+{
+	int n_chains = (opt->flag&RI_M_ALL_CHAINS || reg0->n_cregs < 1)?reg0->n_cregs:1;
 
-		if (reg0->n_cregs == 1 && ((reg0->creg[0].mapq >= opt->min_mapq) || (opt->flag&RI_M_DTW_EVALUATE_CHAINS && reg0->creg[0].alignment_score >= opt->dtw_min_score))) {
-			reg0->n_maps++;
-			reg0->maps = (ri_map_t*)ri_krealloc(0, reg0->maps, reg0->n_maps*sizeof(ri_map_t));
-			reg0->maps[reg0->n_maps-1].c_id = 0;
-			break;
-		}
+	if (reg0->n_cregs == 1 && ((reg0->creg[0].mapq >= opt->min_mapq) || (opt->flag&RI_M_DTW_EVALUATE_CHAINS && reg0->creg[0].alignment_score >= opt->dtw_min_score))) {
+		reg0->n_maps++;
+		reg0->maps = (ri_map_t*)ri_krealloc(0, reg0->maps, reg0->n_maps*sizeof(ri_map_t));
+		reg0->maps[reg0->n_maps-1].c_id = 0;
+		return 1;
+	}
 
-		//TODO make n_cregs a parameter of best n mappings
-		float meanC = 0, meanQ = 0;
-		// if(opt->flag&RI_M_DTW_EVALUATE_CHAINS){
-		// 	uint32_t chain_cnt = 0;
-		// 	for (uint32_t c_ind = 0; c_ind < reg0->n_cregs; ++c_ind){
-		// 		if(reg0->creg[c_ind].alignment_score < opt->dtw_min_score) continue;
-		// 		chain_cnt++;
-		// 		meanC += reg0->creg[c_ind].score;
-		// 		meanQ += reg0->creg[c_ind].mapq;
-		// 		// meanA += reg0->creg[c_ind].alignment_score;
-		// 	}
-		// 	if(chain_cnt){meanC /= chain_cnt; meanQ /= chain_cnt;}
-		// }
-		// else{
-		for (int32_t c_ind = 0; c_ind < reg0->n_cregs; ++c_ind){
-			meanC += reg0->creg[c_ind].score;
-			meanQ += reg0->creg[c_ind].mapq;
-		}
-		if(reg0->n_cregs > 0){meanC /= reg0->n_cregs; meanQ /= reg0->n_cregs;}
-		// }
-		
-		for(int ic = 0; ic < n_chains; ++ic){
-			float r_bestma = 0.0f, r_bestmq = 0.0f, r_bestmc = 0.0f, r_bestq = 0.0f;
-			float bestQ = 0.0f, bestC = 0.0f, bestA = 0.0f, weighted_sum = 0.0f;
-			bestQ = reg0->creg[ic].mapq;
-			bestC = reg0->creg[ic].score;
-
-			if(opt->flag&RI_M_DTW_EVALUATE_CHAINS){
-				bestA = reg0->creg[ic].alignment_score;
-				if(n_chains == 1){ //no all-vs-all overlap mod
-					uint32_t best_ind = 0;
-					for(int i = 1; i < reg0->n_cregs; ++i){
-						if(reg0->creg[i].alignment_score > bestA){
-							bestA = reg0->creg[i].alignment_score;
-							best_ind = i;
-						}
+	//TODO make n_cregs a parameter of best n mappings
+	float meanC = 0, meanQ = 0;
+	// if(opt->flag&RI_M_DTW_EVALUATE_CHAINS){
+	// 	uint32_t chain_cnt = 0;
+	// 	for (uint32_t c_ind = 0; c_ind < reg0->n_cregs; ++c_ind){
+	// 		if(reg0->creg[c_ind].alignment_score < opt->dtw_min_score) continue;
+	// 		chain_cnt++;
+	// 		meanC += reg0->creg[c_ind].score;
+	// 		meanQ += reg0->creg[c_ind].mapq;
+	// 		// meanA += reg0->creg[c_ind].alignment_score;
+	// 	}
+	// 	if(chain_cnt){meanC /= chain_cnt; meanQ /= chain_cnt;}
+	// }
+	// else{
+	for (int32_t c_ind = 0; c_ind < reg0->n_cregs; ++c_ind){
+		meanC += reg0->creg[c_ind].score;
+		meanQ += reg0->creg[c_ind].mapq;
+	}
+	if(reg0->n_cregs > 0){meanC /= reg0->n_cregs; meanQ /= reg0->n_cregs;}
+	// }
+	
+	for(int ic = 0; ic < n_chains; ++ic){
+		float r_bestma = 0.0f, r_bestmq = 0.0f, r_bestmc = 0.0f, r_bestq = 0.0f;
+		float bestQ = 0.0f, bestC = 0.0f, bestA = 0.0f, weighted_sum = 0.0f;
+		bestQ = reg0->creg[ic].mapq;
+		bestC = reg0->creg[ic].score;
+
+		if(opt->flag&RI_M_DTW_EVALUATE_CHAINS){
+			bestA = reg0->creg[ic].alignment_score;
+			if(n_chains == 1){ //no all-vs-all overlap mod
+				uint32_t best_ind = 0;
+				for(int i = 1; i < reg0->n_cregs; ++i){
+					if(reg0->creg[i].alignment_score > bestA){
+						bestA = reg0->creg[i].alignment_score;
+						best_ind = i;
 					}
-					ic = best_ind;
-					bestQ = reg0->creg[ic].mapq;
-					bestC = reg0->creg[ic].score;
-				}
-				if(bestA >= opt->dtw_min_score){
-					// r_bestma = (bestA > 0)?(1.0f - (meanA/bestA)):0.0f; if(r_bestma < 0) r_bestma = 0.0f;
-					r_bestma = (bestA > 0)?(bestA/50.0f):0.0f; if(r_bestma < 0) r_bestma = 0.0f;
-					r_bestmq = (bestQ > 0)?(1.0f - (meanQ/bestQ)):0.0f; if(r_bestmq < 0) r_bestmq = 0.0f;
-					r_bestmc = (bestC > 0)?(1.0f - (meanC/bestC)):0.0f; if(r_bestmc < 0) r_bestmc = 0.0f;
-
-					weighted_sum = opt->w_bestma*r_bestma + opt->w_bestmq*r_bestmq + opt->w_bestmc*r_bestmc;
 				}
-			}else{
-				r_bestq = (bestQ > 0)?(bestQ/30.0f):0.0f; if(r_bestq > 1) r_bestq = 1.0f;
+				ic = best_ind;
+				bestQ = reg0->creg[ic].mapq;
+				bestC = reg0->creg[ic].score;
+			}
+			if(bestA >= opt->dtw_min_score){
+				// r_bestma = (bestA > 0)?(1.0f - (meanA/bestA)):0.0f; if(r_bestma < 0) r_bestma = 0.0f;
+				r_bestma = (bestA > 0)?(bestA/50.0f):0.0f; if(r_bestma < 0) r_bestma = 0.0f;
 				r_bestmq = (bestQ > 0)?(1.0f - (meanQ/bestQ)):0.0f; if(r_bestmq < 0) r_bestmq = 0.0f;
 				r_bestmc = (bestC > 0)?(1.0f - (meanC/bestC)):0.0f; if(r_bestmc < 0) r_bestmc = 0.0f;
 
-				weighted_sum = opt->w_bestq*r_bestq + opt->w_bestmq*r_bestmq + opt->w_bestmc*r_bestmc;
+				weighted_sum = opt->w_bestma*r_bestma + opt->w_bestmq*r_bestmq + opt->w_bestmc*r_bestmc;
 			}
-			
-			// Compare the weighted sum against a threshold to make the decision
-			if (weighted_sum >= opt->w_threshold) {
-				reg0->n_maps++;
-				reg0->maps = (ri_map_t*)ri_krealloc(0, reg0->maps, reg0->n_maps*sizeof(ri_map_t));
-				reg0->maps[reg0->n_maps-1].c_id = ic;
-				// fprintf(stderr, "Aligned ic: %d\n", ic);
-			}
-		}
+		}else{
+			r_bestq = (bestQ > 0)?(bestQ/30.0f):0.0f; if(r_bestq > 1) r_bestq = 1.0f;
+			r_bestmq = (bestQ > 0)?(1.0f - (meanQ/bestQ)):0.0f; if(r_bestmq < 0) r_bestmq = 0.0f;
+			r_bestmc = (bestC > 0)?(1.0f - (meanC/bestC)):0.0f; if(r_bestmc < 0) r_bestmc = 0.0f;
 
-		if(reg0->n_maps > 0) break;
-	} double mapping_time = ri_realtime() - t;
-
-	#ifdef PROFILERH
-	ri_maptime += mapping_time;
-	#endif
+			weighted_sum = opt->w_bestq*r_bestq + opt->w_bestmq*r_bestmq + opt->w_bestmc*r_bestmc;
+		}
+		
+		// Compare the weighted sum against a threshold to make the decision
+		if (weighted_sum >= opt->w_threshold) {
+			reg0->n_maps++;
+			reg0->maps = (ri_map_t*)ri_krealloc(0, reg0->maps, reg0->n_maps*sizeof(ri_map_t));
+			reg0->maps[reg0->n_maps-1].c_id = ic;
+			// fprintf(stderr, "Aligned ic: %d\n", ic);
+		}
+	}
 
-	if (c_count > 0 && (s_qs >= qlen || c_count == max_chunk)) --c_count;
+	return reg0->n_maps > 0;
+}
 
+/**
+ * Fills the mappings of a read (reg0->maps) once no more chunks are going to be mapped
+ *
+ * @param ri			index
+ * @param opt			mapping options
+ * @param reg0			mapping state of the read (see ri_map_decide)
+ * @param rid			read id
+ * @param name			read name
+ * @param qlen			number of signal values of the read that are loaded
+ * @param l_chunk		number of signal values in a chunk
+ * @param c_count		index of the last mapped chunk
+ * @param trim			number of signal values skipped at the start of the read (see RI_M_TRIM_STALL)
+ * @param mapping_time	time spent mapping the read (in seconds)
+ */
+static void ri_map_finalize(const ri_idx_t *ri,
+							const ri_mapopt_t *opt,
+							ri_reg1_t *reg0,
+							uint32_t rid,
+							const char *name,
+							uint32_t qlen,
+							uint32_t l_chunk,
+							uint32_t c_count,
+							uint32_t trim,
+							double mapping_time)
+{
 	float read_position_scale = (reg0->offset == 0)?0.0f:(opt->sample_per_base == 0)?0.0f:((float)(c_count+1)*l_chunk/reg0->offset)/opt->sample_per_base;
 	mm_reg1_t* chains = reg0->creg;
 
@@ -465,6 +480,7 @@ static void map_worker_for(void *_data,
 		sprintf(buffer, "mt:f:%.6f", mapping_time * 1000); strcat(tags, buffer);
 		sprintf(buffer, "\tci:i:%d", c_count + 1); strcat(tags, buffer);
 		sprintf(buffer, "\tsl:i:%d", qlen); strcat(tags, buffer);
+		if (opt->flag&RI_M_TRIM_STALL) {sprintf(buffer, "\tts:i:%u", trim); strcat(tags, buffer);}
 		if (reg0->n_cregs >= 1) {
 			sprintf(buffer, "\tcm:i:%d", chains[0].cnt); strcat(tags, buffer);
 			sprintf(buffer, "\tnc:i:%d", reg0->n_cregs); strcat(tags, buffer);
@@ -479,9 +495,9 @@ static void map_worker_for(void *_data,
 			sprintf(buffer, "\tsm:f:0"); strcat(tags, buffer);
 		}
 
-		reg0->read_id = sig->rid;
-		reg0->read_name = sig->name;
-		reg0->maps[0].read_length = (s->p->ri->flag&RI_I_SIG_TARGET)?reg0->offset:(uint32_t)(read_position_scale * reg0->offset);
+		reg0->read_id = rid;
+		reg0->read_name = name;
+		reg0->maps[0].read_length = (ri->flag&RI_I_SIG_TARGET)?reg0->offset:(uint32_t)(read_position_scale * reg0->offset);
 		reg0->maps[0].c_id = 0;
 		reg0->maps[0].ref_id = 0;
 		reg0->maps[0].read_start_position = 0;
@@ -501,20 +517,21 @@ static void map_worker_for(void *_data,
 			sprintf(buffer, "mt:f:%.6f", mapping_time * 1000); strcat(tags, buffer);
 			sprintf(buffer, "\tci:i:%d", c_count + 1); strcat(tags, buffer);
 			sprintf(buffer, "\tsl:i:%d", qlen); strcat(tags, buffer);
+			if (opt->flag&RI_M_TRIM_STALL) {sprintf(buffer, "\tts:i:%u", trim); strcat(tags, buffer);}
 			sprintf(buffer, "\tcm:i:%d", chains[c_id].cnt); strcat(tags, buffer);
 			sprintf(buffer, "\tnc:i:%d", reg0->n_cregs); strcat(tags, buffer);
 			sprintf(buffer, "\ts1:i:%d", chains[c_id].score); strcat(tags, buffer);
 			// sprintf(buffer, "\ts2:i:%d", reg0->n_cregs > 1 ? chains[1].score : 0); strcat(tags, buffer);
 			sprintf(buffer, "\tsm:f:%.2f", mean_chain_score); strcat(tags, buffer);
 
-			reg0->read_id = sig->rid;
-			reg0->read_name = sig->name;
-			reg0->maps[m].read_length = (s->p->ri->flag&RI_I_SIG_TARGET)?(reg0->offset):(uint32_t)(read_position_scale*chains[c_id].qe);
+			reg0->read_id = rid;
+			reg0->read_name = name;
+			reg0->maps[m].read_length = (ri->flag&RI_I_SIG_TARGET)?(reg0->offset):(uint32_t)(read_position_scale*chains[c_id].qe);
 			reg0->maps[m].ref_id = chains[c_id].rid;
-			reg0->maps[m].read_start_position = (s->p->ri->flag&RI_I_SIG_TARGET)?chains[c_id].qs:(uint32_t)(read_position_scale*chains[c_id].qs);
-			reg0->maps[m].read_end_position = (s->p->ri->flag&RI_I_SIG_TARGET)?chains[c_id].qe:(uint32_t)(read_position_scale*chains[c_id].qe);
-			if(s->p->ri->flag&RI_I_SIG_TARGET) reg0->maps[m].fragment_start_position = chains[c_id].rev?(uint32_t)(s->p->ri->sig[chains[c_id].rid].l_sig+1-chains[c_id].re):chains[c_id].rs;
-			else reg0->maps[m].fragment_start_position = chains[c_id].rev?(uint32_t)(s->p->ri->seq[chains[c_id].rid].len+1-chains[c_id].re):chains[c_id].rs;
+			reg0->maps[m].read_start_position = (ri->flag&RI_I_SIG_TARGET)?chains[c_id].qs:(uint32_t)(read_position_scale*chains[c_id].qs);
+			reg0->maps[m].read_end_position = (ri->flag&RI_I_SIG_TARGET)?chains[c_id].qe:(uint32_t)(read_position_scale*chains[c_id].qe);
+			if(ri->flag&RI_I_SIG_TARGET) reg0->maps[m].fragment_start_position = chains[c_id].rev?(uint32_t)(ri->sig[chains[c_id].rid].l_sig+1-chains[c_id].re):chains[c_id].rs;
+			else reg0->maps[m].fragment_start_position = chains[c_id].rev?(uint32_t)(ri->seq[chains[c_id].rid].len+1-chains[c_id].re):chains[c_id].rs;
 			reg0->maps[m].fragment_length = (uint32_t)(chains[c_id].re - chains[c_id].rs + 1);
 			reg0->maps[m].mapq = chains[c_id].mapq;
 			reg0->maps[m].rev = (chains[c_id].rev == 1)?1:0;
@@ -522,20 +539,404 @@ static void map_worker_for(void *_data,
 			reg0->maps[m].tags = tags;
 		}
 	}
+}
+
+//Mapping state of a read that is mapped chunk by chunk in a worker thread
+typedef struct ri_read_map_s {
+	ri_sig_t *sig;
+	ri_reg1_t *reg0;
+	ri_evdetect_t *ed; //event detection continues from where the previous chunk left off
+	float *chunk; //raw samples are converted into pA one chunk at a time
+	int16_t *ichunk; //or kept as integer samples if the events are detected with fixed-point arithmetic (see RI_M_SEG_FIXED)
+	uint64_t raw_pos;
+	uint32_t qlen, l_chunk, max_chunk;
+	uint32_t s_qs, c_count; //start of the next chunk and its index
+	uint32_t trim; //number of signal values of the stall that are not mapped (see map_read_trim)
+	double t; //time when the mapping started
+} ri_read_map_t;
+
+#define RI_TRIM_WINDOW 100 //the stall is found in windows of this many signal values (see ri_detect_stall)
+
+/**
+ * Skips the stall at the start of a read so that its first chunk starts with the strand. Up to $opt->trim_max signal
+ * values and the window after them are converted to find the stall; the chunks convert again from the window where
+ * the stall ends
+ */
+static void map_read_trim(ri_read_map_t *r, const ri_mapopt_t *opt, void *km)
+{
+	ri_sig_t *sig = r->sig;
+	const uint32_t w = RI_TRIM_WINDOW;
+	uint32_t n_win = opt->trim_max / w + 1;
+	if(n_win*w > r->qlen && sig->fn) r->qlen += ri_read_sig_more(sig, n_win*w - r->qlen);
+	if(n_win*w > r->qlen) n_win = r->qlen / w;
+	if(n_win == 0) return;
+
+	float *buf = (float*)ri_kmalloc(km, n_win*w*sizeof(float));
+	uint64_t *win_pos = (uint64_t*)ri_kmalloc(km, (n_win+1)*sizeof(uint64_t)); //raw sample where each window starts
+	uint32_t n = 0;
+	win_pos[0] = r->raw_pos;
+	for(uint32_t i = 0; i < n_win; ++i){
+		win_pos[i+1] = win_pos[i];
+		n += ri_sig_convert(sig, &win_pos[i+1], w, buf + n);
+		if(n < (i+1)*w) break;
+	}
+
+	uint32_t trim = ri_detect_stall(buf, n, w, opt->trim_sd);
+	if(trim > opt->trim_max) trim = opt->trim_max / w * w;
+	if(trim){
+		r->raw_pos = win_pos[trim / w];
+		r->s_qs = r->trim = trim;
+	}
+	ri_kfree(km, buf); ri_kfree(km, win_pos);
+}
+
+static void map_read_init(ri_read_map_t *r, ri_sig_t *sig, ri_reg1_t *reg0, const ri_mapopt_t *opt, void *km)
+{
+	reg0->prev_anchors = NULL, reg0->creg = NULL, reg0->events = NULL;
+	reg0->offset = 0, reg0->n_prev_anchors = 0, reg0->n_cregs = 0;
+	reg0->n_maps = 0;
+
+	r->sig = sig, r->reg0 = reg0;
+	r->qlen = sig->l_sig;
+	r->l_chunk = (opt->chunk_size > r->qlen)?r->qlen:opt->chunk_size;
+	r->max_chunk = (opt->flag&RI_M_NO_ADAPTIVE)?(r->qlen/(r->l_chunk+1))+1:opt->max_num_chunk;
+	r->s_qs = r->c_count = 0;
+	r->trim = 0;
+	r->t = ri_realtime();
+
+	r->ed = ri_evdetect_init(opt->window_length1, opt->window_length2, opt->threshold1, opt->threshold2, opt->peak_height);
+	if (opt->flag&RI_M_SEG_ROBUST) ri_evdetect_set_robust(r->ed);
+	r->raw_pos = 0;
+	r->chunk = 0, r->ichunk = 0;
+	int16_t lo, hi;
+	if ((opt->flag&RI_M_SEG_FIXED) && ri_sig_range_i16(sig, &lo, &hi) && ri_evdetect_set_fixed(r->ed, lo, hi))
+		r->ichunk = (int16_t*)ri_kmalloc(km, r->l_chunk*sizeof(int16_t));
+	else r->chunk = (float*)ri_kmalloc(km, r->l_chunk*sizeof(float));
+
+	if (opt->flag&RI_M_TRIM_STALL) map_read_trim(r, opt, km);
+}
+
+/**
+ * Converts the next chunk of a read into $r->chunk
+ *
+ * @return	number of signal values in the chunk. 0 if there are no more chunks to map
+ */
+static uint32_t map_read_chunk(ri_read_map_t *r)
+{
+	ri_sig_t *sig = r->sig;
+	ri_reg1_t *reg0 = r->reg0;
+
+	if (r->c_count >= r->max_chunk) return 0;
+	//Reads more signal values if only a prefix of the read is loaded
+	if(r->s_qs + r->l_chunk > r->qlen && sig->fn) r->qlen += ri_read_sig_more(sig, r->s_qs + r->l_chunk - r->qlen);
+	if(r->s_qs >= r->qlen) return 0;
+
+	uint32_t s_qe = r->s_qs + r->l_chunk;
+	if(s_qe > r->qlen) s_qe = r->qlen;
 
-	if(reg0->prev_anchors) {ri_kfree(b->km, reg0->prev_anchors); reg0->prev_anchors = NULL; reg0->n_prev_anchors = 0;}
 	if(reg0->creg){free(reg0->creg); reg0->creg = NULL; reg0->n_cregs = 0;}
-	if(reg0->events){ri_kfree(b->km, reg0->events); reg0->events = NULL; reg0->offset = 0;}
 
+	#ifdef PROFILERH
+	double conv_t = ri_realtime();
+	uint64_t conv_pos = r->raw_pos;
+	#endif
+	if (r->ichunk) ri_sig_convert_i16(sig, &r->raw_pos, s_qe-r->s_qs, r->ichunk);
+	else ri_sig_convert(sig, &r->raw_pos, s_qe-r->s_qs, r->chunk);
+	#ifdef PROFILERH
+	ri_convtime += ri_realtime() - conv_t;
+	ri_convsamples += r->raw_pos - conv_pos;
+	#endif
+	return s_qe-r->s_qs;
+}
+
+static void map_read_finish(ri_read_map_t *r, const ri_idx_t *ri, const ri_mapopt_t *opt, void *km)
+{
+	ri_reg1_t *reg0 = r->reg0;
+	double mapping_time = ri_realtime() - r->t;
+	ri_kfree(km, r->chunk); ri_kfree(km, r->ichunk);
+	ri_evdetect_destroy(r->ed);
+
+	#ifdef PROFILERH
+	ri_maptime += mapping_time;
+	#endif
+
+	uint32_t c_count = r->c_count;
+	if (c_count > 0 && (r->s_qs >= r->qlen || c_count == r->max_chunk)) --c_count;
+
+	ri_map_finalize(ri, opt, reg0, r->sig->rid, r->sig->name, r->qlen, r->l_chunk, c_count, r->trim, mapping_time);
+
+	if(reg0->prev_anchors) {ri_kfree(km, reg0->prev_anchors); reg0->prev_anchors = NULL; reg0->n_prev_anchors = 0;}
+	if(reg0->creg){free(reg0->creg); reg0->creg = NULL; reg0->n_cregs = 0;}
+	if(reg0->events){ri_kfree(km, reg0->events); reg0->events = NULL; reg0->offset = 0;}
+}
+
+//Maps the chunk of $l signal values that map_read_chunk converted
+static void map_read_frag(ri_read_map_t *r, uint32_t l, const ri_idx_t *ri, ri_tbuf_t *b, const ri_mapopt_t *opt)
+{
+	if (!r->ichunk) {ri_map_frag(ri, l, (const float*)r->chunk, r->reg0, b, opt, r->sig->name, r->ed); return;}
+
+	uint32_t n_events = 0;
+	#ifdef PROFILERH
+	double signal_t = ri_realtime();
+	#endif
+	float* events = ri_evdetect_push_i16(r->ed, b->km, l, r->ichunk, 0, &n_events);
+	#ifdef PROFILERH
+	ri_signaltime += ri_realtime() - signal_t;
+	#endif
+	ri_map_events(ri, n_events, events, r->reg0, b, opt, r->sig->name);
+}
+
+static void map_reset_km(ri_tbuf_t *b)
+{
 	if (b->km) {
 		ri_km_stat_t kmst;
 		ri_km_stat(b->km, &kmst);
+		if (kmst.capacity > b->peak_km) b->peak_km = kmst.capacity;
 		// assert(kmst.n_blocks == kmst.n_cores);
 		ri_km_destroy(b->km);
 		b->km = ri_km_init();
 	}
 }
 
+static void map_worker_for(void *_data,
+						   long i,
+						   int tid) // kt_for() callback
+{
+    step_mt *s = (step_mt*)_data; //s->sig and s->n_sig (signals read in this step and num of them)
+	const ri_mapopt_t *opt = s->p->opt;
+	ri_tbuf_t* b = s->buf[tid];
+	ri_read_map_t r;
+	uint32_t l;
+
+	map_read_init(&r, s->sig[i], s->reg[i], opt, b->km);
+	for (; (l = map_read_chunk(&r)) > 0; r.s_qs += r.l_chunk, ++r.c_count) {
+		map_read_frag(&r, l, s->p->ri, b, opt);
+		if (ri_map_decide(opt, r.reg0)) break;
+	}
+	map_read_finish(&r, s->p->ri, opt, b->km);
+	map_reset_km(b);
+}
+
+/**
+ * Maps a group of up to $opt->event_batch reads chunk by chunk in lockstep. The events of the chunks of all the reads
+ * that are still being mapped are detected together (see ri_evdetect_push_batch). The mapping time of a read includes
+ * the time spent on the other reads of the group
+ */
+static void map_worker_batch(void *_data,
+							 long g,
+							 int tid) // kt_for() callback
+{
+	step_mt *s = (step_mt*)_data;
+	const ri_mapopt_t *opt = s->p->opt;
+	ri_tbuf_t* b = s->buf[tid];
+	const uint32_t i0 = (uint32_t)g * opt->event_batch;
+	const uint32_t n = (uint32_t)s->n_sig - i0 < (uint32_t)opt->event_batch? (uint32_t)s->n_sig - i0 : (uint32_t)opt->event_batch;
+
+	ri_read_map_t *r = (ri_read_map_t*)ri_kmalloc(b->km, n * sizeof(ri_read_map_t));
+	uint32_t *act = (uint32_t*)ri_kmalloc(b->km, n * sizeof(uint32_t)); //reads that are still being mapped
+	uint32_t *s_len = (uint32_t*)ri_kmalloc(b->km, n * sizeof(uint32_t));
+	const float **chunks = (const float**)ri_kmalloc(b->km, n * sizeof(float*));
+	ri_evdetect_t **ed = (ri_evdetect_t**)ri_kmalloc(b->km, n * sizeof(ri_evdetect_t*));
+	float **events = (float**)ri_kmalloc(b->km, n * sizeof(float*));
+	uint32_t *n_events = (uint32_t*)ri_kmalloc(b->km, n * sizeof(uint32_t));
+
+	for (uint32_t j = 0; j < n; ++j) map_read_init(&r[j], s->sig[i0+j], s->reg[i0+j], opt, b->km);
+
+	uint32_t n_act = 0;
+	for (uint32_t j = 0; j < n; ++j) {
+		if ((s_len[n_act] = map_read_chunk(&r[j])) > 0) act[n_act++] = j;
+		else map_read_finish(&r[j], s->p->ri, opt, b->km);
+	}
+
+	while (n_act > 0) {
+		for (uint32_t a = 0; a < n_act; ++a) ed[a] = r[act[a]].ed, chunks[a] = r[act[a]].chunk;
+
+		#ifdef PROFILERH
+		double signal_t = ri_realtime();
+		#endif
+		ri_evdetect_push_batch(ed, b->km, n_act, s_len, chunks, 0, events, n_events);
+		#ifdef PROFILERH
+		ri_signaltime += ri_realtime() - signal_t;
+		#endif
+
+		uint32_t n_next = 0;
+		for (uint32_t a = 0; a < n_act; ++a) {
+			ri_read_map_t *rj = &r[act[a]];
+			ri_map_events(s->p->ri, n_events[a], events[a], rj->reg0, b, opt, rj->sig->name);
+			if (!ri_map_decide(opt, rj->reg0)) {
+				rj->s_qs += rj->l_chunk, ++rj->c_count;
+				if ((s_len[n_next] = map_read_chunk(rj)) > 0) {act[n_next++] = act[a]; continue;}
+			}
+			map_read_finish(rj, s->p->ri, opt, b->km);
+		}
+		n_act = n_next;
+	}
+
+	ri_kfree(b->km, r); ri_kfree(b->km, act); ri_kfree(b->km, s_len); ri_kfree(b->km, chunks);
+	ri_kfree(b->km, ed); ri_kfree(b->km, events); ri_kfree(b->km, n_events);
+	map_reset_km(b);
+}
+
+struct ri_stream_s{
+	const ri_idx_t *ri;
+	const ri_mapopt_t *opt;
+	ri_reg1_t reg; //mapping state. reg.prev_anchors and reg.events are kept in the heap between the calls
+	char *name;
+	float *chunk; //signal values received but not mapped yet (less than a chunk)
+	uint32_t l_chunk; //number of signal values in $chunk
+	uint32_t c_count; //number of chunks mapped
+	uint32_t qlen; //number of signal values received
+	ri_evdetect_t *ed; //event detection state between the chunks
+	double mapping_time;
+	int status;
+};
+
+//Moves a buffer between two memory pools. The per-read buffers are kept in the heap between the calls so that the
+//read can be mapped with a different thread buffer in every call
+static void *ri_stream_move(void *km_dst, void *km_src, void *p, size_t size)
+{
+	void *q;
+	if (p == 0) return 0;
+	q = ri_kmalloc(km_dst, size);
+	memcpy(q, p, size);
+	ri_kfree(km_src, p);
+	return q;
+}
+
+static void ri_stream_load(ri_stream_t *st, void *km)
+{
+	st->reg.prev_anchors = (mm128_t*)ri_stream_move(km, 0, st->reg.prev_anchors, st->reg.n_prev_anchors*sizeof(mm128_t));
+	st->reg.events = (float*)ri_stream_move(km, 0, st->reg.events, st->reg.offset*sizeof(float));
+}
+
+static void ri_stream_save(ri_stream_t *st, void *km)
+{
+	st->reg.prev_anchors = (mm128_t*)ri_stream_move(0, km, st->reg.prev_anchors, st->reg.n_prev_anchors*sizeof(mm128_t));
+	st->reg.events = (float*)ri_stream_move(0, km, st->reg.events, st->reg.offset*sizeof(float));
+}
+
+static void ri_stream_map_chunk(ri_stream_t *st, ri_tbuf_t *b)
+{
+	const ri_mapopt_t *opt = st->opt;
+	ri_reg1_t *reg0 = &st->reg;
+
+	if(reg0->creg){free(reg0->creg); reg0->creg = NULL; reg0->n_cregs = 0;}
+	ri_map_frag(st->ri, st->l_chunk, st->chunk, reg0, b, opt, st->name, st->ed);
+	st->l_chunk = 0;
+	++st->c_count;
+
+	if (ri_map_decide(opt, reg0)) st->status = RI_STREAM_MAPPED;
+	else if (!(opt->flag&RI_M_NO_ADAPTIVE) && st->c_count >= opt->max_num_chunk) st->status = RI_STREAM_UNMAPPED;
+}
+
+static void ri_stream_finalize(ri_stream_t *st)
+{
+	ri_reg1_t *reg0 = &st->reg;
+	uint32_t l_chunk = (st->opt->chunk_size > st->qlen)?st->qlen:st->opt->chunk_size;
+
+	#ifdef PROFILERH
+	ri_maptime += st->mapping_time;
+	#endif
+
+	ri_map_finalize(st->ri, st->opt, reg0, reg0->read_id, st->name, st->qlen, l_chunk, st->c_count? st->c_count-1 : 0, 0, st->mapping_time);
+	st->status = (reg0->n_maps > 0 && reg0->maps[0].mapped)? RI_STREAM_MAPPED : RI_STREAM_UNMAPPED;
+
+	if(reg0->prev_anchors) {free(reg0->prev_anchors); reg0->prev_anchors = NULL; reg0->n_prev_anchors = 0;}
+	if(reg0->creg){free(reg0->creg); reg0->creg = NULL; reg0->n_cregs = 0;}
+	if(reg0->events){free(reg0->events); reg0->events = NULL;}
+}
+
+ri_stream_t *ri_stream_open(const ri_idx_t *ri, const ri_mapopt_t *opt, uint32_t rid, const char *name)
+{
+	ri_stream_t *st = (ri_stream_t*)calloc(1, sizeof(ri_stream_t));
+	st->ri = ri;
+	st->opt = opt;
+	st->name = strdup(name? name : "");
+	st->chunk = (float*)malloc(opt->chunk_size * sizeof(float));
+	st->ed = ri_evdetect_init(opt->window_length1, opt->window_length2, opt->threshold1, opt->threshold2, opt->peak_height);
+	if (opt->flag&RI_M_SEG_ROBUST) ri_evdetect_set_robust(st->ed);
+	st->reg.read_id = rid;
+	st->reg.read_name = st->name;
+	st->status = RI_STREAM_MORE;
+	return st;
+}
+
+int ri_stream_push(ri_stream_t *st, ri_tbuf_t *b, const float *sig, uint32_t n)
+{
+	if (st->status != RI_STREAM_MORE) return st->status;
+
+	double t = ri_realtime();
+	ri_stream_load(st, b->km);
+	while (n > 0 && st->status == RI_STREAM_MORE) {
+		uint32_t l = st->opt->chunk_size - st->l_chunk;
+		if (l > n) l = n;
+		memcpy(st->chunk + st->l_chunk, sig, l * sizeof(float));
+		st->l_chunk += l, st->qlen += l;
+		sig += l, n -= l;
+		if (st->l_chunk == st->opt->chunk_size) ri_stream_map_chunk(st, b);
+	}
+	ri_stream_save(st, b->km);
+	st->mapping_time += ri_realtime() - t;
+
+	if (st->status != RI_STREAM_MORE) ri_stream_finalize(st);
+	return st->status;
+}
+
+int ri_stream_finish(ri_stream_t *st, ri_tbuf_t *b)
+{
+	if (st->status != RI_STREAM_MORE) return st->status;
+
+	double t = ri_realtime();
+	if (st->l_chunk > 0) {
+		ri_stream_load(st, b->km);
+		ri_stream_map_chunk(st, b);
+		ri_stream_save(st, b->km);
+	}
+	st->mapping_time += ri_realtime() - t;
+
+	ri_stream_finalize(st);
+	return st->status;
+}
+
+const ri_reg1_t *ri_stream_reg(const ri_stream_t *st)
+{
+	return st->status == RI_STREAM_MORE? 0 : &st->reg;
+}
+
+void ri_stream_close(ri_stream_t *st)
+{
+	if (st == 0) return;
+	ri_reg1_t *reg0 = &st->reg;
+	for (uint32_t m = 0; m < reg0->n_maps; ++m)
+		if (reg0->maps[m].tags) free(reg0->maps[m].tags);
+	//an unmapped read has a single entry in reg0->maps with n_maps = 0
+	if (reg0->n_maps == 0 && reg0->maps && reg0->maps[0].tags) free(reg0->maps[0].tags);
+	if (reg0->maps) free(reg0->maps);
+	if (reg0->prev_anchors) free(reg0->prev_anchors);
+	if (reg0->creg) free(reg0->creg);
+	if (reg0->events) free(reg0->events);
+	ri_evdetect_destroy(st->ed);
+	free(st->chunk);
+	free(st->name);
+	free(st);
+}
+
+//Memory that a read takes in a batch until its mapping is written
+static inline int64_t ri_sig_bytes(const ri_sig_t *s)
+{
+	return s->m_raw * sizeof(int16_t) + sizeof(ri_sig_t) + sizeof(ri_reg1_t) + (s->name? strlen(s->name) + 1 : 0);
+}
+
+//Splits the memory budget among the batches in flight. A batch is mapped while the next one is read, and about as
+//many reads are kept in the prefetch queue. The per-thread mapping buffers of the batch being mapped come on top
+static void ri_update_batch_bytes(pipeline_mt *pl)
+{
+	if (!pl->mem_budget) { pl->batch_bytes = 0; return; }
+	int64_t b = (pl->mem_budget - pl->arena_bytes) / 3;
+	pl->batch_bytes = b > RI_MIN_BATCH_BYTES? b : RI_MIN_BATCH_BYTES;
+	if (pl->pf) ri_prefetch_set_max_bytes(pl->pf, pl->batch_bytes);
+}
+
 ri_sig_t** ri_sig_read_frag(pipeline_mt *pl,
 							int64_t chunk_size,
 							int *n_)
@@ -546,16 +947,28 @@ ri_sig_t** ri_sig_read_frag(pipeline_mt *pl,
 	//Debugging for sweeping purposes
 	// if(pl->su_nreads >= 1000) return 0;
 
-	int64_t size = 0;
+	int64_t size = 0, bytes = 0, max_bytes = pl->batch_bytes;
 	rhsig_v rsigv = {0,0,0};
 	rh_kv_resize(ri_sig_t*, 0, rsigv, 4000);
 
-	while (pl->fp) {
+	//Reads are already decoded by the prefetch threads
+	if(pl->pf){
+		ri_sig_t *s;
+		while((s = ri_prefetch_read(pl->pf))){
+			rh_kv_push(ri_sig_t*, 0, rsigv, s);
+			size += s->l_sig;
+			bytes += ri_sig_bytes(s);
+			if(size >= chunk_size || (max_bytes && bytes >= max_bytes)) break;
+		}
+	}
+
+	while (!pl->pf && pl->fp) {
 		//Reading data in bulk if the buffer is emptied
 		while(pl->fp && pl->fp->cur_read == pl->fp->num_read){
 			ri_sig_close(pl->fp);
 			if(pl->cur_f < pl->n_f){
 				if((pl->fp = open_sig(pl->f[pl->cur_f++])) == 0) break;
+				pl->fp->max_sig = pl->max_sig; pl->fp->n_threads = pl->opt->n_decode_threads;
 			}else if(pl->cur_fp < pl->n_fp){
 				if(pl->f){
 					for(int i = 0; i < pl->n_f; ++i) 
@@ -569,6 +982,7 @@ ri_sig_t** ri_sig_read_frag(pipeline_mt *pl,
 				find_sfiles(pl->fn[pl->cur_fp++], &fnames);
 				pl->f =  fnames.a;
 				if(!fnames.n || ((pl->fp = open_sig(pl->f[pl->cur_f++])) == 0)) break;
+				pl->fp->max_sig = pl->max_sig; pl->fp->n_threads = pl->opt->n_decode_threads;
 				pl->n_f = fnames.n;
 				// ++n_read;
 			}else {pl->fp = 0; break;}
@@ -577,11 +991,14 @@ ri_sig_t** ri_sig_read_frag(pipeline_mt *pl,
 		if(!pl->fp || pl->fp->cur_read == pl->fp->num_read) break;
 		
 		ri_sig_t *s = (ri_sig_t*)calloc(1, sizeof(ri_sig_t));
-		rh_kv_push(ri_sig_t*, 0, rsigv, s);
 		ri_read_sig(pl->fp, s);
+		//no read is left if the last reads of the file could not be decoded
+		if(!s->name){ri_sig_destroy(s); continue;}
+		rh_kv_push(ri_sig_t*, 0, rsigv, s);
 		size += s->l_sig;
+		bytes += ri_sig_bytes(s);
 
-		if(size >= chunk_size) break;
+		if(size >= chunk_size || (max_bytes && bytes >= max_bytes)) break;
 		
 		//Debugging for sweeping purposes
 		// pl->su_nreads++;
@@ -596,6 +1013,35 @@ ri_sig_t** ri_sig_read_frag(pipeline_mt *pl,
 	return a;
 }
 
+void ri_write_reg(FILE *fp, const ri_idx_t *ri, const ri_reg1_t *reg0, int mapped)
+{
+	if(mapped){
+		for(uint32_t m = 0; m < reg0->n_maps; ++m){
+			if(reg0->maps[m].ref_id < ri->n_seq)
+				fprintf(fp, "%s\t%u\t%u\t%u\t%c\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%s\n", 
+								reg0->read_name,
+								reg0->maps[m].read_length,
+								reg0->maps[m].read_start_position,
+								reg0->maps[m].read_end_position, 
+								reg0->maps[m].rev?'-':'+',
+								(ri->flag&RI_I_SIG_TARGET)?ri->sig[reg0->maps[m].ref_id].name:ri->seq[reg0->maps[m].ref_id].name,
+								(ri->flag&RI_I_SIG_TARGET)?ri->sig[reg0->maps[m].ref_id].l_sig:ri->seq[reg0->maps[m].ref_id].len,
+								reg0->maps[m].fragment_start_position,
+								reg0->maps[m].fragment_start_position + reg0->maps[m].fragment_length, 
+								reg0->maps[m].read_end_position-reg0->maps[m].read_start_position-1, 
+								reg0->maps[m].fragment_length,
+								reg0->maps[m].mapq,
+								reg0->maps[m].tags);
+		}
+	}else{
+		fprintf(fp, "%s\t%u\t*\t*\t*\t*\t*\t*\t*\t*\t*\t%u\t%s\n", 
+		reg0->read_name, 
+		reg0->maps[0].read_length, 
+		reg0->maps[0].mapq, 
+		reg0->maps[0].tags);
+	}
+}
+
 static void *map_worker_pipeline(void *shared,
 								int step,
 								void *in)
@@ -633,7 +1079,10 @@ static void *map_worker_pipeline(void *shared,
 		#ifdef PROFILERH
 		double map_multit = ri_realtime();
 		#endif
-		if(!p->su_stop) kt_for(p->n_threads, map_worker_for, in, s->n_sig);
+		if(!p->su_stop) {
+			if (p->opt->event_batch > 1 && !(p->opt->flag&RI_M_SEG_FIXED)) kt_for(p->n_threads, map_worker_batch, in, (s->n_sig + p->opt->event_batch - 1) / p->opt->event_batch);
+			else kt_for(p->n_threads, map_worker_for, in, s->n_sig);
+		}
 		#ifdef PROFILERH
 		ri_maptime_multithread += ri_realtime() - map_multit;
 		#endif
@@ -681,34 +1130,12 @@ static void *map_worker_pipeline(void *shared,
 				// fprintf(stderr, "%s %d %d\n", reg0->read_name, reg0->n_maps, reg0->maps[0].mapped);
 				
 				if(reg0->read_name){
-					if(reg0->n_maps > 0 && (!p->su_stop || k < p->su_stop)){
-						for(uint32_t m = 0; m < reg0->n_maps; ++m){
-							if(reg0->maps[m].ref_id < ri->n_seq)
-								fprintf(stdout, "%s\t%u\t%u\t%u\t%c\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%s\n", 
-												reg0->read_name,
-												reg0->maps[m].read_length,
-												reg0->maps[m].read_start_position,
-												reg0->maps[m].read_end_position, 
-												reg0->maps[m].rev?'-':'+',
-												(ri->flag&RI_I_SIG_TARGET)?ri->sig[reg0->maps[m].ref_id].name:ri->seq[reg0->maps[m].ref_id].name,
-												(ri->flag&RI_I_SIG_TARGET)?ri->sig[reg0->maps[m].ref_id].l_sig:ri->seq[reg0->maps[m].ref_id].len,
-												reg0->maps[m].fragment_start_position,
-												reg0->maps[m].fragment_start_position + reg0->maps[m].fragment_length, 
-												reg0->maps[m].read_end_position-reg0->maps[m].read_start_position-1, 
-												reg0->maps[m].fragment_length,
-												reg0->maps[m].mapq,
-												reg0->maps[m].tags);
+					int mapped = reg0->n_maps > 0 && (!p->su_stop || k < p->su_stop);
+					ri_write_reg(stdout, ri, reg0, mapped);
+					if(mapped){
+						for(uint32_t m = 0; m < reg0->n_maps; ++m)
 							if(reg0->maps[m].tags) {free(reg0->maps[m].tags); reg0->maps[m].tags = NULL;}
-						}
-					}else{
-						fprintf(stdout, "%s\t%u\t*\t*\t*\t*\t*\t*\t*\t*\t*\t%u\t%s\n", 
-						reg0->read_name, 
-						reg0->maps[0].read_length, 
-						reg0->maps[0].mapq, 
-						reg0->maps[0].tags);
-
-						if(reg0->maps[0].tags) {free(reg0->maps[0].tags); reg0->maps[0].tags = NULL;}
-					}
+					}else if(reg0->maps[0].tags) {free(reg0->maps[0].tags); reg0->maps[0].tags = NULL;}
 				}
 
 				// if(reg0->tags) {free(reg0->tags); reg0->tags = NULL;}
@@ -718,16 +1145,20 @@ static void *map_worker_pipeline(void *shared,
 			}
 		}
 
+		//the next batches are made smaller if the mapping buffers grow
+		int64_t arena = 0;
+		for (i = 0; i < p->n_threads; ++i) arena += s->buf[i]->peak_km;
+		if (arena > p->arena_bytes) {
+			p->arena_bytes = arena;
+			ri_update_batch_bytes(p);
+		}
+
 		for (i = 0; i < p->n_threads; ++i) ri_tbuf_destroy(s->buf[i]);
 		if(s->buf){free(s->buf); s->buf = NULL;}
 		if(s->reg){free(s->reg); s->reg = NULL;}
 
 		for(int i = 0; i < s->n_sig; ++i){
-			ri_sig_t *curS = s->sig[i];
-			if(!curS) continue;
-			if(curS->sig){free(curS->sig); curS->sig = NULL;}
-			if(curS->name){free(curS->name); curS->name = NULL;}
-			free(curS); s->sig[i] = NULL;
+			ri_sig_destroy(s->sig[i]); s->sig[i] = NULL;
 		}
 		if(s->sig){free(s->sig); s->sig = NULL;}
 		free(s); s = NULL;
@@ -756,17 +1187,35 @@ int ri_map_file_frag(const ri_idx_t *idx,
 	pl.n_fp = n_segs;
 	pl.n_f = 0; pl.cur_f = 0;
 	ri_char_v fnames = {0,0,0};
-	rh_kv_resize(char*, 0, fnames, 256);
-	find_sfiles(fn[0], &fnames);
-	pl.f =  fnames.a;
-	if(!fnames.n || ((pl.fp = open_sig(pl.f[0])) == 0)){rh_kv_destroy(fnames); return -1;}
-	if (pl.fp == 0){rh_kv_destroy(fnames); return -1;}
+	//Only the first max_num_chunk chunks of a read are mapped in the adaptive mode. The rest is read on demand (see map_worker_for)
+	if(opt->flag&(RI_M_NO_ADAPTIVE|RI_M_FULL_SIGNAL)) pl.max_sig = 0;
+	else pl.max_sig = (opt->max_num_chunk?opt->max_num_chunk:1)*opt->chunk_size;
+	//The chunks start after the stall, so the prefix also covers the longest stall and the window after it (see map_read_trim)
+	if(pl.max_sig && (opt->flag&RI_M_TRIM_STALL)) pl.max_sig += opt->trim_max + RI_TRIM_WINDOW;
+	pl.n_threads = n_threads > 1? n_threads : 1;
+	//The index is already loaded so that the available memory excludes it
+	pl.mem_budget = opt->mem_budget? opt->mem_budget : ri_memavail() / 2;
+	pl.arena_bytes = pl.n_threads * RI_ARENA_BYTES_INIT;
+	ri_update_batch_bytes(&pl);
+	if (ri_verbose >= 3 && pl.mem_budget)
+		fprintf(stderr, "[M::%s] memory budget: %.3f GB; at most %.1f MB of reads per batch\n", __func__, pl.mem_budget / 1e9, pl.batch_bytes / 1e6);
+	if(opt->n_io_threads > 0){
+		//Signal files are opened and decoded by separate threads ahead of the mapping step
+		pl.pf = ri_prefetch_init(n_segs, fn, opt->n_io_threads, opt->n_prefetch_files, pl.batch_bytes? pl.batch_bytes : opt->mini_batch_size * (int64_t)sizeof(int16_t), pl.max_sig, opt->n_decode_threads);
+		if(!pl.pf) return -1;
+	}else{
+		rh_kv_resize(char*, 0, fnames, 256);
+		find_sfiles(fn[0], &fnames);
+		pl.f =  fnames.a;
+		if(!fnames.n || ((pl.fp = open_sig(pl.f[0])) == 0)){rh_kv_destroy(fnames); return -1;}
+		if (pl.fp == 0){rh_kv_destroy(fnames); return -1;}
+		pl.fp->max_sig = pl.max_sig; pl.fp->n_threads = opt->n_decode_threads;
+		pl.n_f = fnames.n;
+		pl.cur_f = 1;
+	}
 	pl.fn = fn;
-	pl.n_f = fnames.n;
 	pl.cur_fp = 1;
-	pl.cur_f = 1;
 	pl.opt = opt, pl.ri = idx;
-	pl.n_threads = n_threads > 1? n_threads : 1;
 	pl.mini_batch_size = opt->mini_batch_size;
 	pl_threads = pl.n_threads == 1?1:2;
 	pl.su_stop = 0;
@@ -783,6 +1232,7 @@ int ri_map_file_frag(const ri_idx_t *idx,
 	}
 	
 	kt_pipeline(pl_threads, map_worker_pipeline, &pl, 3);
+	if(pl.pf){ri_prefetch_destroy(pl.pf); pl.pf = NULL;}
 
 	if(opt->flag & RI_M_SEQUENCEUNTIL){
 		// pl.su_nreads = 0;
@@ -798,6 +1248,7 @@ int ri_map_file_frag(const ri_idx_t *idx,
 	}
 
 	#ifdef PROFILERH
+	fprintf(stderr, "\n[M::%s] Signal conversion: %.6f sec; %llu raw samples; %.2f M samples/sec\n", __func__, ri_convtime, (unsigned long long)ri_convsamples, (ri_convtime > 0)?ri_convsamples/ri_convtime/1e6:0.0);
 	fprintf(stderr, "\n[M::%s] File read: %.6f sec; Signal-to-event: %.6f sec; Sketching: %.6f sec; Seeding: %.6f sec; Chaining: %.6f sec; Mapping: %.6f sec; Mapping (multi-threaded): %.6f sec\n", __func__, ri_filereadtime, ri_signaltime, ri_sketchtime, ri_seedtime, ri_chaintime, ri_maptime, ri_maptime_multithread);
 	#endif
 
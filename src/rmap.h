@@ -3,6 +3,7 @@
 
 #include "rindex.h"
 #include "rsig.h"
+#include "rprefetch.h"
 #include "chain.h"
 
 #ifdef __cplusplus
@@ -55,6 +56,11 @@ typedef struct pipeline_ms{
 	float** su_estimations;
 	uint32_t* su_c_estimations;
 	int su_stop;
+	ri_prefetch_t *pf; //reads the signal files asynchronously if not NULL
+	uint32_t max_sig; //maximum number of signal values to read per read at once (0: entire signal)
+	int64_t mem_budget; //memory for the batches in flight and their mapping buffers (0: unlimited)
+	int64_t batch_bytes; //maximum number of bytes of reads in a batch (0: unlimited). See ri_update_batch_bytes
+	int64_t arena_bytes; //largest total size of the per-thread mapping buffers of a batch so far
 } pipeline_mt;
 
 typedef struct step_ms{
@@ -91,6 +97,102 @@ int ri_map_file(const ri_idx_t *idx, const char *fn, const ri_mapopt_t *opt, int
  */
 int ri_map_file_frag(const ri_idx_t *idx, int n_segs, const char **fn, const ri_mapopt_t *opt, int n_threads);
 
+/**
+ * Write the mappings of a read in PAF
+ *
+ * @param fp		output file
+ * @param ri		index (see rindex.h)
+ * @param reg0		mappings of the read (see ri_stream_reg)
+ * @param mapped	0: the read is reported as unmapped even if it has mappings
+ */
+void ri_write_reg(FILE *fp, const ri_idx_t *ri, const ri_reg1_t *reg0, int mapped);
+
+/**
+ * Create a thread-local buffer for mapping (see ri_stream_push)
+ *
+ * @return	thread buffer (see ri_tbuf_destroy)
+ */
+ri_tbuf_t *ri_tbuf_init(void);
+
+/**
+ * Deallocate a thread buffer
+ *
+ * @param b	thread buffer to destroy
+ */
+void ri_tbuf_destroy(ri_tbuf_t *b);
+
+/*
+ * Streaming API: maps a read chunk by chunk as its signal arrives (e.g., from a Read Until client) and decides
+ * as early as possible. Typical use:
+ *
+ *   ri_stream_t *st = ri_stream_open(ri, opt, rid, name);
+ *   while (ri_stream_push(st, b, sig, n) == RI_STREAM_MORE) { ...wait for the next chunk of the read... }
+ *   (or ri_stream_finish(st, b) when the read ends before a decision)
+ *   const ri_reg1_t *reg = ri_stream_reg(st);
+ *   ri_stream_close(st);
+ *
+ * A read context can be pushed from any thread, each thread using its own ri_tbuf_t. A context must not be used
+ * by two threads at the same time. The mappings are the same as ri_map_file_frag, which maps opt->chunk_size
+ * signal values at a time. Only the sl:i tag differs: it reports the number of signal values received until the decision.
+ */
+#define RI_STREAM_MORE		0 //no decision yet: more signal values are needed
+#define RI_STREAM_MAPPED	1 //the read is mapped
+#define RI_STREAM_UNMAPPED	2 //the read cannot be mapped within the maximum number of chunks (or before it ended)
+
+typedef struct ri_stream_s ri_stream_t;
+
+/**
+ * Open a context to map a read as its signal arrives
+ *
+ * @param ri	index (see rindex.h)
+ * @param opt	mapping options. Must be valid until the context is closed
+ * @param rid	read id
+ * @param name	read name (copied)
+ *
+ * @return		read context (see ri_stream_close)
+ */
+ri_stream_t *ri_stream_open(const ri_idx_t *ri, const ri_mapopt_t *opt, uint32_t rid, const char *name);
+
+/**
+ * Map the next signal values of a read. A chunk is mapped whenever opt->chunk_size signal values are accumulated.
+ * Signal values that arrive after the decision are ignored
+ *
+ * @param st	read context (see ri_stream_open)
+ * @param b		thread buffer of the calling thread (see ri_tbuf_init)
+ * @param sig	next signal values of the read in pA
+ * @param n		number of signal values in $sig
+ *
+ * @return		RI_STREAM_MORE, RI_STREAM_MAPPED, or RI_STREAM_UNMAPPED
+ */
+int ri_stream_push(ri_stream_t *st, ri_tbuf_t *b, const float *sig, uint32_t n);
+
+/**
+ * Map the remaining signal values when a read ends before a decision is made
+ *
+ * @param st	read context (see ri_stream_open)
+ * @param b		thread buffer of the calling thread (see ri_tbuf_init)
+ *
+ * @return		RI_STREAM_MAPPED or RI_STREAM_UNMAPPED
+ */
+int ri_stream_finish(ri_stream_t *st, ri_tbuf_t *b);
+
+/**
+ * Mappings of a read once it is decided. The mappings are reported the same way as ri_map_file_frag reports
+ * them (i.e., a single unmapped entry in reg->maps if reg->n_maps is 0)
+ *
+ * @param st	read context (see ri_stream_open)
+ *
+ * @return		mappings of the read (owned by the context); NULL if no decision is made yet
+ */
+const ri_reg1_t *ri_stream_reg(const ri_stream_t *st);
+
+/**
+ * Close a read context
+ *
+ * @param st	read context to close
+ */
+void ri_stream_close(ri_stream_t *st);
+
 #ifdef __cplusplus
 }
 #endif
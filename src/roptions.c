@@ -5,6 +5,7 @@ void ri_idxopt_init(ri_idxopt_t *opt)
 {
 	memset(opt, 0, sizeof(ri_idxopt_t));
 	opt->e = 8; opt->w = 0; opt->q = 4; opt->n = 0; opt->k = 6, opt->lev_col = 1;
+	opt->s = 0; opt->t = -1;
 	opt->b = 14;
 	opt->diff = 0.35f;
 	opt->mini_batch_size = 50000000;
@@ -86,6 +87,11 @@ void ri_mapopt_init(ri_mapopt_t *opt)
 
 	opt->mini_batch_size = 500000000; //-K
 
+	opt->n_io_threads = 2; //--io-threads
+	opt->n_prefetch_files = 4; //--prefetch-files
+	opt->n_decode_threads = 4; //--decode-threads
+	opt->mem_budget = 0; //--mem-budget
+
 	opt->step_size = 1;
 	opt->min_events = 50; //--min-events
 	opt->max_num_chunk = 10;//--max-chunks
@@ -105,6 +111,10 @@ void ri_mapopt_init(ri_mapopt_t *opt)
     opt->threshold1 = 4.0f; //--seg-threshold1
     opt->threshold2 = 3.5f; //--seg-threshold2
     opt->peak_height = 0.4f; //--seg-peak_height
+	opt->event_batch = 0; //--event-batch
+
+	opt->trim_max = 10000; //--trim-max
+	opt->trim_sd = 5.0f; //--trim-sd
 
 	// opt->window_length1 = 3; //--seg-window-length1
     // opt->window_length2 = 7; //--seg-window-length2
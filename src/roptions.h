@@ -33,6 +33,17 @@
 //Characterization related
 #define RI_M_OUT_ALL_CHAINS 0x4000
 
+//Signal reading related
+#define RI_M_FULL_SIGNAL	0x8000
+
+//Read Until related
+#define RI_M_UNBLOCK_MAPPED	0x10000
+
+//Event detection related
+#define RI_M_SEG_FIXED		0x20000
+#define RI_M_SEG_ROBUST		0x40000
+#define RI_M_TRIM_STALL		0x80000
+
 //DTW related
 #define RI_M_DTW_BORDER_CONSTRAINT_GLOBAL	0
 #define RI_M_DTW_BORDER_CONSTRAINT_SPARSE	1
@@ -47,6 +58,7 @@ extern "C" {
 // indexing and mapping options
 typedef struct ri_idxopt_s{
 	short b, w, e, n, q, k, flag, lev_col;
+	short s, t; // syncmers (see RI_I_SYNCMER): length of the s-mers and the offset of the smallest s-mer of an open syncmer (-1: closed syncmers)
 	int64_t mini_batch_size;
 	uint64_t batch_size;
 
@@ -127,12 +139,23 @@ typedef struct ri_mapopt_s{
 	int64_t flag;    // see ri_F_* macros
 	int64_t mini_batch_size; // size of a batch of query bases to process in parallel
 
+	//Signal file reading
+	int n_io_threads; // number of threads that decode the signal files ahead of mapping (0: read in the pipeline)
+	int n_prefetch_files; // maximum number of files decoded ahead of the file being mapped
+	int n_decode_threads; // number of threads that decode a batch of reads within a file
+	int64_t mem_budget; // memory in bytes for the reads in flight and the mapping buffers (0: half of the available memory after the index is loaded)
+
 	//Event detector options
 	uint32_t window_length1;
 	uint32_t window_length2;
 	float threshold1;
 	float threshold2;
 	float peak_height;
+	int event_batch; // number of reads whose events are detected together (0: each read on its own)
+
+	//Stall trimming (see RI_M_TRIM_STALL)
+	uint32_t trim_max; // maximum number of signal values trimmed from the start of a read
+	float trim_sd; // maximum standard deviation of the stall (in pA)
 } ri_mapopt_t;
 
 /**
@@ -0,0 +1,84 @@
+#include "rpack.h"
+#include "rprefetch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rh_kvec.h"
+
+int64_t ri_pack_sigs(int n_fn, const char **fn, const char *out, uint32_t max_sig, int n_threads)
+{
+	ri_pack_hdr_t hdr;
+	ri_prefetch_t *pf;
+	ri_sig_t *s;
+	FILE *fp;
+	rh_kvec_t(ri_pack_read_t) idx = {0,0,0};
+	rh_kvec_t(char) names = {0,0,0};
+	uint64_t off = RI_PACK_DATA_OFF;
+	char pad[RI_PACK_DATA_OFF];
+	int err = 0;
+
+	pf = ri_prefetch_init(n_fn, fn, n_threads, n_threads*2, (int64_t)1<<29, max_sig, n_threads);
+	if (!pf) {
+		fprintf(stderr, "[ERROR] no signal file found in '%s'\n", fn[0]);
+		return -1;
+	}
+	if ((fp = fopen(out, "wb")) == 0) {
+		fprintf(stderr, "[ERROR] failed to open file '%s' for writing\n", out);
+		ri_prefetch_destroy(pf);
+		return -1;
+	}
+
+	//the header is written once the index is complete
+	memset(pad, 0, RI_PACK_DATA_OFF);
+	fwrite(pad, 1, RI_PACK_DATA_OFF, fp);
+
+	while ((s = ri_prefetch_read(pf)) != 0) {
+		if (!s->name) { ri_sig_destroy(s); continue; }
+
+		ri_pack_read_t r;
+		memset(&r, 0, sizeof(ri_pack_read_t));
+		r.off = off; r.len = s->raw_pos;
+		r.cal_offset = s->cal_offset; r.cal_scale = s->cal_scale;
+		r.format = s->format;
+		r.name_off = names.n;
+		rh_kv_push(ri_pack_read_t, 0, idx, r);
+
+		size_t l = strlen(s->name) + 1;
+		rh_kv_resize(char, 0, names, names.n + l);
+		memcpy(names.a + names.n, s->name, l);
+		names.n += l;
+
+		if (r.len && fwrite(s->raw, sizeof(int16_t), r.len, fp) != r.len) err = 1;
+		off += r.len * sizeof(int16_t);
+		ri_sig_destroy(s);
+		if (err) break;
+	}
+	ri_prefetch_destroy(pf);
+
+	//keeps the index aligned
+	if (!err && off % 8) {
+		fwrite(pad, 1, 8 - off % 8, fp);
+		off += 8 - off % 8;
+	}
+
+	memset(&hdr, 0, sizeof(ri_pack_hdr_t));
+	memcpy(hdr.magic, RI_PACK_MAGIC, 4);
+	hdr.version = RI_PACK_VERSION;
+	hdr.n_reads = idx.n;
+	hdr.idx_off = off;
+	hdr.names_off = off + idx.n * sizeof(ri_pack_read_t);
+	hdr.max_sig = max_sig;
+
+	if (!err && idx.n && fwrite(idx.a, sizeof(ri_pack_read_t), idx.n, fp) != idx.n) err = 1;
+	if (!err && names.n && fwrite(names.a, 1, names.n, fp) != names.n) err = 1;
+	if (!err && (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(ri_pack_hdr_t), 1, fp) != 1)) err = 1;
+	if (fclose(fp) != 0) err = 1;
+
+	rh_kv_destroy(idx);
+	rh_kv_destroy(names);
+	if (err) {
+		fprintf(stderr, "[ERROR] failed to write the signal pack '%s'\n", out);
+		return -1;
+	}
+	return (int64_t)hdr.n_reads;
+}
@@ -0,0 +1,60 @@
+#ifndef RPACK_H
+#define RPACK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Signal pack (.rhsp): raw samples of many reads stored contiguously so that they can be read through mmap
+ * without any decoding library. Layout (native byte order):
+ *
+ *   ri_pack_hdr_t                                  (padded to RI_PACK_DATA_OFF bytes)
+ *   int16_t raw samples of all the reads           (read by read)
+ *   ri_pack_read_t index[n_reads]                  (at idx_off)
+ *   NUL-terminated read names                      (at names_off)
+ */
+
+#define RI_PACK_MAGIC "RHSP"
+#define RI_PACK_VERSION 1
+#define RI_PACK_DATA_OFF 64
+
+typedef struct ri_pack_hdr_s{
+	char magic[4]; //RI_PACK_MAGIC
+	uint32_t version; //RI_PACK_VERSION
+	uint64_t n_reads; //number of reads in the pack
+	uint64_t idx_off; //byte offset of the read index
+	uint64_t names_off; //byte offset of the read names
+	uint32_t max_sig; //maximum number of signal values stored per read (0: entire signals are stored)
+	uint32_t pad;
+} ri_pack_hdr_t;
+
+typedef struct ri_pack_read_s{
+	uint64_t off; //byte offset of the first raw sample of the read
+	uint64_t len; //number of raw samples stored for the read
+	double cal_offset, cal_scale; //calibration values (see ri_sig_t)
+	uint64_t name_off; //offset of the read name from names_off
+	uint8_t format; //format of the original file (RI_SIG_FAST5, RI_SIG_POD5, or RI_SIG_SLOW5). Determines the pA conversion
+	uint8_t pad[7];
+} ri_pack_read_t;
+
+/**
+ * Converts the reads in the signal files into a single signal pack
+ *
+ * @param n_fn		number of input paths in $fn
+ * @param fn		input paths (FAST5/POD5/SLOW5/signal pack files or directories that are searched recursively)
+ * @param out		path to the signal pack to write
+ * @param max_sig	maximum number of signal values (i.e., raw samples within the expected pA range) to store per read.
+ * 					0: entire signals are stored
+ * @param n_threads	number of threads that read the signal files
+ *
+ * @return			number of reads written; -1 on error
+ */
+int64_t ri_pack_sigs(int n_fn, const char **fn, const char *out, uint32_t max_sig, int n_threads);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //RPACK_H
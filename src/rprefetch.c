@@ -0,0 +1,172 @@
+#include "rprefetch.h"
+#include "rscan.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rh_kvec.h"
+
+typedef struct ri_pf_file_s{
+	int done; //1 if all the reads of the file are decoded
+	size_t head; //index of the next read to return from $sigs
+	rhsig_v sigs; //decoded reads of the file
+} ri_pf_file_t;
+
+struct ri_prefetch_s{
+	ri_scan_t *sc; //finds the signal files under the input paths
+	int eof, stop;
+
+	int n_threads, n_files;
+	int64_t max_bytes, n_bytes; //upper bound and the current number of bytes of raw samples in the queue
+	uint32_t max_sig; //maximum number of signal values to read per read
+	int n_decode; //number of threads that decode a batch of reads within a file
+	int64_t n_claimed, n_consumed; //number of files claimed by the threads and consumed by ri_prefetch_read
+	ri_pf_file_t *files; //ring buffer of size $n_files. files[i%n_files] is the i-th claimed file
+
+	pthread_t *tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+};
+
+static void *pf_worker(void *data)
+{
+	ri_prefetch_t *pf = (ri_prefetch_t*)data;
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		while (!pf->stop && !pf->eof && pf->n_claimed - pf->n_consumed >= pf->n_files)
+			pthread_cond_wait(&pf->cv, &pf->mutex);
+		if (pf->stop || pf->eof) break;
+
+		//the slot is claimed before the file is known so that waiting for the scan does not hold the lock
+		int64_t seq = pf->n_claimed++;
+		ri_pf_file_t *f = &pf->files[seq % pf->n_files];
+		f->done = 0; f->head = 0; f->sigs.n = 0;
+		pthread_mutex_unlock(&pf->mutex);
+
+		char *fn = ri_scan_next(pf->sc);
+		int found = fn != 0;
+		ri_sig_file_t *fp = found? open_sig(fn) : 0;
+		free(fn);
+		if (fp) fp->max_sig = pf->max_sig, fp->n_threads = pf->n_decode;
+		while (fp && fp->cur_read < fp->num_read) {
+			ri_sig_t *s = (ri_sig_t*)calloc(1, sizeof(ri_sig_t));
+			ri_read_sig(fp, s);
+			//no read is left if the last reads of the file could not be decoded
+			if (!s->name) { ri_sig_destroy(s); continue; }
+
+			pthread_mutex_lock(&pf->mutex);
+			rh_kv_push(ri_sig_t*, 0, f->sigs, s);
+			pf->n_bytes += s->m_raw * sizeof(int16_t);
+			pthread_cond_broadcast(&pf->cv);
+			//the file that is currently consumed never waits so that the consumer can always make progress
+			while (!pf->stop && pf->n_bytes >= pf->max_bytes && seq != pf->n_consumed)
+				pthread_cond_wait(&pf->cv, &pf->mutex);
+			int stop = pf->stop;
+			pthread_mutex_unlock(&pf->mutex);
+			if (stop) break;
+		}
+		ri_sig_close(fp);
+
+		pthread_mutex_lock(&pf->mutex);
+		if (!found) pf->eof = 1;
+		f->done = 1;
+		pthread_cond_broadcast(&pf->cv);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return 0;
+}
+
+ri_prefetch_t *ri_prefetch_init(int n_fn, const char **fn, int n_threads, int n_files, int64_t max_bytes, uint32_t max_sig, int n_decode)
+{
+	int i;
+	ri_prefetch_t *pf;
+	if (n_fn < 1) return 0;
+
+	pf = (ri_prefetch_t*)calloc(1, sizeof(ri_prefetch_t));
+	pf->n_threads = n_threads > 1? n_threads : 1;
+	pf->n_files = n_files > pf->n_threads? n_files : pf->n_threads;
+	pf->max_bytes = max_bytes > 0? max_bytes : 1;
+	pf->max_sig = max_sig;
+	pf->n_decode = n_decode;
+
+	pf->sc = ri_scan_init(n_fn, fn, pf->n_threads);
+	if (!ri_scan_wait(pf->sc)) {
+		ri_scan_destroy(pf->sc);
+		free(pf);
+		return 0;
+	}
+
+	pf->files = (ri_pf_file_t*)calloc(pf->n_files, sizeof(ri_pf_file_t));
+	pthread_mutex_init(&pf->mutex, 0);
+	pthread_cond_init(&pf->cv, 0);
+	pf->tid = (pthread_t*)calloc(pf->n_threads, sizeof(pthread_t));
+	for (i = 0; i < pf->n_threads; ++i) pthread_create(&pf->tid[i], 0, pf_worker, pf);
+
+	return pf;
+}
+
+ri_sig_t *ri_prefetch_read(ri_prefetch_t *pf)
+{
+	ri_sig_t *s = 0;
+	pthread_mutex_lock(&pf->mutex);
+	for (;;) {
+		if (pf->n_consumed == pf->n_claimed) {
+			if (pf->eof || pf->stop) break;
+			pthread_cond_wait(&pf->cv, &pf->mutex);
+			continue;
+		}
+
+		ri_pf_file_t *f = &pf->files[pf->n_consumed % pf->n_files];
+		if (f->head < f->sigs.n) {
+			s = f->sigs.a[f->head];
+			f->sigs.a[f->head++] = 0;
+			pf->n_bytes -= s->m_raw * sizeof(int16_t);
+			pthread_cond_broadcast(&pf->cv);
+			break;
+		}
+
+		if (f->done) {
+			f->sigs.n = 0; f->head = 0;
+			pf->n_consumed++;
+			pthread_cond_broadcast(&pf->cv);
+			continue;
+		}
+		pthread_cond_wait(&pf->cv, &pf->mutex);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return s;
+}
+
+void ri_prefetch_set_max_bytes(ri_prefetch_t *pf, int64_t max_bytes)
+{
+	pthread_mutex_lock(&pf->mutex);
+	pf->max_bytes = max_bytes > 0? max_bytes : 1;
+	//the threads waiting for the queue to drain may continue if the bound is raised
+	pthread_cond_broadcast(&pf->cv);
+	pthread_mutex_unlock(&pf->mutex);
+}
+
+void ri_prefetch_destroy(ri_prefetch_t *pf)
+{
+	int i;
+	size_t j;
+	if (!pf) return;
+
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = 1;
+	pthread_cond_broadcast(&pf->cv);
+	pthread_mutex_unlock(&pf->mutex);
+	ri_scan_stop(pf->sc);
+	for (i = 0; i < pf->n_threads; ++i) pthread_join(pf->tid[i], 0);
+	ri_scan_destroy(pf->sc);
+
+	for (i = 0; i < pf->n_files; ++i) {
+		ri_pf_file_t *f = &pf->files[i];
+		for (j = f->head; j < f->sigs.n; ++j) ri_sig_destroy(f->sigs.a[j]);
+		rh_kv_destroy(f->sigs);
+	}
+
+	pthread_mutex_destroy(&pf->mutex);
+	pthread_cond_destroy(&pf->cv);
+	free(pf->files); free(pf->tid);
+	free(pf);
+}
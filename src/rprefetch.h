@@ -0,0 +1,59 @@
+#ifndef RPREFETCH_H
+#define RPREFETCH_H
+
+#include <stdint.h>
+#include "rsig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ri_prefetch_s ri_prefetch_t;
+
+/**
+ * Starts a pool of threads that opens the signal files and decodes their reads ahead of the mapping step.
+ * Files are opened as they are found by the scan (see ri_scan_next), the largest available file first.
+ * Reads of a file are returned by ri_prefetch_read() in their order in the file.
+ *
+ * @param n_fn			number of input paths in $fn
+ * @param fn			input paths (signal files or directories that are searched recursively with ri_scan_init)
+ * @param n_threads		number of threads that open and decode the signal files. Also used to scan the directories
+ * @param n_files		maximum number of files that can be opened and decoded ahead of the file that is currently consumed
+ * @param max_bytes		maximum number of bytes of raw samples to keep decoded in the queue.
+ * 						The file that is currently consumed is never blocked so that the queue cannot deadlock.
+ * @param max_sig		maximum number of signal values to read per read (0: entire signal). See ri_read_sig_more
+ * @param n_decode		number of threads that decode a batch of reads within a file (see ri_sig_file_t::n_threads)
+ *
+ * @return				prefetcher; NULL if none of the paths in $fn contains a signal file
+ */
+ri_prefetch_t *ri_prefetch_init(int n_fn, const char **fn, int n_threads, int n_files, int64_t max_bytes, uint32_t max_sig, int n_decode);
+
+/**
+ * Returns the next read from the prefetch queue. Blocks until the read is decoded.
+ *
+ * @param pf	prefetcher (see ri_prefetch_init)
+ *
+ * @return		next read (owned by the caller, see ri_sig_destroy); NULL if all the files are consumed
+ */
+ri_sig_t *ri_prefetch_read(ri_prefetch_t *pf);
+
+/**
+ * Updates the maximum number of bytes of raw samples to keep decoded in the queue (see ri_prefetch_init).
+ * The reads already in the queue are kept if the bound is lowered; the threads wait until the queue drains below it.
+ *
+ * @param pf		prefetcher
+ * @param max_bytes	new upper bound
+ */
+void ri_prefetch_set_max_bytes(ri_prefetch_t *pf, int64_t max_bytes);
+
+/**
+ * Stops the prefetch threads and deallocates the reads that are not consumed yet
+ *
+ * @param pf	prefetcher to destroy
+ */
+void ri_prefetch_destroy(ri_prefetch_t *pf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //RPREFETCH_H
@@ -0,0 +1,221 @@
+#include "rscan.h"
+#include "rsig.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "rh_kvec.h"
+
+#define RI_SCAN_FLUSH 64 //number of files found in a directory before they are made available to ri_scan_next
+
+typedef struct ri_sfile_s{
+	uint64_t size; //size of the file in bytes
+	char *fn;
+} ri_sfile_t;
+
+typedef rh_kvec_t(ri_sfile_t) ri_sfile_v;
+
+struct ri_scan_s{
+	ri_char_v dirs; //directories that are not scanned yet
+	ri_sfile_v heap; //files that are found but not returned yet. Max-heap on the file size
+	int n_busy; //number of threads that are scanning a directory
+	int done, stop;
+	int64_t n_found;
+
+	int n_threads;
+	pthread_t *tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+};
+
+//Larger files first. Ties are broken by the path so that the order does not depend on the order the files are found
+static inline int sfile_lt(const ri_sfile_t *a, const ri_sfile_t *b)
+{
+	if (a->size != b->size) return a->size < b->size;
+	return strcmp(a->fn, b->fn) > 0;
+}
+
+static void heap_push(ri_sfile_v *h, ri_sfile_t f)
+{
+	size_t i = h->n, p;
+	rh_kv_push(ri_sfile_t, 0, *h, f);
+	while (i > 0 && sfile_lt(&h->a[p = (i - 1) >> 1], &f)) {
+		h->a[i] = h->a[p];
+		i = p;
+	}
+	h->a[i] = f;
+}
+
+static ri_sfile_t heap_pop(ri_sfile_v *h)
+{
+	ri_sfile_t top = h->a[0], tmp = h->a[--h->n];
+	size_t i = 0, k, n = h->n;
+	while ((k = (i << 1) + 1) < n) {
+		if (k + 1 < n && sfile_lt(&h->a[k], &h->a[k+1])) ++k;
+		if (!sfile_lt(&tmp, &h->a[k])) break;
+		h->a[i] = h->a[k]; i = k;
+	}
+	if (n) h->a[i] = tmp;
+	return top;
+}
+
+//Makes the files and the subdirectories found by a thread available to the other threads
+static void scan_flush(ri_scan_t *sc, ri_sfile_v *files, ri_char_v *subdirs)
+{
+	size_t i;
+	if (!files->n && !subdirs->n) return;
+	pthread_mutex_lock(&sc->mutex);
+	for (i = 0; i < files->n; ++i) heap_push(&sc->heap, files->a[i]);
+	for (i = 0; i < subdirs->n; ++i) rh_kv_push(char*, 0, sc->dirs, subdirs->a[i]);
+	sc->n_found += files->n;
+	pthread_cond_broadcast(&sc->cv);
+	pthread_mutex_unlock(&sc->mutex);
+	files->n = subdirs->n = 0;
+}
+
+//Scans a single directory. d_type avoids a stat call per entry unless the file system does not provide it
+static void scan_dir(ri_scan_t *sc, const char *path, ri_sfile_v *files, ri_char_v *subdirs)
+{
+	DIR *dir;
+	struct dirent *ent;
+	size_t l = strlen(path);
+	if ((dir = opendir(path)) == NULL) return;
+	int dfd = dirfd(dir);
+	while (!sc->stop && (ent = readdir(dir)) != NULL) {
+		const char *name = ent->d_name;
+		struct stat st;
+		int is_d = 0, has_st = 0;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+
+		if (ent->d_type == DT_DIR) is_d = 1;
+		else if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+			if (fstatat(dfd, name, &st, 0) != 0) continue;
+			is_d = S_ISDIR(st.st_mode); has_st = 1;
+		}
+		if (!is_d && !is_sfile(name)) continue;
+
+		size_t l_name = strlen(name);
+		char *fn = (char*)malloc(l + l_name + 2);
+		memcpy(fn, path, l); fn[l] = '/';
+		memcpy(fn + l + 1, name, l_name + 1);
+		if (is_d) {
+			rh_kv_push(char*, 0, *subdirs, fn);
+		} else {
+			ri_sfile_t f;
+			f.fn = fn;
+			f.size = (has_st || fstatat(dfd, name, &st, 0) == 0)? (uint64_t)st.st_size : 0;
+			rh_kv_push(ri_sfile_t, 0, *files, f);
+			if (files->n >= RI_SCAN_FLUSH) scan_flush(sc, files, subdirs);
+		}
+	}
+	closedir(dir);
+	scan_flush(sc, files, subdirs);
+}
+
+static void *scan_worker(void *data)
+{
+	ri_scan_t *sc = (ri_scan_t*)data;
+	ri_sfile_v files = {0,0,0};
+	ri_char_v subdirs = {0,0,0};
+	pthread_mutex_lock(&sc->mutex);
+	for (;;) {
+		while (!sc->stop && !sc->dirs.n && sc->n_busy > 0)
+			pthread_cond_wait(&sc->cv, &sc->mutex);
+		if (sc->stop || !sc->dirs.n) break;
+
+		char *path = sc->dirs.a[--sc->dirs.n];
+		++sc->n_busy;
+		pthread_mutex_unlock(&sc->mutex);
+
+		scan_dir(sc, path, &files, &subdirs);
+		free(path);
+
+		pthread_mutex_lock(&sc->mutex);
+		--sc->n_busy;
+	}
+	//no directory is left and no thread can add more
+	sc->done = 1;
+	pthread_cond_broadcast(&sc->cv);
+	pthread_mutex_unlock(&sc->mutex);
+	rh_kv_destroy(files);
+	rh_kv_destroy(subdirs);
+	return 0;
+}
+
+ri_scan_t *ri_scan_init(int n_fn, const char **fn, int n_threads)
+{
+	int i;
+	struct stat st;
+	ri_scan_t *sc = (ri_scan_t*)calloc(1, sizeof(ri_scan_t));
+
+	for (i = 0; i < n_fn; ++i) {
+		if (is_dir(fn[i])) {
+			rh_kv_push(char*, 0, sc->dirs, strdup(fn[i]));
+		} else if (is_sfile(fn[i])) {
+			ri_sfile_t f;
+			f.fn = strdup(fn[i]);
+			f.size = stat(fn[i], &st) == 0? (uint64_t)st.st_size : 0;
+			heap_push(&sc->heap, f);
+			++sc->n_found;
+		}
+	}
+
+	pthread_mutex_init(&sc->mutex, 0);
+	pthread_cond_init(&sc->cv, 0);
+	sc->n_threads = n_threads > 1? n_threads : 1;
+	sc->tid = (pthread_t*)calloc(sc->n_threads, sizeof(pthread_t));
+	for (i = 0; i < sc->n_threads; ++i) pthread_create(&sc->tid[i], 0, scan_worker, sc);
+	return sc;
+}
+
+int64_t ri_scan_wait(ri_scan_t *sc)
+{
+	int64_t n;
+	pthread_mutex_lock(&sc->mutex);
+	while (!sc->stop && !sc->n_found && !sc->done)
+		pthread_cond_wait(&sc->cv, &sc->mutex);
+	n = sc->n_found;
+	pthread_mutex_unlock(&sc->mutex);
+	return n;
+}
+
+char *ri_scan_next(ri_scan_t *sc)
+{
+	char *fn = 0;
+	pthread_mutex_lock(&sc->mutex);
+	while (!sc->stop && !sc->heap.n && !sc->done)
+		pthread_cond_wait(&sc->cv, &sc->mutex);
+	if (sc->heap.n) fn = heap_pop(&sc->heap).fn;
+	pthread_mutex_unlock(&sc->mutex);
+	return fn;
+}
+
+void ri_scan_stop(ri_scan_t *sc)
+{
+	pthread_mutex_lock(&sc->mutex);
+	sc->stop = 1;
+	pthread_cond_broadcast(&sc->cv);
+	pthread_mutex_unlock(&sc->mutex);
+}
+
+void ri_scan_destroy(ri_scan_t *sc)
+{
+	int i;
+	size_t j;
+	if (!sc) return;
+
+	ri_scan_stop(sc);
+	for (i = 0; i < sc->n_threads; ++i) pthread_join(sc->tid[i], 0);
+
+	for (j = 0; j < sc->dirs.n; ++j) free(sc->dirs.a[j]);
+	for (j = 0; j < sc->heap.n; ++j) free(sc->heap.a[j].fn);
+	rh_kv_destroy(sc->dirs);
+	rh_kv_destroy(sc->heap);
+
+	pthread_mutex_destroy(&sc->mutex);
+	pthread_cond_destroy(&sc->cv);
+	free(sc->tid);
+	free(sc);
+}
@@ -0,0 +1,60 @@
+#ifndef RSCAN_H
+#define RSCAN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ri_scan_s ri_scan_t;
+
+/**
+ * Starts a pool of threads that searches the input paths for signal files (see is_sfile) recursively.
+ * Files can be retrieved with ri_scan_next() while the scan continues.
+ *
+ * @param n_fn		number of input paths in $fn
+ * @param fn		input paths (signal files or directories)
+ * @param n_threads	number of threads that scan the directories
+ *
+ * @return			scanner (see ri_scan_destroy)
+ */
+ri_scan_t *ri_scan_init(int n_fn, const char **fn, int n_threads);
+
+/**
+ * Blocks until at least one signal file is found or the scan is complete
+ *
+ * @param sc	scanner (see ri_scan_init)
+ *
+ * @return		number of signal files found so far
+ */
+int64_t ri_scan_wait(ri_scan_t *sc);
+
+/**
+ * Returns the largest signal file among the files that are found but not returned yet so that
+ * the large files start first. Blocks until a file is found or the scan is complete.
+ *
+ * @param sc	scanner (see ri_scan_init)
+ *
+ * @return		path to the signal file (owned by the caller); NULL if all the files are returned
+ */
+char *ri_scan_next(ri_scan_t *sc);
+
+/**
+ * Stops the scan. Blocked and later ri_scan_next() calls return the files that are already found and then NULL
+ *
+ * @param sc	scanner (see ri_scan_init)
+ */
+void ri_scan_stop(ri_scan_t *sc);
+
+/**
+ * Stops the scan and deallocates the scanner
+ *
+ * @param sc	scanner to destroy
+ */
+void ri_scan_destroy(ri_scan_t *sc);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //RSCAN_H
@@ -0,0 +1,365 @@
+#include "rserve.h"
+#include "rmap.h"
+#include "rutils.h"
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "khash.h"
+#include "rh_kvec.h"
+
+#define RI_SRV_CLOSE 0 //the connection is closed (sent to the workers by the reader of the connection)
+#define RI_SRV_MAX_SIG (1U<<24) //maximum number of signal values in a chunk
+
+static volatile sig_atomic_t ri_srv_stop = 0;
+
+typedef struct ri_srv_conn_s{
+	int fd, id;
+	int refs; //the reader and the workers that have not processed the end of the connection yet
+	pthread_mutex_t lock; //serializes the replies
+	struct ri_srv_s *srv;
+} ri_srv_conn_t;
+
+typedef struct ri_srv_msg_s{
+	ri_srv_conn_t *conn;
+	ri_srv_chunk_t hdr;
+	char *id;
+	float *sig;
+	struct ri_srv_msg_s *next;
+} ri_srv_msg_t;
+
+typedef struct ri_srv_read_s{
+	uint32_t number;
+	int written; //1 if the mappings are written
+	ri_stream_t *st;
+} ri_srv_read_t;
+
+KHASH_MAP_INIT_INT64(srv, ri_srv_read_t)
+
+typedef struct ri_srv_worker_s{
+	struct ri_srv_s *srv;
+	ri_tbuf_t *b;
+	khash_t(srv) *h; //reads in progress on the channels of the worker. Key: connection id<<32 | channel
+	ri_srv_msg_t *head, *tail;
+	int stop;
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+} ri_srv_worker_t;
+
+typedef struct ri_srv_s{
+	const ri_idx_t *ri;
+	const ri_mapopt_t *opt;
+	int n_workers;
+	ri_srv_worker_t *w;
+	rh_kvec_t(ri_srv_conn_t*) conns; //connections that are still read
+	int n_conns; //number of connections so far
+	uint32_t n_reads, n_unblocked;
+	pthread_mutex_t mutex; //protects $conns and the output
+	pthread_cond_t cv;
+} ri_srv_t;
+
+static void ri_srv_sighandler(int sig) { (void)sig; ri_srv_stop = 1; }
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = (char*)buf;
+	while (len > 0) {
+		ssize_t r = read(fd, p, len);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		p += r, len -= r;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char*)buf;
+	while (len > 0) {
+		ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		p += r, len -= r;
+	}
+	return 0;
+}
+
+static void conn_unref(ri_srv_conn_t *conn)
+{
+	int refs;
+	pthread_mutex_lock(&conn->lock);
+	refs = --conn->refs;
+	pthread_mutex_unlock(&conn->lock);
+	if (refs > 0) return;
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+static void worker_push(ri_srv_worker_t *w, ri_srv_msg_t *msg)
+{
+	pthread_mutex_lock(&w->mutex);
+	if (w->tail) w->tail->next = msg;
+	else w->head = msg;
+	w->tail = msg;
+	pthread_cond_signal(&w->cv);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+static void srv_write(ri_srv_t *srv, ri_srv_read_t *r)
+{
+	const ri_reg1_t *reg0 = ri_stream_reg(r->st);
+	if (r->written || !reg0) return;
+	pthread_mutex_lock(&srv->mutex);
+	ri_write_reg(stdout, srv->ri, reg0, reg0->n_maps > 0);
+	fflush(stdout);
+	pthread_mutex_unlock(&srv->mutex);
+	r->written = 1;
+}
+
+//Ends the read in the slot $k of the worker. Reads that end before a decision are mapped with what is received
+static void srv_end_read(ri_srv_worker_t *w, khint_t k)
+{
+	ri_srv_read_t *r = &kh_val(w->h, k);
+	ri_stream_finish(r->st, w->b);
+	srv_write(w->srv, r);
+	ri_stream_close(r->st);
+	kh_del(srv, w->h, k);
+}
+
+static void srv_chunk(ri_srv_worker_t *w, ri_srv_msg_t *msg)
+{
+	ri_srv_t *srv = w->srv;
+	ri_srv_conn_t *conn = msg->conn;
+	uint64_t key = (uint64_t)conn->id<<32 | msg->hdr.channel;
+	khint_t k = kh_get(srv, w->h, key);
+	int absent;
+
+	//a new read on the channel ends the previous one
+	if (k != kh_end(w->h) && kh_val(w->h, k).number != msg->hdr.number) {
+		srv_end_read(w, k);
+		k = kh_end(w->h);
+	}
+	if (msg->hdr.type == RI_SRV_END) {
+		if (k != kh_end(w->h)) srv_end_read(w, k);
+		return;
+	}
+
+	if (k == kh_end(w->h)) {
+		char name[32];
+		if (!msg->id) snprintf(name, 32, "%u_%u", msg->hdr.channel, msg->hdr.number);
+		k = kh_put(srv, w->h, key, &absent);
+		ri_srv_read_t *r = &kh_val(w->h, k);
+		r->number = msg->hdr.number;
+		r->written = 0;
+		r->st = ri_stream_open(srv->ri, srv->opt, __sync_fetch_and_add(&srv->n_reads, 1), msg->id? msg->id : name);
+	}
+
+	ri_srv_read_t *r = &kh_val(w->h, k);
+	int ret = ri_stream_push(r->st, w->b, msg->sig, msg->hdr.n_sig);
+
+	ri_srv_decision_t d;
+	memset(&d, 0, sizeof(ri_srv_decision_t));
+	d.channel = msg->hdr.channel;
+	d.number = msg->hdr.number;
+	d.decision = RI_SRV_CONTINUE;
+	if (ret != RI_STREAM_MORE) {
+		int unblock = (ret == RI_STREAM_MAPPED) == !!(srv->opt->flag & RI_M_UNBLOCK_MAPPED);
+		d.decision = unblock? RI_SRV_UNBLOCK : RI_SRV_STOP_RECEIVING;
+		if (!r->written && unblock) __sync_fetch_and_add(&srv->n_unblocked, 1);
+		srv_write(srv, r);
+	}
+
+	pthread_mutex_lock(&conn->lock);
+	write_full(conn->fd, &d, sizeof(ri_srv_decision_t));
+	pthread_mutex_unlock(&conn->lock);
+}
+
+//Ends all the reads of a closed connection on the channels of the worker
+static void srv_close(ri_srv_worker_t *w, ri_srv_conn_t *conn)
+{
+	khint_t k;
+	for (k = 0; k < kh_end(w->h); ++k)
+		if (kh_exist(w->h, k) && (int)(kh_key(w->h, k)>>32) == conn->id) srv_end_read(w, k);
+	conn_unref(conn);
+}
+
+static void *srv_worker(void *data)
+{
+	ri_srv_worker_t *w = (ri_srv_worker_t*)data;
+	for (;;) {
+		pthread_mutex_lock(&w->mutex);
+		while (!w->head && !w->stop) pthread_cond_wait(&w->cv, &w->mutex);
+		ri_srv_msg_t *msg = w->head;
+		if (msg) {
+			w->head = msg->next;
+			if (!w->head) w->tail = 0;
+		}
+		pthread_mutex_unlock(&w->mutex);
+		if (!msg) break; //stopped and no message is left
+
+		if (msg->hdr.type == RI_SRV_CLOSE) srv_close(w, msg->conn);
+		else srv_chunk(w, msg);
+		free(msg->id); free(msg->sig); free(msg);
+	}
+	return 0;
+}
+
+//Reads the messages of a connection and passes them to the worker of their channel
+static void *srv_reader(void *data)
+{
+	ri_srv_conn_t *conn = (ri_srv_conn_t*)data;
+	ri_srv_t *srv = conn->srv;
+	ri_srv_chunk_t hdr;
+	int i;
+
+	while (read_full(conn->fd, &hdr, sizeof(ri_srv_chunk_t)) == 0) {
+		if ((hdr.type != RI_SRV_CHUNK && hdr.type != RI_SRV_END) || hdr.n_sig > RI_SRV_MAX_SIG) {
+			fprintf(stderr, "[WARNING] invalid message from client %d. Closing the connection\n", conn->id);
+			break;
+		}
+		ri_srv_msg_t *msg = (ri_srv_msg_t*)calloc(1, sizeof(ri_srv_msg_t));
+		msg->conn = conn;
+		msg->hdr = hdr;
+		if (hdr.l_id) {
+			msg->id = (char*)malloc(hdr.l_id + 1);
+			msg->id[hdr.l_id] = 0;
+		}
+		if (hdr.n_sig) msg->sig = (float*)malloc(hdr.n_sig * sizeof(float));
+		if ((hdr.l_id && read_full(conn->fd, msg->id, hdr.l_id) != 0) ||
+			(hdr.n_sig && read_full(conn->fd, msg->sig, hdr.n_sig * sizeof(float)) != 0)) {
+			free(msg->id); free(msg->sig); free(msg);
+			break;
+		}
+		worker_push(&srv->w[hdr.channel % srv->n_workers], msg);
+	}
+
+	//every worker ends the reads of the connection on its channels after the messages that are already passed
+	pthread_mutex_lock(&conn->lock);
+	conn->refs += srv->n_workers;
+	pthread_mutex_unlock(&conn->lock);
+	for (i = 0; i < srv->n_workers; ++i) {
+		ri_srv_msg_t *msg = (ri_srv_msg_t*)calloc(1, sizeof(ri_srv_msg_t));
+		msg->conn = conn;
+		msg->hdr.type = RI_SRV_CLOSE;
+		worker_push(&srv->w[i], msg);
+	}
+
+	pthread_mutex_lock(&srv->mutex);
+	for (i = 0; i < (int)srv->conns.n; ++i)
+		if (srv->conns.a[i] == conn) { srv->conns.a[i] = srv->conns.a[--srv->conns.n]; break; }
+	pthread_cond_broadcast(&srv->cv);
+	pthread_mutex_unlock(&srv->mutex);
+	conn_unref(conn);
+	return 0;
+}
+
+int ri_serve(const ri_idx_t *ri, const ri_mapopt_t *opt, const char *path, int n_threads)
+{
+	ri_srv_t srv;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	int i, fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "[ERROR] socket path '%s' is too long\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	//a socket left by an earlier daemon is replaced
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+		fprintf(stderr, "[ERROR] failed to listen on '%s': %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ri_srv_sighandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&srv, 0, sizeof(ri_srv_t));
+	srv.ri = ri, srv.opt = opt;
+	srv.n_workers = n_threads > 1? n_threads : 1;
+	pthread_mutex_init(&srv.mutex, 0);
+	pthread_cond_init(&srv.cv, 0);
+	srv.w = (ri_srv_worker_t*)calloc(srv.n_workers, sizeof(ri_srv_worker_t));
+	for (i = 0; i < srv.n_workers; ++i) {
+		ri_srv_worker_t *w = &srv.w[i];
+		w->srv = &srv;
+		w->b = ri_tbuf_init();
+		w->h = kh_init(srv);
+		pthread_mutex_init(&w->mutex, 0);
+		pthread_cond_init(&w->cv, 0);
+		pthread_create(&w->tid, 0, srv_worker, w);
+	}
+
+	if (ri_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] listening on %s with %d threads\n", __func__, ri_realtime() - ri_realtime0, ri_cputime() / (ri_realtime() - ri_realtime0), path, srv.n_workers);
+
+	while (!ri_srv_stop) {
+		struct pollfd pfd;
+		pfd.fd = fd, pfd.events = POLLIN, pfd.revents = 0;
+		if (poll(&pfd, 1, 200) <= 0 || !(pfd.revents & POLLIN)) continue;
+
+		int cfd = accept(fd, 0, 0);
+		if (cfd < 0) continue;
+		ri_srv_conn_t *conn = (ri_srv_conn_t*)calloc(1, sizeof(ri_srv_conn_t));
+		conn->fd = cfd;
+		conn->srv = &srv;
+		conn->refs = 1;
+		pthread_mutex_init(&conn->lock, 0);
+
+		pthread_t tid;
+		pthread_mutex_lock(&srv.mutex);
+		conn->id = srv.n_conns++;
+		rh_kv_push(ri_srv_conn_t*, 0, srv.conns, conn);
+		pthread_mutex_unlock(&srv.mutex);
+		pthread_create(&tid, 0, srv_reader, conn);
+		pthread_detach(tid);
+	}
+	close(fd);
+	unlink(path);
+
+	//the readers stop once their connections are shut down
+	pthread_mutex_lock(&srv.mutex);
+	for (i = 0; i < (int)srv.conns.n; ++i) shutdown(srv.conns.a[i]->fd, SHUT_RDWR);
+	while (srv.conns.n) pthread_cond_wait(&srv.cv, &srv.mutex);
+	pthread_mutex_unlock(&srv.mutex);
+
+	for (i = 0; i < srv.n_workers; ++i) {
+		ri_srv_worker_t *w = &srv.w[i];
+		pthread_mutex_lock(&w->mutex);
+		w->stop = 1;
+		pthread_cond_signal(&w->cv);
+		pthread_mutex_unlock(&w->mutex);
+		pthread_join(w->tid, 0);
+		ri_tbuf_destroy(w->b);
+		kh_destroy(srv, w->h);
+		pthread_mutex_destroy(&w->mutex);
+		pthread_cond_destroy(&w->cv);
+	}
+	free(srv.w);
+	rh_kv_destroy(srv.conns);
+	pthread_mutex_destroy(&srv.mutex);
+	pthread_cond_destroy(&srv.cv);
+
+	if (ri_verbose >= 3)
+		fprintf(stderr, "[M::%s] stopped after %u reads from %d clients (%u unblocked)\n", __func__, srv.n_reads, srv.n_conns, srv.n_unblocked);
+	return 0;
+}
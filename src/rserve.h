@@ -0,0 +1,83 @@
+#ifndef RSERVE_H
+#define RSERVE_H
+
+#include <stdint.h>
+#include "rindex.h"
+#include "roptions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Protocol of the mapping daemon (see ri_serve). Messages are exchanged over a Unix domain stream socket in native
+ * byte order.
+ *
+ * Client -> daemon: ri_srv_chunk_t, followed by l_id bytes of the read id (not NUL-terminated), followed by n_sig
+ *                   signal values of the read in pA (float)
+ * Daemon -> client: ri_srv_decision_t for every RI_SRV_CHUNK message, in the order the chunks of a channel are sent
+ *
+ * A read is identified by its channel and its number. A chunk of a new read on a channel ends the previous read of
+ * the channel. The read id is needed only in the first chunk of a read.
+ */
+
+#define RI_SRV_CHUNK	1 //next chunk of signal values of a read
+#define RI_SRV_END		2 //the read ended (no reply)
+
+#define RI_SRV_CONTINUE			0 //no decision yet: keep sending the chunks of the read
+#define RI_SRV_STOP_RECEIVING	1 //keep sequencing the read but stop sending its chunks
+#define RI_SRV_UNBLOCK			2 //eject the read from the pore
+
+typedef struct ri_srv_chunk_s{
+	uint32_t channel;
+	uint32_t number; //read number on the channel
+	uint32_t n_sig; //number of signal values that follow the read id
+	uint16_t l_id; //length of the read id that follows the message
+	uint8_t type; //RI_SRV_CHUNK or RI_SRV_END
+	uint8_t pad;
+} ri_srv_chunk_t;
+
+typedef struct ri_srv_decision_s{
+	uint32_t channel;
+	uint32_t number;
+	uint8_t decision; //RI_SRV_CONTINUE, RI_SRV_STOP_RECEIVING, or RI_SRV_UNBLOCK
+	uint8_t pad[3];
+} ri_srv_decision_t;
+
+/**
+ * Map the reads that the clients stream over a Unix domain socket until SIGINT or SIGTERM is received.
+ * Mapped reads are kept (RI_SRV_STOP_RECEIVING) and the reads that cannot be mapped are ejected (RI_SRV_UNBLOCK).
+ * RI_M_UNBLOCK_MAPPED in opt->flag reverses the decisions (e.g., to deplete a genome).
+ * The mappings of all the reads are written to stdout in PAF once they are decided.
+ *
+ * @param ri		index (see rindex.h)
+ * @param opt		mapping options
+ * @param path		path to the socket to create
+ * @param n_threads	number of threads to map the chunks. Chunks of a channel are always mapped by the same thread
+ *
+ * @return			0 if the daemon stops with no issues. -1, otherwise.
+ */
+int ri_serve(const ri_idx_t *ri, const ri_mapopt_t *opt, const char *path, int n_threads);
+
+/**
+ * Replay the reads in the signal files as if they were sequenced on a flow cell and stream them to a daemon
+ * (see ri_serve). Every channel sends the next chunk of its read every $chunk_sec seconds until the daemon decides
+ * or the read ends, then moves to the next read. Reports the decisions and the latency of the replies.
+ *
+ * @param path			path to the socket of the daemon
+ * @param n_fn			number of input paths in $fn
+ * @param fn			input paths (signal files or directories)
+ * @param n_channels	number of channels that sequence at the same time
+ * @param sample_rate	number of signal values a channel generates per second
+ * @param chunk_sec		seconds of signal in a chunk
+ * @param max_reads		maximum number of reads to replay (0: all reads)
+ * @param n_threads		number of threads to read the signal files
+ *
+ * @return				0 if the replay is completed with no issues. -1, otherwise.
+ */
+int ri_simulate(const char *path, int n_fn, const char **fn, int n_channels, uint32_t sample_rate, float chunk_sec, int64_t max_reads, int n_threads);
+
+#ifdef __cplusplus
+}
+#endif
+#endif //RSERVE_H
@@ -1,5 +1,7 @@
 #include "rsig.h"
+#include "rpack.h"
 #include "rh_kvec.h"
+#include "kthread.h"
 #include <math.h>
 #ifndef NHDF5RH
 #include <cstring>
@@ -8,7 +10,13 @@
 #include <errno.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <dirent.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 void ri_seq_to_sig(const char *str,
 				   int len,
@@ -49,7 +57,305 @@ void ri_seq_to_sig(const char *str,
 	*s_len = j;
 }
 
+//Calibrate-and-filter kernels: convert $raw into pA and keep the values within (30, 200) pA until $n values are kept.
+//Kept values are written to $out unless it is NULL. Returns the number of raw samples consumed and sets $n_out to the number of kept values.
+//All kernels use the same arithmetic as the scalar kernel so that they produce identical values.
+typedef uint64_t (*ri_sig_filter_f)(const ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t n, float* out, uint32_t* n_out);
+
+static uint64_t ri_sig_filter_scalar(const ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t n, float* out, uint32_t* n_out){
+	uint64_t i = 0;
+	uint32_t l = 0;
+	if(s->format == RI_SIG_SLOW5){
+		float pa = 0.0f;
+		for(i = 0; i < n_raw && l < n; ++i){
+			pa = (raw[i]+s->cal_offset)*s->cal_scale;
+			if (pa > 30.0f && pa < 200.0f){
+				if(out) out[l] = pa;
+				++l;
+			}
+		}
+	}else{
+		float offset = (float)s->cal_offset, scale = (float)s->cal_scale, pa = 0.0f;
+		//FAST5 signals are stored as integer pA values
+		int is_int = (s->format == RI_SIG_FAST5);
+		for(i = 0; i < n_raw && l < n; ++i){
+			pa = (raw[i]+offset)*scale;
+			if (pa > 30.0f && pa < 200.0f){
+				if(out) out[l] = is_int?(float)(int16_t)pa:pa;
+				++l;
+			}
+		}
+	}
+	*n_out = l;
+	return i;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+//Lanes to keep for each 8-bit mask (used to compact 8 values with a single permutation in AVX2)
+static int32_t ri_sig_compress_lut[256][8] __attribute__((aligned(32)));
+
+__attribute__((target("avx2,popcnt")))
+static uint64_t ri_sig_filter_avx2(const ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t n, float* out, uint32_t* n_out){
+	uint64_t i = 0;
+	uint32_t l = 0, l_tail = 0;
+	int is_int = (s->format == RI_SIG_FAST5), is_double = (s->format == RI_SIG_SLOW5);
+	const __m256 lo = _mm256_set1_ps(30.0f), hi = _mm256_set1_ps(200.0f);
+	const __m256 offset = _mm256_set1_ps((float)s->cal_offset), scale = _mm256_set1_ps((float)s->cal_scale);
+	const __m256d offset_d = _mm256_set1_pd(s->cal_offset), scale_d = _mm256_set1_pd(s->cal_scale);
+
+	//a block is processed only if all of its 8 values fit in $out
+	for(; i + 8 <= n_raw && n - l >= 8; i += 8){
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(raw + i)));
+		__m256 pa;
+		if(is_double){
+			__m256d pa1 = _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), offset_d), scale_d);
+			__m256d pa2 = _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), offset_d), scale_d);
+			pa = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(pa1)), _mm256_cvtpd_ps(pa2), 1);
+		}else pa = _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(v), offset), scale);
+
+		int m = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(pa, lo, _CMP_GT_OQ), _mm256_cmp_ps(pa, hi, _CMP_LT_OQ)));
+		if(out && m){
+			if(is_int) pa = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(pa));
+			_mm256_storeu_ps(out + l, _mm256_permutevar8x32_ps(pa, _mm256_load_si256((const __m256i*)ri_sig_compress_lut[m])));
+		}
+		l += _mm_popcnt_u32(m);
+	}
+
+	i += ri_sig_filter_scalar(s, raw + i, n_raw - i, n - l, out?out + l:0, &l_tail);
+	*n_out = l + l_tail;
+	return i;
+}
+
+//GCC reports false positives on the undefined registers used by the AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,popcnt")))
+static uint64_t ri_sig_filter_avx512(const ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t n, float* out, uint32_t* n_out){
+	uint64_t i = 0;
+	uint32_t l = 0, l_tail = 0;
+	int is_int = (s->format == RI_SIG_FAST5), is_double = (s->format == RI_SIG_SLOW5);
+	const __m512 lo = _mm512_set1_ps(30.0f), hi = _mm512_set1_ps(200.0f);
+	const __m512 offset = _mm512_set1_ps((float)s->cal_offset), scale = _mm512_set1_ps((float)s->cal_scale);
+	const __m512d offset_d = _mm512_set1_pd(s->cal_offset), scale_d = _mm512_set1_pd(s->cal_scale);
+
+	for(; i + 16 <= n_raw && n - l >= 16; i += 16){
+		__m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(raw + i)));
+		__m512 pa;
+		if(is_double){
+			__m512d pa1 = _mm512_mul_pd(_mm512_add_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(v)), offset_d), scale_d);
+			__m512d pa2 = _mm512_mul_pd(_mm512_add_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1)), offset_d), scale_d);
+			pa = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(pa1))), _mm256_castps_pd(_mm512_cvtpd_ps(pa2)), 1));
+		}else pa = _mm512_mul_ps(_mm512_add_ps(_mm512_cvtepi32_ps(v), offset), scale);
+
+		__mmask16 m = _mm512_cmp_ps_mask(pa, lo, _CMP_GT_OQ) & _mm512_cmp_ps_mask(pa, hi, _CMP_LT_OQ);
+		if(out && m){
+			if(is_int) pa = _mm512_cvtepi32_ps(_mm512_cvttps_epi32(pa));
+			_mm512_mask_compressstoreu_ps(out + l, m, pa);
+		}
+		l += _mm_popcnt_u32(m);
+	}
+
+	i += ri_sig_filter_scalar(s, raw + i, n_raw - i, n - l, out?out + l:0, &l_tail);
+	*n_out = l + l_tail;
+	return i;
+}
+#pragma GCC diagnostic pop
+#endif
+
+//Selects the fastest kernel supported by the CPU
+static ri_sig_filter_f ri_sig_filter_select(void){
+	#if defined(__x86_64__) && defined(__GNUC__)
+	for(int m = 0; m < 256; ++m)
+		for(int j = 0, k = 0; j < 8; ++j)
+			if(m&(1<<j)) ri_sig_compress_lut[m][k++] = j;
+
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return ri_sig_filter_avx512;
+	if(__builtin_cpu_supports("avx2")) return ri_sig_filter_avx2;
+	#endif
+	return ri_sig_filter_scalar;
+}
+
+static inline uint64_t ri_sig_filter(const ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t n, float* out, uint32_t* n_out){
+	static const ri_sig_filter_f filter = ri_sig_filter_select();
+	return filter(s, raw, n_raw, n, out, n_out);
+}
+
+//Counts the signal values in the next $n_raw raw samples of $s (stored in $raw) until $s->l_sig reaches $max_sig (0: no limit).
+//Returns the number of raw samples consumed
+static uint64_t ri_sig_count(ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t max_sig){
+	uint32_t l = 0, n = max_sig?(s->l_sig < max_sig?max_sig - s->l_sig:0):UINT32_MAX - s->l_sig;
+	uint64_t i = ri_sig_filter(s, raw, n_raw, n, 0, &l);
+	s->l_sig += l;
+	s->raw_pos += i;
+	return i;
+}
+
+//Appends the raw samples to $s->raw until $s->l_sig reaches $max_sig (0: no limit). Only the consumed samples are copied
+static void ri_sig_append(ri_sig_t* s, const int16_t* raw, uint64_t n_raw, uint32_t max_sig){
+	uint64_t pos = s->raw_pos, i = ri_sig_count(s, raw, n_raw, max_sig);
+	s->raw = (int16_t*)realloc(s->raw, s->raw_pos*sizeof(int16_t));
+	s->m_raw = s->raw_pos;
+	memcpy(s->raw + pos, raw, i*sizeof(int16_t));
+}
+
+#if !defined(NPOD5RH) || !defined(NSLOW5RH)
+//Copies all the $s->l_raw decoded samples of a POD5 or SLOW5 read to $s->raw but reads only the first $max_sig signal values.
+//The rest are read by ri_read_sig_more without decoding the read again
+static void ri_sig_keep(ri_sig_t* s, const int16_t* raw, uint32_t max_sig){
+	s->raw = (int16_t*)malloc(s->l_raw*sizeof(int16_t));
+	s->m_raw = s->l_raw;
+	memcpy(s->raw, raw, s->l_raw*sizeof(int16_t));
+	ri_sig_count(s, s->raw, s->l_raw, max_sig);
+}
+#endif
+
+uint32_t ri_sig_convert(const ri_sig_t* s, uint64_t* raw_pos, uint32_t n, float* out){
+	uint32_t l = 0;
+	*raw_pos += ri_sig_filter(s, s->raw + *raw_pos, s->raw_pos - *raw_pos, n, out, &l);
+	return l;
+}
+
+//pA value of the raw sample $r, computed as in ri_sig_filter_scalar
+static inline float ri_sig_pa(const ri_sig_t* s, int32_t r){
+	return s->format == RI_SIG_SLOW5?(r+s->cal_offset)*s->cal_scale:(r+(float)s->cal_offset)*(float)s->cal_scale;
+}
+
+int ri_sig_range_i16(const ri_sig_t* s, int16_t* lo, int16_t* hi){
+	//FAST5 signal values are integer pA values
+	if(s->format == RI_SIG_FAST5){*lo = 30; *hi = 199; return 1;}
+	if(!(s->cal_scale > 0)) return 0;
+
+	//The pA value increases with the raw sample, so the kept samples form a range
+	int32_t a = INT16_MIN, b = INT16_MAX + 1, m;
+	while(a < b){m = a + (b-a)/2; if(ri_sig_pa(s, m) > 30.0f) b = m; else a = m + 1;}
+	int32_t l = a;
+	for(b = INT16_MAX + 1; a < b;){m = a + (b-a)/2; if(ri_sig_pa(s, m) < 200.0f) a = m + 1; else b = m;}
+	if(l > a - 1) return 0;
+	*lo = (int16_t)l; *hi = (int16_t)(a - 1);
+	return 1;
+}
+
+uint32_t ri_sig_convert_i16(const ri_sig_t* s, uint64_t* raw_pos, uint32_t n, int16_t* out){
+	const int16_t* raw = s->raw + *raw_pos;
+	uint64_t i = 0, n_raw = s->raw_pos - *raw_pos;
+	uint32_t l = 0;
+	if(s->format == RI_SIG_FAST5){
+		float offset = (float)s->cal_offset, scale = (float)s->cal_scale, pa;
+		for(i = 0; i < n_raw && l < n; ++i){
+			pa = (raw[i]+offset)*scale;
+			out[l] = (int16_t)pa;
+			l += (pa > 30.0f && pa < 200.0f);
+		}
+	}else{
+		int16_t lo, hi;
+		if(!ri_sig_range_i16(s, &lo, &hi)) lo = 1, hi = 0;
+		//the raw samples are kept as they are. Only an integer range check per sample
+		for(i = 0; i < n_raw && l < n; ++i){
+			out[l] = raw[i];
+			l += (raw[i] >= lo && raw[i] <= hi);
+		}
+	}
+	*raw_pos += i;
+	return l;
+}
+
 #ifndef NHDF5RH
+//Reads the numeric attribute $name of the object $oid in the same way as hdf5_tools::File::get_attr_map and atof do
+//(i.e., floating-point values are rounded to 6 significant digits). Returns 0 if the attribute does not exist
+static double ri_fast5_attr_num(hid_t oid, const char* name){
+
+	if(H5Aexists(oid, name) <= 0) return 0;
+	hid_t aid = H5Aopen(oid, name, H5P_DEFAULT);
+	if(aid < 0) return 0;
+
+	hid_t ftype = H5Aget_type(aid);
+	H5T_class_t cl = H5Tget_class(ftype);
+	char buf[64] = {0};
+	double res = 0;
+	if(cl == H5T_FLOAT){
+		double d = 0;
+		if(H5Aread(aid, H5T_NATIVE_DOUBLE, &d) >= 0){
+			snprintf(buf, sizeof(buf), "%g", d);
+			res = atof(buf);
+		}
+	}else if(cl == H5T_INTEGER){
+		long long d = 0;
+		if(H5Aread(aid, H5T_NATIVE_LLONG, &d) >= 0) res = (double)d;
+	}else if(cl == H5T_STRING){
+		hid_t mtype = H5Tcopy(H5T_C_S1);
+		H5Tset_cset(mtype, H5Tget_cset(ftype));
+		if(H5Tis_variable_str(ftype) > 0){
+			char* str = 0;
+			H5Tset_size(mtype, H5T_VARIABLE);
+			if(H5Aread(aid, mtype, &str) >= 0 && str){
+				res = atof(str);
+				H5free_memory(str);
+			}
+		}else{
+			H5Tset_size(mtype, sizeof(buf));
+			if(H5Tget_size(ftype) < sizeof(buf) && H5Aread(aid, mtype, buf) >= 0) res = atof(buf);
+		}
+		H5Tclose(mtype);
+	}
+
+	H5Tclose(ftype);
+	H5Aclose(aid);
+	return res;
+}
+
+//Reads the string attribute $name of the object $oid. Returns NULL if the attribute does not exist
+static char* ri_fast5_attr_str(hid_t oid, const char* name){
+
+	if(H5Aexists(oid, name) <= 0) return 0;
+	hid_t aid = H5Aopen(oid, name, H5P_DEFAULT);
+	if(aid < 0) return 0;
+
+	hid_t ftype = H5Aget_type(aid);
+	char* res = 0;
+	if(H5Tget_class(ftype) == H5T_STRING){
+		hid_t mtype = H5Tcopy(H5T_C_S1);
+		H5Tset_cset(mtype, H5Tget_cset(ftype));
+		if(H5Tis_variable_str(ftype) > 0){
+			char* str = 0;
+			H5Tset_size(mtype, H5T_VARIABLE);
+			if(H5Aread(aid, mtype, &str) >= 0 && str){
+				res = strdup(str);
+				H5free_memory(str);
+			}
+		}else{
+			size_t l = H5Tget_size(ftype);
+			H5Tset_size(mtype, l+1);
+			res = (char*)calloc(l+1, sizeof(char));
+			if(H5Aread(aid, mtype, res) < 0){free(res); res = 0;}
+		}
+		H5Tclose(mtype);
+	}
+
+	H5Tclose(ftype);
+	H5Aclose(aid);
+	return res;
+}
+
+//Reads the read id from the raw group $raw_path and the calibration values from the channel group $ch_path (skipped if NULL)
+static void ri_fast5_read_meta(hid_t fid, const char* raw_path, const char* ch_path, ri_fast5_read_t* r){
+
+	hid_t oid = H5Oopen(fid, raw_path, H5P_DEFAULT);
+	if(oid >= 0){
+		r->name = ri_fast5_attr_str(oid, "read_id");
+		H5Oclose(oid);
+	}
+
+	if(!ch_path) return;
+	oid = H5Oopen(fid, ch_path, H5P_DEFAULT);
+	if(oid >= 0){
+		r->dig = ri_fast5_attr_num(oid, "digitisation");
+		r->ran = ri_fast5_attr_num(oid, "range");
+		r->offset = ri_fast5_attr_num(oid, "offset");
+		H5Oclose(oid);
+	}
+}
+
 static inline ri_sig_file_t *ri_sig_open_fast5(const char *fn)
 {
 	ri_sig_file_t *fp;
@@ -74,7 +380,7 @@ static inline ri_sig_file_t *ri_sig_open_fast5(const char *fn)
 	bool is_single = false;
 	std::vector<std::string> fast5_file_groups = fast5_file->list_group("/");
 	fp->num_read = fast5_file_groups.size();
-	fp->ch_path = (char**)calloc(fp->num_read, sizeof(char*));
+	fp->fast5_reads = (ri_fast5_read_t*)calloc(fp->num_read, sizeof(ri_fast5_read_t));
 	fp->raw_path = (char**)calloc(fp->num_read, sizeof(char*));
 
 	for (std::string &group : fast5_file_groups) {
@@ -96,15 +402,23 @@ static inline ri_sig_file_t *ri_sig_open_fast5(const char *fn)
 				fprintf(stderr, "ERROR: More reads than previously predicted (%d). Stopped reading the reads here.\n", fp->num_read);
 				break;
 			}
-			fp->ch_path[i] = strdup(ch_path.c_str());
-			fp->raw_path[i++] = strdup(raw_path.c_str());
+			fp->raw_path[i] = strdup(raw_path.c_str());
+			//all the reads share the same channel
+			ri_fast5_read_meta(fast5_file->id(), fp->raw_path[i], i?NULL:ch_path.c_str(), &fp->fast5_reads[i]);
+			if(i){
+				fp->fast5_reads[i].dig = fp->fast5_reads[0].dig;
+				fp->fast5_reads[i].ran = fp->fast5_reads[0].ran;
+				fp->fast5_reads[i].offset = fp->fast5_reads[0].offset;
+			}
+			++i;
 		}
 	} else {
 		for (std::string &read : fast5_file_groups) {
 			raw_path = "/" + read + "/Raw";
 			ch_path = "/" + read + "/channel_id";
-			fp->ch_path[i] = strdup(ch_path.c_str());
-			fp->raw_path[i++] = strdup(raw_path.c_str());
+			fp->raw_path[i] = strdup(raw_path.c_str());
+			ri_fast5_read_meta(fast5_file->id(), fp->raw_path[i], ch_path.c_str(), &fp->fast5_reads[i]);
+			++i;
 		}
 	}
 
@@ -115,8 +429,16 @@ static inline ri_sig_file_t *ri_sig_open_fast5(const char *fn)
 #endif
 
 #ifndef NPOD5RH
+//Initializes the POD5 library only once
+static void ri_pod5_init(void){
+	static const int init = (pod5_init(), 1);
+	(void)init;
+}
+
+static void ri_pod5_free_batch(ri_sig_file_t* fp);
+
 static inline ri_sig_file_t *ri_sig_open_pod5(const char *fn){
-	pod5_init();
+	ri_pod5_init();
 
 	ri_sig_file_t *fp;
 
@@ -149,28 +471,10 @@ static inline ri_sig_file_t *ri_sig_open_pod5(const char *fn){
 	fp->num_read = batch_count; //num_read is the number of batches for pod5
 	fp->cur_read = 0; //cur_read is cur_batch for pod5
 
-	Pod5ReadRecordBatch_t* batch = NULL;
-	if(pod5_get_read_batch(&batch, pod5_file, fp->cur_read) != POD5_OK){
-		fprintf(stderr, "Failed to get batch: %s\n", pod5_get_error_string());
-		pod5_close_and_free_reader(pod5_file);
-		free(fp);
-		return 0;
-	}
-
-	long unsigned int batch_row_count = 0;
-	if(pod5_get_read_batch_row_count(&batch_row_count, batch) != POD5_OK) {
-		fprintf(stderr, "Failed to get batch row count\n");
-		pod5_close_and_free_reader(pod5_file);
-		pod5_free_read_batch(batch);
-		free(fp);
-		return 0;
-	}
-
-	fp->pod5_row_count = batch_row_count;
+	//Batches are decoded when their reads are requested (see ri_read_sig_pod5)
+	fp->batch = NULL;
+	fp->pod5_row_count = 0;
 	fp->pod5_row = 0;
-	
-	fp->batch = batch;
-	fp->num_read = batch_count;
 
 	return fp;
 }
@@ -206,22 +510,63 @@ static inline ri_sig_file_t *ri_sig_open_slow5(const char *fn){
 }
 #endif
 
+//Maps a signal pack (see rpack.h)
+static inline ri_sig_file_t *ri_sig_open_pack(const char *fn){
+
+	ri_sig_file_t *fp;
+	struct stat st;
+	void* map = MAP_FAILED;
+
+	int fd = open(fn, O_RDONLY);
+	if(fd < 0){
+		fprintf(stderr, "ERROR: Failed to open file %s\n", fn);
+		return 0;
+	}
+	if(fstat(fd, &st) == 0 && (uint64_t)st.st_size >= RI_PACK_DATA_OFF) map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		fprintf(stderr, "ERROR: Failed to map file %s\n", fn);
+		return 0;
+	}
+
+	const ri_pack_hdr_t* hdr = (const ri_pack_hdr_t*)map;
+	if(memcmp(hdr->magic, RI_PACK_MAGIC, 4) || hdr->version != RI_PACK_VERSION ||
+	   hdr->idx_off + hdr->n_reads*sizeof(ri_pack_read_t) > hdr->names_off || hdr->names_off > (uint64_t)st.st_size){
+		fprintf(stderr, "ERROR: %s is not a valid signal pack\n", fn);
+		munmap(map, st.st_size);
+		return 0;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	fp = (ri_sig_file_t*)calloc(1, sizeof(ri_sig_file_t));
+	fp->pack = map;
+	fp->pack_size = st.st_size;
+	fp->num_read = hdr->n_reads;
+	fp->cur_read = 0;
+
+	return fp;
+}
+
 ri_sig_file_t *ri_sig_open(const char *fn){
+	ri_sig_file_t *fp = 0;
 	if (strstr(fn, ".fast5")) {
 		#ifndef NHDF5RH
-		return ri_sig_open_fast5(fn);
+		fp = ri_sig_open_fast5(fn);
 		#endif
 	} else if (strstr(fn, ".pod5") || strstr(fn, ".pod")) {
 		#ifndef NPOD5RH
-		return ri_sig_open_pod5(fn);
+		fp = ri_sig_open_pod5(fn);
 		#endif
 	} else if (strstr(fn, ".slow5") || strstr(fn, ".blow5")) {
 		#ifndef NSLOW5RH
-		return ri_sig_open_slow5(fn);
+		fp = ri_sig_open_slow5(fn);
 		#endif
+	} else if (strstr(fn, ".rhsp")) {
+		fp = ri_sig_open_pack(fn);
 	}
 
-	return 0;
+	if(fp) fp->fn = strdup(fn);
+	return fp;
 }
 
 void ri_sig_close(ri_sig_file_t *fp)
@@ -233,26 +578,36 @@ void ri_sig_close(ri_sig_file_t *fp)
 	if(fp->fp){
 		fp->fp->close();
 		for(int i = 0; i < fp->num_read; ++i){
-			if(fp->ch_path[i])free(fp->ch_path[i]);
+			if(fp->fast5_reads[i].name)free(fp->fast5_reads[i].name);
 			if(fp->raw_path[i])free(fp->raw_path[i]);
 		}
-		free(fp->ch_path);
+		free(fp->fast5_reads);
 		free(fp->raw_path);
 		delete fp->fp;
 	}
 	#endif
 	#ifndef NPOD5RH
 	if(fp->pp){
+		if(fp->batch) ri_pod5_free_batch(fp);
+		for(int i = 0; i < fp->pod5_n_buf; ++i) if(fp->pod5_buf[i]) free(fp->pod5_buf[i]);
+		if(fp->pod5_buf) free(fp->pod5_buf);
+		if(fp->pod5_m_buf) free(fp->pod5_m_buf);
+		if(fp->pod5_sigs) free(fp->pod5_sigs);
 		pod5_close_and_free_reader(fp->pp);
 	}
 	#endif
 
 	#ifndef NSLOW5RH
 	if(fp->sp){
+		if(fp->slow5_batch) slow5_free_batch(fp->slow5_batch);
+		if(fp->slow5_mt) slow5_free_mt(fp->slow5_mt);
 		slow5_close(fp->sp);
 	}
 	#endif
 
+	if(fp->pack) munmap(fp->pack, fp->pack_size);
+
+	if(fp->fn) free(fp->fn);
 	free(fp);
 }
 
@@ -295,10 +650,15 @@ int is_dir(const char *A)
 
 //Recursively find all files that ends with "fast5", "pod5", or "s/blow5" under input directory const char *A
 //Generated by GitHub Copilot
+int is_sfile(const char *A)
+{
+	return strstr(A, ".fast5") || strstr(A, ".pod5") || strstr(A, ".pod") || strstr(A, ".slow5") || strstr(A, ".blow5") || strstr(A, ".rhsp");
+}
+
 void find_sfiles(const char *A, ri_char_v *fnames)
 {
 	if (!is_dir(A)) {
-		if (strstr(A, ".fast5") || strstr(A, ".pod5") || strstr(A, ".pod") || strstr(A, ".slow5") || strstr(A, ".blow5")) {
+		if (is_sfile(A)) {
 			char** cur_fname;
 			rh_kv_pushp(char*, 0, *fnames, &cur_fname);
 			(*cur_fname) = strdup(A);
@@ -308,19 +668,27 @@ void find_sfiles(const char *A, ri_char_v *fnames)
 
 	DIR *dir;
 	struct dirent *ent;
+	size_t l = strlen(A);
 	if ((dir = opendir(A)) != NULL) {
 		while ((ent = readdir(dir)) != NULL) {
-			char *tmp = (char*)malloc(strlen(A) + strlen(ent->d_name) + 2);
-			sprintf(tmp, "%s/%s", A, ent->d_name);
-			if (is_dir(tmp)) {
+			//d_type avoids a stat call per entry unless the file system does not provide it
+			int is_d = ent->d_type == DT_DIR;
+			if (!is_d && !is_sfile(ent->d_name) && ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) continue;
+			if (is_d && (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))) continue;
+
+			size_t l_name = strlen(ent->d_name);
+			char *tmp = (char*)malloc(l + l_name + 2);
+			memcpy(tmp, A, l); tmp[l] = '/';
+			memcpy(tmp + l + 1, ent->d_name, l_name + 1);
+			if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) is_d = is_dir(tmp);
+			if (is_d) {
 				if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
 					find_sfiles(tmp, fnames);
-			} else {
-				if (strstr(ent->d_name, ".fast5") || strstr(ent->d_name, ".pod5") || strstr(ent->d_name, ".pod") || strstr(ent->d_name, ".slow5") || strstr(ent->d_name, ".blow5")) {
-					char** cur_fname;
-					rh_kv_pushp(char*, 0, *fnames, &cur_fname);
-					(*cur_fname) = strdup(tmp);
-				}
+			} else if (is_sfile(ent->d_name)) {
+				char** cur_fname;
+				rh_kv_pushp(char*, 0, *fnames, &cur_fname);
+				(*cur_fname) = tmp;
+				continue;
 			}
 			free(tmp);
 		}
@@ -329,206 +697,260 @@ void find_sfiles(const char *A, ri_char_v *fnames)
 }
 
 #ifndef NHDF5RH
-static inline void ri_read_sig_fast5(ri_sig_file_t* fp, ri_sig_t* s){
-
-	if(fp->cur_read >= fp->num_read) return;
-	
-	s->name = 0;
-	for (auto a : fp->fp->get_attr_map(fp->raw_path[fp->cur_read])) {
-		if (a.first == "read_id") {
-			s->name = strdup(a.second.c_str());
-		}
+//Reads the raw samples of a FAST5 read starting from $s->raw_pos in blocks until $s->raw includes $max_sig signal values within the expected range
+static void ri_read_sig_fast5_raw(hid_t fid, const char* raw_path, ri_sig_t* s, uint32_t max_sig){
+
+	std::string sig_path = std::string(raw_path) + "/Signal";
+	hid_t did = H5Dopen2(fid, sig_path.c_str(), H5P_DEFAULT);
+	if(did < 0){
+		fprintf(stderr, "ERROR: failed to open the dataset '%s'\n", sig_path.c_str());
+		s->l_raw = s->raw_pos;
+		return;
 	}
 
-	assert(s->name);
-
-	float dig = 0, ran = 0, offset = 0;
-
-	// float digitisation = 0, range = 0, offset = 0;
-	for (auto a : fp->fp->get_attr_map(fp->ch_path[fp->cur_read])) {
-		if (a.first == "channel_number") {
-		// channel_idx = atoi(a.second.c_str()) - 1;
-		} else if (a.first == "digitisation") {
-			dig = atof(a.second.c_str());
-		} else if (a.first == "range") {
-			ran = atof(a.second.c_str());
-		} else if (a.first == "offset") {
-			offset = atof(a.second.c_str());
+	hid_t fspace = H5Dget_space(did);
+	hsize_t dims[1] = {0};
+	H5Sget_simple_extent_dims(fspace, dims, NULL);
+	s->l_raw = dims[0];
+
+	while(s->raw_pos < s->l_raw && (!max_sig || s->l_sig < max_sig)){
+		hsize_t start = s->raw_pos, count = s->l_raw - s->raw_pos;
+		if(max_sig){
+			//some of the samples are filtered out. Read slightly more than needed to avoid too many small reads
+			hsize_t need = max_sig - s->l_sig;
+			need += need/4 + 1024;
+			if(count > need) count = need;
 		}
-	}
 
-	std::string sig_path = std::string(fp->raw_path[fp->cur_read]) + "/Signal";
-	std::vector<int16_t> sig;
-	fp->fp->read(sig_path, sig);
-	// convert to pA
-	uint32_t l_sig = 0;
-	float scale = ran/dig;
-	float pa = 0;
-	for (size_t i = 0; i < sig.size(); i++) {
-		pa = (sig[i]+offset)*scale;
-		if (pa > 30.0f && pa < 200.0f) {
-			sig[l_sig++] = pa;
+		s->raw = (int16_t*)realloc(s->raw, (s->raw_pos + count)*sizeof(int16_t));
+		hid_t mspace = H5Screate_simple(1, &count, NULL);
+		H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &start, NULL, &count, NULL);
+		herr_t status = H5Dread(did, H5T_NATIVE_INT16, mspace, fspace, H5P_DEFAULT, s->raw + s->raw_pos);
+		H5Sclose(mspace);
+		if(status < 0){
+			fprintf(stderr, "ERROR: failed to read the dataset '%s'\n", sig_path.c_str());
+			s->l_raw = s->raw_pos;
+			break;
 		}
+
+		ri_sig_count(s, s->raw + s->raw_pos, count, max_sig);
 	}
+	//drops the samples that are read beyond $max_sig
+	if(s->raw_pos < s->l_raw) s->raw = (int16_t*)realloc(s->raw, s->raw_pos*sizeof(int16_t));
+	s->m_raw = s->raw_pos;
 
-	s->sig = (float*)calloc(l_sig, sizeof(float));
-	s->l_sig = l_sig;
-	std::copy(sig.begin(), sig.begin() + l_sig, s->sig);
-	fp->cur_read++;
+	H5Sclose(fspace);
+	H5Dclose(did);
 }
-#endif
 
-#ifndef NPOD5RH
-static inline void ri_read_sig_pod5(ri_sig_file_t* fp, ri_sig_t* s){
+static inline void ri_read_sig_fast5(ri_sig_file_t* fp, ri_sig_t* s){
 
 	if(fp->cur_read >= fp->num_read) return;
-	if(fp->pod5_row >= fp->pod5_row_count) return;
+	
+	ri_fast5_read_t* r = &fp->fast5_reads[fp->cur_read];
+	s->name = r->name; r->name = 0;
 
-	pod5_init();
+	assert(s->name);
 
-    // Open the file ready for walking:
-    Pod5FileReader_t* pod5_file = fp->pp;
+	// convert to pA
+	float scale = r->ran/r->dig;
+	float offset = r->offset;
+	s->format = RI_SIG_FAST5;
+	s->cal_offset = offset; s->cal_scale = scale;
+	s->raw = 0; s->l_sig = 0;
+	s->l_raw = s->raw_pos = 0;
+	ri_read_sig_fast5_raw(fp->fp->id(), fp->raw_path[fp->cur_read], s, fp->max_sig);
+	if(s->raw_pos < s->l_raw){
+		s->fn = strdup(fp->fn);
+		s->loc = strdup(fp->raw_path[fp->cur_read]);
+	}
+	fp->cur_read++;
+}
+#endif
 
-    if (!pod5_file) {
-        fprintf(stderr, "Failed to open file %s\n", pod5_get_error_string());
-		return;
-    }
+#ifndef NPOD5RH
+//Decodes the read at row $i of the current batch into $fp->pod5_sigs[$i]. $tid selects the decode buffer.
+//The slot is left NULL if the read cannot be decoded (see ri_read_sig_pod5)
+static void ri_pod5_decode_worker(void *data, long i, int tid){
+	ri_sig_file_t* fp = (ri_sig_file_t*)data;
+	fp->pod5_sigs[i] = NULL;
 
 	uint16_t read_table_version = 0;
 	ReadBatchRowInfo_t read_data;
-	if (pod5_get_read_batch_row_info_data(fp->batch, fp->pod5_row, READ_BATCH_ROW_INFO_VERSION, &read_data, &read_table_version) != POD5_OK) {
-		fprintf(stderr, "Failed to get read %lu\n", fp->pod5_row);
+	if (pod5_get_read_batch_row_info_data(fp->batch, i, READ_BATCH_ROW_INFO_VERSION, &read_data, &read_table_version) != POD5_OK) {
+		fprintf(stderr, "Failed to get read %ld\n", i);
 		return;
 	}
 
-	//Retrieve global information for the run
-	RunInfoDictData_t* run_info_data;
-	if (pod5_get_run_info(fp->batch, read_data.run_info, &run_info_data) != POD5_OK) {
-		fprintf(stderr, "Failed to get Run Info %lu %s\n", fp->pod5_row, pod5_get_error_string());
-		pod5_release_run_info(run_info_data);
-		return;
+	if(read_data.num_samples > fp->pod5_m_buf[tid]){
+		fp->pod5_m_buf[tid] = read_data.num_samples;
+		fp->pod5_buf[tid] = (int16_t*)realloc(fp->pod5_buf[tid], fp->pod5_m_buf[tid]*sizeof(int16_t));
 	}
+	int16_t *sig = fp->pod5_buf[tid];
 
-	// Retrieves the digitisation and range for the channel
-	// CalibrationExtraData_t calibration_extra_info;
-	// pod5_get_calibration_extra_info(fp->batch, fp->pod5_row, &calibration_extra_info);
-	// float scale = calibration_extra_info.range / (float)calibration_extra_info.digitisation;
-
-	//This is same as read_data.num_samples
-	// unsigned long int sample_count = 0;
-	// pod5_get_read_complete_sample_count(fp->pp, fp->batch, fp->pod5_row, &sample_count);
-
-	int16_t *sig = (int16_t*)malloc(read_data.num_samples * sizeof(int16_t));
-	float *sigF = (float*)malloc(read_data.num_samples * sizeof(float));
-	
-	if (pod5_get_read_complete_signal(pod5_file, fp->batch, fp->pod5_row, read_data.num_samples, sig) != POD5_OK) {
-		fprintf(stderr, "Failed to get read %lu signal: %s\n", fp->pod5_row, pod5_get_error_string());
-		pod5_release_run_info(run_info_data);
-		if(sig) free(sig);
+	if (pod5_get_read_complete_signal(fp->pp, fp->batch, i, read_data.num_samples, sig) != POD5_OK) {
+		fprintf(stderr, "Failed to get read %ld signal: %s\n", i, pod5_get_error_string());
 		return;
 	}
 
 	char read_id_tmp[37];
 	pod5_format_read_id(read_data.read_id, read_id_tmp);
+	ri_sig_t* s = fp->pod5_sigs[i] = (ri_sig_t*)calloc(1, sizeof(ri_sig_t));
+	s->name = strdup(read_id_tmp);
 
-	uint32_t l_sig = 0;
-	float pa = 0.0f;
-	for(uint64_t i = 0; i < read_data.num_samples; i++){
-		pa = (sig[i]+read_data.calibration_offset)*read_data.calibration_scale;
-		if (pa > 30 && pa < 200) {
-			sigF[l_sig++] = pa;
-		}
+	s->format = RI_SIG_POD5;
+	s->cal_offset = read_data.calibration_offset; s->cal_scale = read_data.calibration_scale;
+	s->l_raw = read_data.num_samples;
+	ri_sig_keep(s, sig, fp->max_sig);
+	if(s->raw_pos < s->l_raw) s->fn = strdup(fp->fn);
+}
+
+//Loads the batch $fp->cur_read and decodes all of its reads with $fp->n_threads threads
+static int ri_pod5_decode_batch(ri_sig_file_t* fp){
+
+	Pod5ReadRecordBatch_t* batch = NULL;
+	if(pod5_get_read_batch(&batch, fp->pp, fp->cur_read) != POD5_OK){
+		fprintf(stderr, "Failed to get batch: %s\n", pod5_get_error_string());
+		return -1;
 	}
 
-	free(sig);
-	s->sig = (float*)calloc(l_sig, sizeof(float));
-	s->l_sig = l_sig;
-	memcpy(s->sig, sigF, l_sig*sizeof(float));
-	s->name = strdup(read_id_tmp);
-	free(sigF);
-
-	// fprintf(stderr, "%s %lu\n", read_id_tmp, s->l_sig);
-	// for(int i = 0; i < s->l_sig; i++){
-	// 	fprintf(stderr, "%f ", s->sig[i]);
-	// }
-	// fprintf(stderr, "\n");
-
-	pod5_release_run_info(run_info_data);
-
-	fp->pod5_row++;
-	if(fp->pod5_row >= fp->pod5_row_count){
-
-		if (pod5_free_read_batch(fp->batch) != POD5_OK) {
-            fprintf(stderr, "Failed to release batch\n");
-			// pod5_close_and_free_reader(fp->pp);
-			return;
-        }
-
-		fp->cur_read++;
-		if(fp->cur_read < fp->num_read){
-			Pod5ReadRecordBatch_t* batch = NULL;
-			if(pod5_get_read_batch(&batch, fp->pp, fp->cur_read) != POD5_OK){
-				fprintf(stderr, "Failed to get batch: %s\n", pod5_get_error_string());
-				return;
-			}
+	long unsigned int batch_row_count = 0;
+	if(pod5_get_read_batch_row_count(&batch_row_count, batch) != POD5_OK) {
+		fprintf(stderr, "Failed to get batch row count\n");
+		pod5_free_read_batch(batch);
+		return -1;
+	}
 
-			long unsigned int batch_row_count = 0;
-			if(pod5_get_read_batch_row_count(&batch_row_count, batch) != POD5_OK) {
-				fprintf(stderr, "Failed to get batch row count\n");
-				return;
-			}
+	fp->batch = batch;
+	fp->pod5_row_count = batch_row_count;
+	fp->pod5_row = 0;
+	if(!batch_row_count) return 0;
+
+	int n_threads = fp->n_threads > 1?fp->n_threads:1;
+	if(fp->pod5_n_buf < n_threads){
+		fp->pod5_buf = (int16_t**)realloc(fp->pod5_buf, n_threads*sizeof(int16_t*));
+		fp->pod5_m_buf = (uint64_t*)realloc(fp->pod5_m_buf, n_threads*sizeof(uint64_t));
+		for(int i = fp->pod5_n_buf; i < n_threads; ++i){fp->pod5_buf[i] = NULL; fp->pod5_m_buf[i] = 0;}
+		fp->pod5_n_buf = n_threads;
+	}
 
-			fp->pod5_row_count = batch_row_count;
-			fp->pod5_row = 0;
-			
-			fp->batch = batch;
+	fp->pod5_sigs = (ri_sig_t**)realloc(fp->pod5_sigs, batch_row_count*sizeof(ri_sig_t*));
+	kt_for(n_threads, ri_pod5_decode_worker, fp, batch_row_count);
+
+	return 0;
+}
+
+static void ri_pod5_free_batch(ri_sig_file_t* fp){
+	for(; fp->pod5_row < fp->pod5_row_count; ++fp->pod5_row)
+		ri_sig_destroy(fp->pod5_sigs[fp->pod5_row]);
+	if (pod5_free_read_batch(fp->batch) != POD5_OK) fprintf(stderr, "Failed to release batch\n");
+	fp->batch = NULL;
+}
+
+static inline void ri_read_sig_pod5(ri_sig_file_t* fp, ri_sig_t* s){
+
+	ri_sig_t* t = NULL;
+	while(!t){
+		//Decodes the next non-empty batch
+		while(!fp->batch || fp->pod5_row >= fp->pod5_row_count){
+			if(fp->batch){ri_pod5_free_batch(fp); fp->cur_read++;}
+			if(fp->cur_read >= fp->num_read) return;
+			if(ri_pod5_decode_batch(fp) < 0){fp->cur_read = fp->num_read; return;}
 		}
+
+		t = fp->pod5_sigs[fp->pod5_row];
+		fp->pod5_sigs[fp->pod5_row++] = NULL;
+		if(!t) fprintf(stderr, "[WARNING] skipping the read at row %lu of batch %d in '%s' that could not be decoded\n", fp->pod5_row-1, fp->cur_read, fp->fn);
 	}
+	*s = *t;
+	free(t);
+
+	//cur_read reaches num_read right after the last read is returned
+	if(fp->pod5_row >= fp->pod5_row_count){ri_pod5_free_batch(fp); fp->cur_read++;}
 }
 #endif
 
 #ifndef NSLOW5RH
+#define RI_SLOW5_BATCH_SIZE 256 //number of SLOW5 records to decode at once
+
+//Loads and decodes the next batch of SLOW5 records with fp->n_threads threads. Returns the number of records in the batch (0 at EOF)
+static int ri_slow5_next_batch(ri_sig_file_t* fp){
+
+	if(!fp->slow5_mt){
+		fp->slow5_mt = slow5_init_mt(fp->n_threads > 0?fp->n_threads:1, fp->sp);
+		fp->slow5_batch = slow5_init_batch(RI_SLOW5_BATCH_SIZE);
+	}
+
+	int ret = slow5_get_next_batch(fp->slow5_mt, fp->slow5_batch, RI_SLOW5_BATCH_SIZE);
+	if(ret < 0){
+		fprintf(stderr, "ERROR: Failed to read a batch of records from %s\n", fp->fn);
+		ret = 0;
+	}
+
+	fp->slow5_n_rec = ret;
+	fp->slow5_row = 0;
+	return ret;
+}
+
 static inline void ri_read_sig_slow5(ri_sig_file_t* fp, ri_sig_t* s){
 	
 	if(fp->cur_read >= fp->num_read) return;
 
-	slow5_file_t *sp = fp->sp;
-	slow5_rec_t *rec = NULL;
-	int ret = 0;
-	if ((ret = slow5_get_next(&rec, sp)) < 0) {
+	if(fp->slow5_row >= fp->slow5_n_rec && ri_slow5_next_batch(fp) == 0){
 		fp->cur_read = fp->num_read;
 		return;
 	}
 
+	slow5_rec_t *rec = fp->slow5_batch->slow5_rec[fp->slow5_row++];
+
 	s->name = strdup(rec->read_id);
-	float *sigF = (float*)malloc(rec->len_raw_signal * sizeof(float));
-	uint32_t l_sig = 0;
-	float pa = 0.0f;
 	float scale = rec->range/rec->digitisation;
-	
-	for(int i = 0; i < rec->len_raw_signal; ++i){
-		pa = (rec->raw_signal[i]+rec->offset)*scale;
-		if (pa > 30.0f && pa < 200.0f) {
-			sigF[l_sig++] = pa;
-		}
-	}
+	s->format = RI_SIG_SLOW5;
+	s->cal_offset = rec->offset; s->cal_scale = scale;
+	s->raw = 0; s->l_sig = 0;
+	s->l_raw = rec->len_raw_signal;
+	s->raw_pos = 0;
+	ri_sig_keep(s, rec->raw_signal, fp->max_sig);
+	if(s->raw_pos < s->l_raw) s->fn = strdup(fp->fn);
 
 	fp->cur_read++;
 
-	if(ret != SLOW5_ERR_EOF){  //check if proper end of file has been reached
+	//a full batch may be followed by more records. The next batch is loaded only after the current read is copied
+	if(fp->slow5_row >= fp->slow5_n_rec && fp->slow5_n_rec == RI_SLOW5_BATCH_SIZE) ri_slow5_next_batch(fp);
+
+	if(fp->slow5_row < fp->slow5_n_rec){
 		fp->num_read++;
-    }else{
+	}else{
 		fp->cur_read = fp->num_read;
 	}
-
-	s->sig = (float*)calloc(l_sig, sizeof(float));
-	s->l_sig = l_sig;
-	memcpy(s->sig, sigF, l_sig*sizeof(float));
-	free(sigF);
-	slow5_rec_free(rec);
 }
 #endif
 
+static inline void ri_read_sig_pack(ri_sig_file_t* fp, ri_sig_t* s){
+
+	if(fp->cur_read >= fp->num_read) return;
+
+	const char* map = (const char*)fp->pack;
+	const ri_pack_hdr_t* hdr = (const ri_pack_hdr_t*)map;
+	const ri_pack_read_t* r = (const ri_pack_read_t*)(map + hdr->idx_off) + fp->cur_read++;
+	if(r->off + r->len*sizeof(int16_t) > hdr->idx_off || hdr->names_off + r->name_off >= fp->pack_size){
+		fprintf(stderr, "ERROR: read %d is out of the bounds of the signal pack %s\n", fp->cur_read-1, fp->fn);
+		return;
+	}
+
+	s->name = strndup(map + hdr->names_off + r->name_off, fp->pack_size - hdr->names_off - r->name_off);
+	s->format = r->format;
+	s->cal_offset = r->cal_offset; s->cal_scale = r->cal_scale;
+	s->raw = 0; s->l_sig = 0;
+	s->l_raw = r->len;
+	s->raw_pos = 0;
+	ri_sig_append(s, (const int16_t*)(map + r->off), r->len, fp->max_sig);
+	if(s->raw_pos < s->l_raw){
+		s->fn = strdup(fp->fn);
+		s->pack_off = r->off;
+	}
+}
+
 void ri_read_sig(ri_sig_file_t* fp, ri_sig_t* s){
 
 	assert(fp->cur_read < fp->num_read);
@@ -542,4 +964,66 @@ void ri_read_sig(ri_sig_file_t* fp, ri_sig_t* s){
 	#ifndef NSLOW5RH
 	if(fp->sp) ri_read_sig_slow5(fp, s);
 	#endif
+	if(fp->pack) ri_read_sig_pack(fp, s);
+}
+
+#ifndef NHDF5RH
+static void ri_read_sig_more_fast5(ri_sig_t* s, uint32_t max_sig){
+	hid_t fid = H5Fopen(s->fn, H5F_ACC_RDONLY, H5P_DEFAULT);
+	if(fid < 0){
+		fprintf(stderr, "ERROR: failed to reopen file '%s'\n", s->fn);
+		s->l_raw = s->raw_pos;
+		return;
+	}
+	ri_read_sig_fast5_raw(fid, s->loc, s, max_sig);
+	H5Fclose(fid);
+}
+#endif
+
+static void ri_read_sig_more_pack(ri_sig_t* s, uint32_t max_sig){
+	struct stat st;
+	void* map = MAP_FAILED;
+	int fd = open(s->fn, O_RDONLY);
+	if(fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size >= s->pack_off + s->l_raw*sizeof(int16_t))
+		map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(fd >= 0) close(fd);
+	if(map == MAP_FAILED){
+		fprintf(stderr, "ERROR: failed to reopen file '%s'\n", s->fn);
+		s->l_raw = s->raw_pos;
+		return;
+	}
+	const int16_t* raw = (const int16_t*)((const char*)map + s->pack_off);
+	ri_sig_append(s, raw + s->raw_pos, s->l_raw - s->raw_pos, max_sig);
+	munmap(map, st.st_size);
+}
+
+uint32_t ri_read_sig_more(ri_sig_t* s, uint32_t n){
+
+	if(!s->fn) return 0;
+
+	uint32_t l_sig = s->l_sig;
+	uint32_t max_sig = n?l_sig+n:0;
+
+	//the remaining samples of POD5 and SLOW5 reads are already decoded (see ri_sig_keep)
+	if(s->m_raw >= s->l_raw) ri_sig_count(s, s->raw + s->raw_pos, s->l_raw - s->raw_pos, max_sig);
+	else if(s->pack_off) ri_read_sig_more_pack(s, max_sig);
+	#ifndef NHDF5RH
+	else if(s->format == RI_SIG_FAST5) ri_read_sig_more_fast5(s, max_sig);
+	#endif
+
+	if(s->raw_pos >= s->l_raw){
+		free(s->fn); s->fn = NULL;
+		if(s->loc){free(s->loc); s->loc = NULL;}
+	}
+
+	return s->l_sig - l_sig;
+}
+
+void ri_sig_destroy(ri_sig_t* s){
+	if(!s) return;
+	if(s->raw) free(s->raw);
+	if(s->name) free(s->name);
+	if(s->fn) free(s->fn);
+	if(s->loc) free(s->loc);
+	free(s);
 }
\ No newline at end of file
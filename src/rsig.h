@@ -10,6 +10,7 @@
 #endif
 #ifndef NSLOW5RH
 #include <slow5/slow5.h>
+#include <slow5/slow5_mt.h>
 #endif
 
 #ifdef __cplusplus
@@ -17,27 +18,48 @@ extern "C" {
 #endif
 
 typedef struct ri_sig_s{
-	uint32_t rid, l_sig; //read id and length of the signal values
+	uint32_t rid, l_sig; //read id and number of signal values (i.e., raw samples within the expected pA range) in $raw
 	char *name; //name of the read
 
 	uint64_t offset; // offset in ri_idx_t::S
 
-	// float dig, ran, offset; //digitalisation, range, offset
-	float* sig; //signal values of a read
+	int16_t* raw; //raw samples of a read. Converted into signal values (pA) with ri_sig_convert
+	uint64_t l_raw, raw_pos; //number of raw samples of the read in its file and number of raw samples in $raw
+	uint64_t m_raw; //number of raw samples allocated in $raw. POD5 and SLOW5 reads keep all $l_raw decoded samples (see ri_read_sig_more)
+	double cal_offset, cal_scale; //calibration values that convert the raw samples into pA
+	uint8_t format; //RI_SIG_FAST5, RI_SIG_POD5, or RI_SIG_SLOW5
+
+	//Prefix reading (see ri_read_sig_more)
+	char *fn; //signal file of the read if only a prefix of its raw samples is read. NULL if the entire signal is read
+	char *loc; //FAST5: path to the raw signal group of the read in $fn
+	uint64_t pack_off; //Signal pack: byte offset of the raw samples of the read in $fn. 0 if the read is not from a signal pack
 } ri_sig_t;
 
+#define RI_SIG_FAST5 1
+#define RI_SIG_POD5 2
+#define RI_SIG_SLOW5 3
+
 typedef struct { size_t n, m; ri_sig_t **a; } rhsig_v;
 
+//Metadata of a read in a FAST5 file. Read once for all the reads when the file is opened
+typedef struct ri_fast5_read_s{
+	char *name; //read_id of the read. Moved to ri_sig_t::name when the read is read
+	float dig, ran, offset; //calibration values of the channel (digitisation, range, and offset)
+} ri_fast5_read_t;
+
 typedef struct ri_sig_file_s {
 	// gzFile fp;
 	// kseq_t *ks;
 	// ri_sig_t s;
 	int num_read; //Number of reads
 	int cur_read; //Number of processed reads by RawHash (shows the id of the next read to process)
+	char *fn; //path to the signal file
+	uint32_t max_sig; //maximum number of signal values to read per read (0: read the entire signal). See ri_read_sig_more
+	int n_threads; //number of threads to decode a batch of reads (POD5 and SLOW5)
 	
 	//HDF5-related
 	char** raw_path; //List of paths to raw values
-	char** ch_path; //List of paths to channel
+	ri_fast5_read_t* fast5_reads; //Metadata of the reads in raw_path
 	#ifndef NHDF5RH
 	hdf5_tools::File* fp; //FAST5 file pointer
 	#endif
@@ -48,13 +70,25 @@ typedef struct ri_sig_file_s {
 	unsigned long int pod5_row_count;
 	unsigned long int pod5_row;
 	#ifndef NPOD5RH
-	Pod5ReadRecordBatch_t* batch;
+	Pod5ReadRecordBatch_t* batch; //current batch. NULL if not loaded yet
 	Pod5FileReader_t* pp; //POD5 file pointer
 	#endif
+	struct ri_sig_s** pod5_sigs; //decoded reads of the current batch
+	int16_t** pod5_buf; //per-thread buffers to decode the signals
+	uint64_t* pod5_m_buf; //sizes of the buffers in $pod5_buf
+	int pod5_n_buf;
 
 	#ifndef NSLOW5RH
 	slow5_file_t* sp; //SLOW5 file pointer
+	slow5_mt_t* slow5_mt; //multi-threaded SLOW5 decoder. NULL until the first batch is loaded
+	slow5_batch_t* slow5_batch; //current batch of decoded records
 	#endif
+	int slow5_row; //index of the next record to read in the current batch
+	int slow5_n_rec; //number of records in the current batch
+
+	//Signal pack-related (see rpack.h)
+	void* pack; //mapped signal pack. NULL if the file is not a signal pack
+	uint64_t pack_size; //size of the mapping
 } ri_sig_file_t;
 
 /**
@@ -106,16 +140,89 @@ void ri_seq_to_sig(const char *str,
 				   float* s_values);
 
 /**
- * Reads the entire signal values of the next read from a file
+ * Reads the signal values of the next read from a file.
+ * If $fp->max_sig is set, only the first $fp->max_sig signal values are read and the rest can be read with ri_read_sig_more
  *
  * @param fp	file pointer to the signal file (i.e., either FAST5 or SLOW5)
  * @param s		attribute of the read and the signal values.
  * 				$s->name = name of the read
- * 				$s->sig = signal values
+ * 				$s->raw = raw samples (see ri_sig_convert)
  * 				$s->l_sig = number of signal values
+ * 				$s->fn = NULL if the entire signal is read
  */
 void ri_read_sig(ri_sig_file_t* fp, ri_sig_t* s);
 
+/**
+ * Converts the raw samples of a read into pA and keeps the values within the expected range
+ *
+ * @param s			read (see ri_read_sig)
+ * @param raw_pos	position of the first raw sample to convert in $s->raw.
+ * 					Updated to the position of the next raw sample to convert.
+ * @param n			maximum number of signal values to convert
+ * @param out		converted signal values. Should have space for $n values.
+ *
+ * @return			number of signal values written to $out (less than $n only if $s->raw is exhausted)
+ */
+uint32_t ri_sig_convert(const ri_sig_t* s, uint64_t* raw_pos, uint32_t n, float* out);
+
+/**
+ * Range of the integer samples of a read that ri_sig_convert_i16 produces. FAST5 samples are the integer pA values and
+ * the other formats keep their raw samples, which convert into pA with a linear transformation
+ *
+ * @param s		read (see ri_read_sig)
+ * @param lo	smallest sample (output)
+ * @param hi	largest sample (output)
+ *
+ * @return		1 if the samples of the read can be used as integers. 0 otherwise (e.g., a non-positive scale)
+ */
+int ri_sig_range_i16(const ri_sig_t* s, int16_t* lo, int16_t* hi);
+
+/**
+ * The same as ri_sig_convert but keeps the samples as integers rather than converting them into pA (see
+ * ri_sig_range_i16). The same raw samples are kept
+ *
+ * @param out		integer samples. Should have space for $n values.
+ *
+ * @return			number of samples written to $out
+ */
+uint32_t ri_sig_convert_i16(const ri_sig_t* s, uint64_t* raw_pos, uint32_t n, int16_t* out);
+
+/**
+ * Reads more signal values of a read that is partially read by ri_read_sig. FAST5 files and signal packs are reopened.
+ * POD5 and SLOW5 signals are decoded as a whole, so their remaining samples are already in $s->raw and are not decoded again.
+ *
+ * @param s		partially read read. New raw samples are appended to $s->raw and $s->fn is set to NULL once the entire signal is read.
+ * @param n		number of signal values to read (0: read all the remaining values)
+ *
+ * @return		number of signal values appended to $s->raw
+ */
+uint32_t ri_read_sig_more(ri_sig_t* s, uint32_t n);
+
+/**
+ * Deallocates a read and its signal values
+ *
+ * @param s		read to destroy (see ri_read_sig)
+ */
+void ri_sig_destroy(ri_sig_t* s);
+
+/**
+ * Checks if a path is a directory
+ *
+ * @param A		path to check
+ *
+ * @return		1 if $A is a directory; 0 otherwise
+ */
+int is_dir(const char *A);
+
+/**
+ * Checks if a file name has the extension of a signal file (FAST5, POD5, SLOW5/BLOW5, or signal pack)
+ *
+ * @param A		file name to check
+ *
+ * @return		1 if $A is a signal file name; 0 otherwise
+ */
+int is_sfile(const char *A);
+
 /**
  * Recursively find all files that ends with "fast5" under input directory const char *A
  *
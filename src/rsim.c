@@ -0,0 +1,259 @@
+#include "rserve.h"
+#include "rprefetch.h"
+#include "rutils.h"
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rh_kvec.h"
+
+typedef rh_kvec_t(uint64_t) ri_u64_v;
+
+typedef struct ri_sim_ch_s{
+	ri_sig_t *s; //read that is sequenced on the channel. NULL if the channel is idle
+	uint32_t number; //read number on the channel
+	uint64_t raw_pos; //position of the next raw sample to send
+	uint32_t n_sent; //number of signal values sent
+	int decision; //decision of the daemon for the read
+	double next_t; //time to send the next chunk
+	double start_t; //time the first chunk of the read is sent
+	rh_kvec_t(double) sent_t; //send times of the chunks that are not replied yet (a queue that starts at $head)
+	size_t head;
+} ri_sim_ch_t;
+
+typedef struct ri_sim_s{
+	int fd;
+	int n_channels;
+	ri_sim_ch_t *ch;
+	ri_u64_v lat; //latency of the replies in microseconds
+	ri_u64_v dec_t; //time from the first chunk to the decision in microseconds
+	uint64_t n_pending; //chunks that are not replied yet
+	uint64_t n_kept, n_unblocked;
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+} ri_sim_t;
+
+static int sim_write(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char*)buf;
+	while (len > 0) {
+		ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		p += r, len -= r;
+	}
+	return 0;
+}
+
+static void *sim_receiver(void *data)
+{
+	ri_sim_t *sim = (ri_sim_t*)data;
+	ri_srv_decision_t d;
+	char *p;
+	size_t l;
+
+	for (;;) {
+		for (p = (char*)&d, l = sizeof(ri_srv_decision_t); l > 0;) {
+			ssize_t r = read(sim->fd, p, l);
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) break;
+			p += r, l -= r;
+		}
+		if (l > 0) break;
+
+		double t = ri_realtime();
+		pthread_mutex_lock(&sim->mutex);
+		if (d.channel < (uint32_t)sim->n_channels) {
+			ri_sim_ch_t *ch = &sim->ch[d.channel];
+			if (ch->head < ch->sent_t.n) {
+				rh_kv_push(uint64_t, 0, sim->lat, (uint64_t)((t - ch->sent_t.a[ch->head++]) * 1e6));
+				if (ch->head == ch->sent_t.n) ch->head = ch->sent_t.n = 0;
+				--sim->n_pending;
+			}
+			if (d.number == ch->number && !ch->decision && d.decision != RI_SRV_CONTINUE) {
+				ch->decision = d.decision;
+				rh_kv_push(uint64_t, 0, sim->dec_t, (uint64_t)((t - ch->start_t) * 1e6));
+				if (d.decision == RI_SRV_UNBLOCK) ++sim->n_unblocked;
+				else ++sim->n_kept;
+			}
+		}
+		pthread_cond_broadcast(&sim->cv);
+		pthread_mutex_unlock(&sim->mutex);
+	}
+	return 0;
+}
+
+static void sim_report(const char *name, ri_u64_v *v)
+{
+	if (!v->n) return;
+	radix_sort_64(v->a, v->a + v->n);
+	fprintf(stderr, "[M::ri_simulate] %s (ms): p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", name,
+			v->a[(size_t)(v->n * 0.5)] / 1e3, v->a[(size_t)(v->n * 0.9)] / 1e3, v->a[(size_t)(v->n * 0.99)] / 1e3,
+			v->a[(size_t)(v->n * 0.999)] / 1e3, v->a[v->n - 1] / 1e3);
+}
+
+int ri_simulate(const char *path, int n_fn, const char **fn, int n_channels, uint32_t sample_rate, float chunk_sec, int64_t max_reads, int n_threads)
+{
+	ri_sim_t sim;
+	ri_prefetch_t *pf;
+	struct sockaddr_un addr;
+	pthread_t tid;
+	uint32_t l_chunk = (uint32_t)(sample_rate * chunk_sec + .499);
+	int64_t n_reads = 0;
+	uint64_t n_chunks = 0;
+	double max_lag = 0;
+	int i, n_active;
+
+	if (l_chunk == 0 || n_channels <= 0) {
+		fprintf(stderr, "[ERROR] the number of channels and the chunk size must be positive\n");
+		return -1;
+	}
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "[ERROR] socket path '%s' is too long\n", path);
+		return -1;
+	}
+	memset(&sim, 0, sizeof(ri_sim_t));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((sim.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(sim.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "[ERROR] failed to connect to '%s': %s\n", path, strerror(errno));
+		if (sim.fd >= 0) close(sim.fd);
+		return -1;
+	}
+
+	pf = ri_prefetch_init(n_fn, fn, n_threads, n_threads*2, (int64_t)1<<30, 0, n_threads);
+	if (!pf) {
+		fprintf(stderr, "[ERROR] no signal file found in '%s'\n", fn[0]);
+		close(sim.fd);
+		return -1;
+	}
+
+	sim.n_channels = n_channels;
+	sim.ch = (ri_sim_ch_t*)calloc(n_channels, sizeof(ri_sim_ch_t));
+	pthread_mutex_init(&sim.mutex, 0);
+	pthread_cond_init(&sim.cv, 0);
+	pthread_create(&tid, 0, sim_receiver, &sim);
+
+	//the channels start at different times within a chunk so that the chunks are sent evenly
+	double t0 = ri_realtime();
+	for (i = 0; i < n_channels; ++i) sim.ch[i].next_t = t0 + chunk_sec * i / n_channels;
+
+	rh_kvec_t(char) buf = {0,0,0};
+	float *sig = (float*)malloc(l_chunk * sizeof(float));
+	do {
+		double t = ri_realtime(), next_t = 0;
+		n_active = 0;
+		for (i = 0; i < n_channels; ++i) {
+			ri_sim_ch_t *ch = &sim.ch[i];
+			if (ch->next_t < 0) continue; //no reads are left for the channel
+			++n_active;
+			if (ch->next_t > t) {
+				if (!next_t || ch->next_t < next_t) next_t = ch->next_t;
+				continue;
+			}
+			if (t - ch->next_t > max_lag) max_lag = t - ch->next_t;
+
+			ri_srv_chunk_t hdr;
+			memset(&hdr, 0, sizeof(ri_srv_chunk_t));
+			hdr.channel = i;
+
+			pthread_mutex_lock(&sim.mutex);
+			int decision = ch->decision;
+			pthread_mutex_unlock(&sim.mutex);
+
+			//the read ends when the daemon decides or the whole read is sent
+			if (ch->s && (decision || ch->n_sent >= ch->s->l_sig)) {
+				if (!decision) {
+					hdr.type = RI_SRV_END;
+					hdr.number = ch->number;
+					if (sim_write(sim.fd, &hdr, sizeof(ri_srv_chunk_t)) != 0) break;
+				}
+				ri_sig_destroy(ch->s); ch->s = 0;
+			}
+			if (!ch->s) {
+				if ((max_reads && n_reads >= max_reads) || (ch->s = ri_prefetch_read(pf)) == 0) {
+					ch->next_t = -1.0;
+					continue;
+				}
+				++n_reads;
+				pthread_mutex_lock(&sim.mutex);
+				ch->number++;
+				ch->raw_pos = 0, ch->n_sent = 0, ch->decision = 0;
+				ch->start_t = t;
+				pthread_mutex_unlock(&sim.mutex);
+			}
+
+			uint32_t n = ch->s->l_sig - ch->n_sent < l_chunk? ch->s->l_sig - ch->n_sent : l_chunk;
+			n = ri_sig_convert(ch->s, &ch->raw_pos, n, sig);
+			ch->n_sent += n;
+
+			hdr.type = RI_SRV_CHUNK;
+			hdr.number = ch->number;
+			hdr.n_sig = n;
+			hdr.l_id = ch->n_sent == n && ch->s->name? strlen(ch->s->name) : 0;
+			buf.n = 0;
+			rh_kv_resize(char, 0, buf, sizeof(ri_srv_chunk_t) + hdr.l_id + n * sizeof(float));
+			memcpy(buf.a, &hdr, sizeof(ri_srv_chunk_t));
+			if (hdr.l_id) memcpy(buf.a + sizeof(ri_srv_chunk_t), ch->s->name, hdr.l_id);
+			memcpy(buf.a + sizeof(ri_srv_chunk_t) + hdr.l_id, sig, n * sizeof(float));
+
+			pthread_mutex_lock(&sim.mutex);
+			rh_kv_push(double, 0, ch->sent_t, ri_realtime());
+			++sim.n_pending;
+			pthread_mutex_unlock(&sim.mutex);
+			if (sim_write(sim.fd, buf.a, sizeof(ri_srv_chunk_t) + hdr.l_id + n * sizeof(float)) != 0) break;
+			++n_chunks;
+
+			ch->next_t += chunk_sec;
+			if (!next_t || ch->next_t < next_t) next_t = ch->next_t;
+		}
+		if (i < n_channels) {
+			fprintf(stderr, "[ERROR] the connection to the daemon is lost\n");
+			break;
+		}
+		t = ri_realtime();
+		if (n_active && next_t > t) usleep((useconds_t)((next_t - t) * 1e6));
+	} while (n_active);
+
+	//waits for the replies of the chunks that are sent
+	pthread_mutex_lock(&sim.mutex);
+	while (sim.n_pending) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 5;
+		if (pthread_cond_timedwait(&sim.cv, &sim.mutex, &ts) == ETIMEDOUT) break;
+	}
+	pthread_mutex_unlock(&sim.mutex);
+	shutdown(sim.fd, SHUT_RDWR);
+	pthread_join(tid, 0);
+	close(sim.fd);
+
+	double elapsed = ri_realtime() - t0;
+	fprintf(stderr, "[M::%s] replayed %ld reads on %d channels in %.2f sec: %lu chunks of %u signal values, %lu kept, %lu unblocked, %ld undecided\n",
+			__func__, (long)n_reads, n_channels, elapsed, (unsigned long)n_chunks, l_chunk, (unsigned long)sim.n_kept,
+			(unsigned long)sim.n_unblocked, (long)(n_reads - sim.n_kept - sim.n_unblocked));
+	fprintf(stderr, "[M::%s] %.1f chunks/sec; the client fell behind the flow cell by at most %.2f ms\n", __func__, n_chunks / elapsed, max_lag * 1e3);
+	sim_report("reply latency", &sim.lat);
+	sim_report("time to decision", &sim.dec_t);
+	if (sim.n_pending) fprintf(stderr, "[WARNING] %lu chunks are not replied\n", (unsigned long)sim.n_pending);
+
+	for (i = 0; i < n_channels; ++i) {
+		if (sim.ch[i].s) ri_sig_destroy(sim.ch[i].s);
+		rh_kv_destroy(sim.ch[i].sent_t);
+	}
+	free(sim.ch);
+	free(sig);
+	rh_kv_destroy(buf);
+	rh_kv_destroy(sim.lat);
+	rh_kv_destroy(sim.dec_t);
+	ri_prefetch_destroy(pf);
+	pthread_mutex_destroy(&sim.mutex);
+	pthread_cond_destroy(&sim.cv);
+	return 0;
+}
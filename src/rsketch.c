@@ -4,190 +4,429 @@
 #include <math.h>
 #include <float.h>
 
-static inline uint64_t hash64(uint64_t key, uint64_t mask){
-    key = (~key + (key << 21)) & mask; // key = (key << 21) - key - 1;
-    key = key ^ key >> 24;
-    key = ((key + (key << 3)) + (key << 8)) & mask; // key * 265
-    key = key ^ key >> 14;
-    key = ((key + (key << 2)) + (key << 4)) & mask; // key * 21
-    key = key ^ key >> 28;
-    key = (key + (key << 31)) & mask;
-    return key;
+#define RI_SKETCH_BLOCK 1024 //number of events that are quantized and hashed together
+#define RI_SKETCH_HIST 64 //events of the previous block kept for the windows that span two blocks (at least $e-1)
+#define RI_BLEND_TILE 64 //number of seeds whose SimHash bits are counted together (see blend_block)
+#define RI_BLEND_PLANES 7 //bits of the SimHash counters; enough for RI_SKETCH_HIST hashes
+
+//Thomas Wang's 64-bit integer hash (hash64 in minimap2) with a 32-bit mask. The mask keeps every intermediate value within 32 bits, so the hash depends
+//only on the lower 32 bits of the key and is computed with 32-bit arithmetic (e.g., 16 keys in an AVX-512 register)
+static inline uint32_t hash32(uint32_t key){
+	key = ~key + (key << 21); // key = (key << 21) - key - 1;
+	key = key ^ key >> 24;
+	key = (key + (key << 3)) + (key << 8); // key * 265
+	key = key ^ key >> 14;
+	key = (key + (key << 2)) + (key << 4); // key * 21
+	key = key ^ key >> 28;
+	key = key + (key << 31);
+	return key;
 }
 
-uint32_t dynamic_quantize(float signal,
-						  float fine_min,
-						  float fine_max,
-						  float fine_range,
-						  uint32_t n_buckets)
+//Constants of the dynamic quantization (see quantize_block), computed once per sketch
+typedef struct ri_quant_s {
+	float fine_min, fine_max, fine_range;
+	float coarse_coef1, coarse_coef2;
+	float a, b_a; //[$fine_min, $fine_max] normalized to [a, a+b_a]
+	float n_buckets1; //largest quantized value
+} ri_quant_t;
+
+static inline void quant_init(ri_quant_t *qc, float fine_min, float fine_max, float fine_range, uint32_t n_buckets)
 {
-    // Total range for normalization
-    float minVal = -3.0, maxVal = 3.0;
-    float range = maxVal - minVal;
-	float coarse_coef1 = (1-fine_range)/2;
-	float coarse_coef2 = fine_range + coarse_coef1;
-
-    // Normalize the signal to [0, 1]
-    float normalized = (signal - minVal) / range;
-
-	float a = (fine_min - minVal) / range;
-	float b = (fine_max - minVal) / range;
-
-    // Conditional quantization based on the segment
-    float quantized = fine_max;
-    if (signal >= fine_min && signal <= fine_max) {
-        // Within [fine_min, fine_max], map to a sub-range [a, b] in [0, 1],
-		//then scale to [0, fine_range] for finer granularity
-        quantized = fine_range * ((normalized - a) / (b - a));
-    }
-	else {
-        // Outside [fine_min, fine_max], split the rest of [0, 1] into two and map accordingly
-        if (normalized < 0.5) quantized = fine_range + coarse_coef1 * normalized; // Coarser granularity
-        else quantized = coarse_coef2 + coarse_coef1 * normalized; // Coarser granularity
-    }
-
-    // Map the quantized value back to the range [0, 2^n_buckets - 1]
-    uint32_t quantizedValue = (uint32_t)(quantized * (n_buckets-1));
-
-    return quantizedValue;
+	// Total range for normalization
+	const float minVal = -3.0, maxVal = 3.0;
+	const float range = maxVal - minVal;
+	qc->fine_min = fine_min, qc->fine_max = fine_max, qc->fine_range = fine_range;
+	qc->coarse_coef1 = (1-fine_range)/2;
+	qc->coarse_coef2 = fine_range + qc->coarse_coef1;
+	qc->a = (fine_min - minVal) / range;
+	qc->b_a = (fine_max - minVal) / range - qc->a;
+	qc->n_buckets1 = (float)(n_buckets-1);
 }
 
-void ri_sketch_min(void *km,
-				   const float* s_values,
-				   uint32_t id,
-				   int strand,
-				   uint32_t len,
-				   float diff,
-				   int w,
-				   int e,
-				   uint32_t quant_bit,
-				   int k,
-				   float fine_min,
-				   float fine_max,
-				   float fine_range,
-				   mm128_v *p)
+//The quantization is vectorized without changing its results: the product of the coarse region is rounded before it
+//is added, as the scalar quantization computes it, rather than contracted into a fused multiply-add. Floating-point
+//exceptions are ignored so that the selects of the loop are not turned into branches
+#if defined(__GNUC__) && !defined(__clang__)
+#define RI_QUANT_EXACT __attribute__((optimize("fp-contract=off", "no-trapping-math")))
+#else
+#define RI_QUANT_EXACT
+#endif
+
+//Converts a quantized value into its bucket as the scalar conversion of the target does. The quantized values of the
+//signal values far below the fine region are negative, and a plain (uint32_t) cast of them is left to the compiler,
+//which converts them differently once the loop is vectorized
+RI_QUANT_EXACT static inline uint32_t quant_bucket(const float x)
 {
-	assert(len > 0 && (w > 0 && w < 256) && e*quant_bit <= (64-RI_HASH_SHIFT));
-	
-	int j, buf_pos, min_pos;
-	mm128_t buf[256], min = { UINT64_MAX, UINT64_MAX };
-
-	uint32_t span = k+e-1;
-	
-	const uint64_t id_shift = (uint64_t)id<<RI_ID_SHIFT, mask = (1ULL<<32)-1, mask_events = (1ULL<<(quant_bit*e))-1, mask_quant_bit = (1ULL<<quant_bit)-1;
-
-	uint32_t n_buckets = 1UL<<quant_bit;
-
-	memset(buf, 0xff, w * 16);
-	rh_kv_resize(mm128_t, km, *p, p->n + len/w);
+	//The value is selected before it is converted so that the conversion is defined and the loop has no branches
+#ifdef __AVX512F__
+	//vcvttss2usi: UINT32_MAX if the value is out of range or NaN
+	const int in = (x > -1.0f) & (x < 4294967296.0f);
+	const float y = in? x : 0.0f, h = (y >= 2147483648.0f)? 2147483648.0f : 0.0f;
+	const uint32_t v = (uint32_t)(int32_t)(y - h) + ((h != 0.0f)? 0x80000000U : 0);
+	return in? v : UINT32_MAX;
+#else
+	//cvttss2si with a 64-bit result: the lower 32 bits of the truncated value, which are 0 if the value is infinite or
+	//NaN. Finite quantized values are far from 2^31 in magnitude
+	const float y = ((x > -2147483648.0f) & (x < 2147483648.0f))? x : 0.0f;
+	return (uint32_t)(int32_t)y;
+#endif
+}
 
-	int sigBufFull = 0;
-	uint32_t f_pos, l, sigBufPos = 0;
-	uint32_t l_sigpos = 0; //last signal position
-	uint32_t f_tmpQuantSignal = 0;
-	uint64_t quantVal = 0;
+/**
+ * Quantizes the signal values into [0, 2^quant_bit-1]. The values within [fine_min, fine_max] are quantized with a
+ * finer granularity than the rest. Both regions are computed for all the values and selected without branches so that
+ * the loop is vectorized
+ */
+RI_QUANT_EXACT static void quantize_block(const ri_quant_t *qc, const float* __restrict sig, uint32_t n, uint32_t mask_quant_bit, uint32_t* __restrict out)
+{
+	const float minVal = -3.0, range = 6.0;
+	const float fine_min = qc->fine_min, fine_max = qc->fine_max, fine_range = qc->fine_range;
+	const float c1 = qc->coarse_coef1, c2 = qc->coarse_coef2, a = qc->a, b_a = qc->b_a, n_buckets1 = qc->n_buckets1;
+	for (uint32_t i = 0; i < n; ++i) {
+		// Normalize the signal to [0, 1]
+		const float normalized = (sig[i] - minVal) / range;
+		// Within [fine_min, fine_max], map to a sub-range [a, b] in [0, 1], then scale to [0, fine_range]
+		const float fine = fine_range * ((normalized - a) / b_a);
+		// Outside [fine_min, fine_max], split the rest of [0, 1] into two and map accordingly
+		const float coarse_step = c1 * normalized;
+		const float coarse = ((normalized < 0.5f)? fine_range : c2) + coarse_step;
+		const float quantized = ((sig[i] >= fine_min) & (sig[i] <= fine_max))? fine : coarse;
+		// Map the quantized value back to the range [0, 2^n_buckets - 1]
+		out[i] = quant_bucket(quantized * n_buckets1) & mask_quant_bit;
+	}
+}
 
-	mm128_t sigBuf[e];
-	memset(sigBuf, 0, e*sizeof(mm128_t));
+//Sketching state of a signal that is quantized and hashed block by block (see sketch_block)
+typedef struct ri_sketch_iter_s {
+	const float* sig;
+	uint32_t len, f_pos; //length of $sig and the next position to sketch
+	float diff, last; //consecutive values closer than $diff are skipped. $last is the last value that is not skipped
+	uint32_t l; //number of values that are not skipped so far (i.e., events)
+	int e;
+	uint32_t quant_bit, mask_quant_bit, mask_events; //$mask_events is the mask of the packed events, cut to 32 bits (see hash32)
+	ri_quant_t qc;
+	uint64_t id_shift, span;
+	int strand;
+	uint32_t s, mask_smer; //syncmers if $s>0: length of the s-mers and the mask of their packed events (see sketch_iter_sync)
+	int t;
+	uint32_t n; //BLEND if $n>1: number of the hashes of consecutive windows combined into a seed (see sketch_iter_blend)
+
+	float val[RI_SKETCH_BLOCK];
+	uint32_t hash[RI_SKETCH_HIST + RI_SKETCH_BLOCK], blend[RI_SKETCH_BLOCK];
+	uint32_t quant[RI_SKETCH_HIST + RI_SKETCH_BLOCK], pos[RI_SKETCH_HIST + RI_SKETCH_BLOCK]; //events of the block after those of the previous block
+	uint32_t smer[RI_SKETCH_HIST + RI_SKETCH_BLOCK]; //hash of the s-mer that ends at each event
+} ri_sketch_iter_t;
+
+static void sketch_iter_init(ri_sketch_iter_t *it, const float* s_values, uint32_t id, int strand, uint32_t len, float diff, int e, uint32_t quant_bit, int k, float fine_min, float fine_max, float fine_range)
+{
+	assert(e > 0 && e <= RI_SKETCH_HIST);
+	it->sig = s_values, it->len = len, it->f_pos = 0;
+	it->diff = diff, it->last = 0, it->l = 0;
+	it->e = e, it->quant_bit = quant_bit;
+	it->mask_quant_bit = (uint32_t)((1ULL<<quant_bit)-1);
+	it->mask_events = (uint32_t)((1ULL<<(quant_bit*e))-1);
+	quant_init(&it->qc, fine_min, fine_max, fine_range, 1UL<<quant_bit);
+	it->id_shift = (uint64_t)id<<RI_ID_SHIFT, it->span = (uint64_t)(k+e-1), it->strand = strand;
+	memset(it->quant, 0, RI_SKETCH_HIST*sizeof(uint32_t));
+	it->s = 0, it->n = 0;
+}
 
-    for (f_pos = l = buf_pos = min_pos = 0; f_pos < len; ++f_pos) {
-        if(f_pos > 0 && fabs(s_values[f_pos] - s_values[l_sigpos]) < diff) continue;
+//Keeps only the windows of $e events that are syncmers: the smallest of the hashes of the $s-event windows (s-mers)
+//within the window is the first or the last s-mer (closed syncmers, t<0) or the s-mer at offset $t (open syncmers)
+static void sketch_iter_sync(ri_sketch_iter_t *it, int s, int t)
+{
+	assert(s > 0 && s <= it->e && t < it->e - s + 1);
+	it->s = s, it->t = t;
+	it->mask_smer = (uint32_t)((1ULL<<(it->quant_bit*s))-1);
+	memset(it->smer, 0, RI_SKETCH_HIST*sizeof(uint32_t));
+}
 
-		l++;
-		mm128_t info = { UINT64_MAX, UINT64_MAX };
-		l_sigpos = f_pos;
+//Combines the hashes of each $n consecutive windows of $e events into a seed with SimHash, as BLEND does: a bit of the
+//seed is set if it is set in more than half of the $n hashes. The seed spans the events of the $n windows
+static void sketch_iter_blend(ri_sketch_iter_t *it, int n)
+{
+	assert(n > 1 && it->e + n - 1 <= RI_SKETCH_HIST);
+	it->n = n;
+	it->span += n - 1;
+	if (it->span >= 1ULL<<RI_HASH_SHIFT) it->span = (1ULL<<RI_HASH_SHIFT) - 1;
+	memset(it->hash, 0, RI_SKETCH_HIST*sizeof(uint32_t));
+}
 
-		f_tmpQuantSignal = dynamic_quantize(s_values[f_pos], fine_min, fine_max, fine_range, n_buckets)&mask_quant_bit;
+/**
+ * SimHash of the $n hashes that end at each position. The bits of the $n hashes are counted for all 32 bits at once
+ * with the counters stored as bit planes: the j-th plane holds the j-th bit of the counter of each bit, and a hash is
+ * added with a carry-save adder. The counts are then compared with n/2 plane by plane. The seeds are processed
+ * RI_BLEND_TILE at a time with the same operations on each, so the loops are vectorized
+ *
+ * @param hash		hashes. The $n-1 hashes before $hash[0] are the last ones of the previous block
+ * @param n_hash	number of the SimHash values to compute
+ * @param n			number of hashes in a SimHash value
+ * @param out		SimHash values
+ */
+static void blend_block(const uint32_t* __restrict hash, uint32_t n_hash, uint32_t n, uint32_t* __restrict out)
+{
+	const uint32_t n_planes = 32 - __builtin_clz(n), thr = n / 2;
+	uint32_t cnt[RI_BLEND_PLANES][RI_BLEND_TILE], carry[RI_BLEND_TILE], gt[RI_BLEND_TILE], eq[RI_BLEND_TILE];
+	for (uint32_t i0 = 0; i0 < n_hash; i0 += RI_BLEND_TILE) {
+		const uint32_t m = (n_hash - i0 < RI_BLEND_TILE)? n_hash - i0 : RI_BLEND_TILE;
+		memset(cnt, 0, sizeof(cnt));
+		for (uint32_t j = 0; j < n; ++j) {
+			const uint32_t* __restrict h = hash + i0 - j;
+			for (uint32_t i = 0; i < m; ++i) carry[i] = h[i];
+			for (uint32_t b = 0; b < n_planes; ++b) {
+				uint32_t* __restrict c = cnt[b];
+				for (uint32_t i = 0; i < m; ++i) {
+					const uint32_t t = c[i] & carry[i];
+					c[i] ^= carry[i], carry[i] = t;
+				}
+			}
+		}
+		//count > thr: the first plane from the most significant one where the count and thr differ decides
+		for (uint32_t i = 0; i < m; ++i) gt[i] = 0, eq[i] = UINT32_MAX;
+		for (uint32_t b = n_planes; b-- > 0;) {
+			const uint32_t* __restrict c = cnt[b];
+			if (thr>>b & 1) for (uint32_t i = 0; i < m; ++i) eq[i] &= c[i];
+			else for (uint32_t i = 0; i < m; ++i) gt[i] |= eq[i] & c[i], eq[i] &= ~c[i];
+		}
+		for (uint32_t i = 0; i < m; ++i) out[i0 + i] = gt[i];
+	}
+}
 
-		quantVal = (quantVal<<quant_bit|f_tmpQuantSignal)&mask_events;
+/**
+ * Sketches the next block of events in two passes. The first pass finds the events (skipping the values within $diff
+ * of the previous event) and quantizes them. The second pass packs the quantized values of each $e consecutive events
+ * and hashes the packed values. The windows are packed with shifts of whole blocks rather than an event at a time, so
+ * both passes are vectorized
+ *
+ * @param it	sketching state
+ * @param out	seeds of the windows that end in the block (see ri_sketch). Should have space for RI_SKETCH_BLOCK seeds
+ *
+ * @return		number of seeds written to $out. They are of the last events so far, i.e., $it->l-1 is the last one
+ */
+template<int E, int Q>
+static uint32_t sketch_block(ri_sketch_iter_t *it, mm128_t *out)
+{
+	const uint32_t H = RI_SKETCH_HIST, e = E? (uint32_t)E : (uint32_t)it->e, q = Q? (uint32_t)Q : it->quant_bit;
+	const uint32_t mask_quant_bit = Q? (uint32_t)((1ULL<<Q)-1) : it->mask_quant_bit;
+	const uint32_t mask_events = (E && Q)? (uint32_t)((1ULL<<(Q*E))-1) : it->mask_events;
+	uint32_t* __restrict quant = it->quant + H;
+	uint32_t* __restrict pos = it->pos + H;
+	uint32_t* __restrict hash = it->hash + H;
+	uint32_t n = 0, f_pos = it->f_pos;
+	float last = it->last;
+
+	for (; f_pos < it->len && n < RI_SKETCH_BLOCK; ++f_pos) {
+		const float v = it->sig[f_pos];
+		if(f_pos > 0 && fabs(v - last) < it->diff) continue;
+		last = v;
+		it->val[n] = v, pos[n++] = f_pos;
+	}
+	it->f_pos = f_pos, it->last = last;
+	if (n == 0) return 0;
+
+	quantize_block(&it->qc, it->val, n, mask_quant_bit, quant);
+
+	//The event $j events before the end of a window is shifted by $j*$q bits. Only the lower 32 bits are hashed
+	if (E && Q) { //the shifts are unrolled and a window is packed and hashed at once
+		for (uint32_t i = 0; i < n; ++i) {
+			uint32_t h = quant[i];
+			for (uint32_t j = 1; j < e && j*q < 32; ++j) h |= (quant - j)[i] << (j*q);
+			hash[i] = hash32(h & mask_events);
+		}
+	} else {
+		for (uint32_t i = 0; i < n; ++i) hash[i] = quant[i];
+		for (uint32_t j = 1; j < e && j*q < 32; ++j) {
+			const uint32_t* __restrict prev = quant - j;
+			for (uint32_t i = 0; i < n; ++i) hash[i] |= prev[i] << (j*q);
+		}
+		for (uint32_t i = 0; i < n; ++i) hash[i] = hash32(hash[i] & mask_events);
+	}
+
+	//A seed of $n windows (BLEND) ends with the last window and its hashes come from the windows that end at the last
+	//$n events
+	const uint32_t ne = e + (it->n > 1? it->n - 1 : 0); //events of a seed
+	const uint32_t* seed = hash;
+	if (it->n > 1) {
+		blend_block(hash, n, it->n, it->blend);
+		memmove(it->hash, it->hash + n, H*sizeof(uint32_t));
+		seed = it->blend;
+	}
+
+	//A seed of $ne events starts at the event $ne-1 before its end. The seeds that end before the $ne-th event are not full
+	const uint32_t i0 = (it->l >= ne-1)? 0 : ne-1-it->l;
+	const uint64_t strand = (uint64_t)it->strand;
+	const uint32_t* start = pos - (ne-1); //first event of the seed that ends at each event
+	uint32_t n_out = 0;
+	if (it->s == 0) {
+		for (uint32_t i = i0; i < n; ++i, ++n_out) {
+			out[n_out].x = (uint64_t)seed[i]<<RI_HASH_SHIFT | it->span;
+			out[n_out].y = it->id_shift | start[i]<<RI_POS_SHIFT | strand;
+		}
+	} else {
+		//The s-mers of the window that ends at an event end at the last $d+1 events. The s-mers are hashed and their
+		//smallest hash in each window is found with shifts of whole blocks as the windows are packed above
+		const uint32_t s = it->s, d = e - s;
+		uint32_t* __restrict smer = it->smer + H;
+		uint32_t* __restrict smin = hash + 0; //the hashes of the windows are kept in $out
+		for (uint32_t i = i0; i < n; ++i) out[i-i0].x = (uint64_t)seed[i]<<RI_HASH_SHIFT | it->span;
+		for (uint32_t i = 0; i < n; ++i) smer[i] = quant[i];
+		for (uint32_t j = 1; j < s && j*q < 32; ++j) {
+			const uint32_t* __restrict prev = quant - j;
+			for (uint32_t i = 0; i < n; ++i) smer[i] |= prev[i] << (j*q);
+		}
+		for (uint32_t i = 0; i < n; ++i) smin[i] = smer[i] = hash32(smer[i] & it->mask_smer);
+		for (uint32_t j = 1; j <= d; ++j) {
+			const uint32_t* __restrict prev = smer - j;
+			for (uint32_t i = 0; i < n; ++i) smin[i] = (prev[i] < smin[i])? prev[i] : smin[i];
+		}
+		//The seeds are compacted without branches: a seed is always written and kept only if its window is a syncmer
+		const uint32_t* first = smer - d, *at = smer - d + (it->t < 0? 0 : it->t);
+		for (uint32_t i = i0; i < n; ++i) {
+			const int keep = (it->t < 0)? ((first[i] == smin[i]) | (smer[i] == smin[i])) : (at[i] == smin[i]);
+			out[n_out].x = out[i-i0].x;
+			out[n_out].y = it->id_shift | start[i]<<RI_POS_SHIFT | strand;
+			n_out += keep;
+		}
+		memmove(it->smer, it->smer + n, H*sizeof(uint32_t));
+	}
+	it->l += n;
 
-		sigBuf[sigBufPos].y = id_shift | (uint32_t)f_pos<<RI_POS_SHIFT | strand;
-		if(++sigBufPos == e) {sigBufFull = 1; sigBufPos = 0;}
-		sigBuf[sigBufPos].x = hash64(quantVal, mask)<<RI_HASH_SHIFT | span;
+	memmove(it->quant, it->quant + n, H*sizeof(uint32_t));
+	memmove(it->pos, it->pos + n, H*sizeof(uint32_t));
+	return n_out;
+}
 
-		if(!sigBufFull) continue;
+//The non-zero template parameters replace $w, $e, and $quant_bit with constants (see ri_sketch)
+template<int W, int E, int Q>
+static void ri_sketch_min(void *km,
+						  const float* s_values,
+						  uint32_t id,
+						  int strand,
+						  uint32_t len,
+						  float diff,
+						  int w,
+						  int e,
+						  int n,
+						  uint32_t quant_bit,
+						  int k,
+						  float fine_min,
+						  float fine_max,
+						  float fine_range,
+						  mm128_v *p)
+{
+	if (W) w = W;
+	if (E) e = E;
+	if (Q) quant_bit = Q;
+	assert(len > 0 && (w > 0 && w < 256) && e*quant_bit <= (64-RI_HASH_SHIFT));
+	
+	//The e-mer at index i is in buf[i % w]. A window ends in a block of $w e-mers that starts at buf[0] and starts in the
+	//previous block, so its minimum is the minimum of a suffix of the previous block and a prefix of the current block
+	//(van Herk/Gil-Werman). Both are computed only when the minimum drops out of the window and are extended from where
+	//the last rescan of the block stopped, so the cost per e-mer does not depend on $w. Each minimum is kept both as the
+	//closest and the farthest of the e-mers with the smallest hash so that identical k-mers are searched only if any
+	int j, buf_pos, min_pos, pre_c = 0, pre_f = 0, pre_pos, suf_pos;
+	uint64_t pre_x = UINT64_MAX, suf_x[256]; //smallest hash in buf[0..pre_pos-1] of the current block and in buf[j..w-1] of the previous block
+	uint8_t suf_c[256], suf_f[256]; //closest/farthest position of the smallest hash in buf[j..w-1] of the previous block
+	mm128_t buf[256], min = { UINT64_MAX, UINT64_MAX };
 
-		info.x = sigBuf[sigBufPos].x;
-		info.y = sigBuf[sigBufPos].y;
+	memset(buf, 0xff, w * 16);
+	rh_kv_resize(mm128_t, km, *p, p->n + len/w);
 
-		buf[buf_pos] = info; // need to do this here as appropriate buf_pos and buf[buf_pos] are needed below
-		if (l == w + e - 1 && min.x != UINT64_MAX) { // special case for the first window - because identical k-mers are not stored yet
-			for (j = buf_pos + 1; j < w; ++j)
-				if (min.x == buf[j].x && buf[j].y != min.y) rh_kv_push(mm128_t, km, *p, buf[j]);
-			for (j = 0; j < buf_pos; ++j)
-				if (min.x == buf[j].x && buf[j].y != min.y) rh_kv_push(mm128_t, km, *p, buf[j]);
-		}
-		if (info.x <= min.x) { // a new minimum; then write the old min
-			if (l >= w + e && min.x != UINT64_MAX) rh_kv_push(mm128_t, km, *p, min);
-			min = info, min_pos = buf_pos;
-		} else if (buf_pos == min_pos) { // old min has moved outside the window
-			if (l >= w + e - 1 && min.x != UINT64_MAX) rh_kv_push(mm128_t, km, *p, min);
-			for (j = buf_pos + 1, min.x = UINT64_MAX; j < w; ++j) // the two loops are necessary when there are identical k-mers
-				if (min.x >= buf[j].x) min = buf[j], min_pos = j; // >= is important s.t. min is always the closest e-mer
-			for (j = 0; j <= buf_pos; ++j)
-				if (min.x >= buf[j].x) min = buf[j], min_pos = j;
-			if (l >= w + e - 1 && min.x != UINT64_MAX) { // write identical k-mers
-				for (j = buf_pos + 1; j < w; ++j) // these two loops make sure the output is sorted
-					if (min.x == buf[j].x && min.y != buf[j].y) rh_kv_push(mm128_t, km, *p, buf[j]);
-				for (j = 0; j <= buf_pos; ++j)
-					if (min.x == buf[j].x && min.y != buf[j].y) rh_kv_push(mm128_t, km, *p, buf[j]);
+	ri_sketch_iter_t it;
+	mm128_t seeds[RI_SKETCH_BLOCK];
+	sketch_iter_init(&it, s_values, id, strand, len, diff, e, quant_bit, k, fine_min, fine_max, fine_range);
+	if (n > 1) sketch_iter_blend(&it, n);
+	const int ne = e + (n > 1? n - 1 : 0); //events of a seed; the first seed ends at the $ne-th event
+	const uint32_t l_win = w + ne - 1; //the first window of $w seeds ends at the $l_win-th event
+
+	uint32_t l, n_seeds;
+	buf_pos = min_pos = pre_pos = 0, suf_pos = w;
+	while (it.f_pos < len) {
+		n_seeds = sketch_block<E, Q>(&it, seeds);
+		for (uint32_t s = 0; s < n_seeds; ++s) {
+			l = it.l - n_seeds + s + 1;
+			mm128_t info = seeds[s];
+
+			buf[buf_pos] = info; // need to do this here as appropriate buf_pos and buf[buf_pos] are needed below
+			if (l == l_win && min.x != UINT64_MAX) { // special case for the first window - because identical k-mers are not stored yet
+				for (j = buf_pos + 1; j < w; ++j)
+					if (min.x == buf[j].x && buf[j].y != min.y) rh_kv_push(mm128_t, km, *p, buf[j]);
+				for (j = 0; j < buf_pos; ++j)
+					if (min.x == buf[j].x && buf[j].y != min.y) rh_kv_push(mm128_t, km, *p, buf[j]);
+			}
+			if (info.x <= min.x) { // a new minimum; then write the old min
+				if (l > l_win && min.x != UINT64_MAX) rh_kv_push(mm128_t, km, *p, min);
+				min = info, min_pos = buf_pos;
+			} else if (buf_pos == min_pos) { // old min has moved outside the window
+				if (l >= l_win && min.x != UINT64_MAX) rh_kv_push(mm128_t, km, *p, min);
+				// the window is buf[buf_pos+1..w-1] of the previous block and buf[0..buf_pos] of the current block
+				for (j = pre_pos; j <= buf_pos; ++j) { // <= is important s.t. min is always the closest e-mer
+					const uint64_t x = buf[j].x;
+					pre_c = (x <= pre_x)? j : pre_c, pre_f = (x < pre_x)? j : pre_f, pre_x = (x < pre_x)? x : pre_x;
+				}
+				pre_pos = buf_pos + 1;
+				int c = pre_c, f = pre_f;
+				if (buf_pos + 1 < w) {
+					uint64_t y = (suf_pos < w)? suf_x[suf_pos] : UINT64_MAX;
+					int yc = (suf_pos < w)? suf_c[suf_pos] : 0, yf = (suf_pos < w)? suf_f[suf_pos] : 0;
+					for (j = suf_pos - 1; j > buf_pos; --j) { // from the closest e-mer, so only a smaller hash replaces it
+						const uint64_t x = buf[j].x;
+						yc = (x < y)? j : yc, yf = (x <= y)? j : yf, y = (x < y)? x : y;
+						suf_x[j] = y, suf_c[j] = yc, suf_f[j] = yf;
+					}
+					suf_pos = buf_pos + 1;
+					if (suf_x[suf_pos] < pre_x) c = suf_c[suf_pos];
+					if (suf_x[suf_pos] <= pre_x) f = suf_f[suf_pos];
+				}
+				min = buf[c], min_pos = c;
+				if (l >= l_win && f != c) { // write identical k-mers from the farthest one; the loops make sure the output is sorted
+					if (f > buf_pos) {
+						for (j = f; j < (c > buf_pos? c : w); ++j)
+							if (min.x == buf[j].x) rh_kv_push(mm128_t, km, *p, buf[j]);
+						f = (c > buf_pos)? c : 0;
+					}
+					for (j = f; j < c; ++j)
+						if (min.x == buf[j].x) rh_kv_push(mm128_t, km, *p, buf[j]);
+				}
 			}
+			if (++buf_pos == w) buf_pos = pre_pos = 0, pre_x = UINT64_MAX, suf_pos = w; // a new block; its minima are not computed yet
 		}
-		if (++buf_pos == w) buf_pos = 0;
-    }
+	}
 	if (min.x != UINT64_MAX)
 		rh_kv_push(mm128_t, km, *p, min);
 }
 
-void ri_sketch_reg(void *km,
-				   const float* s_values,
-				   uint32_t id,
-				   int strand,
-				   uint32_t len,
-				   float diff,
-				   int e,
-				   uint32_t quant_bit,
-				   int k,
-				   float fine_min,
-				   float fine_max,
-				   float fine_range,
-				   mm128_v *p){
+template<int E, int Q>
+static void ri_sketch_reg(void *km,
+						  const float* s_values,
+						  uint32_t id,
+						  int strand,
+						  uint32_t len,
+						  float diff,
+						  int s,
+						  int t,
+						  int e,
+						  int n,
+						  uint32_t quant_bit,
+						  int k,
+						  float fine_min,
+						  float fine_max,
+						  float fine_range,
+						  mm128_v *p){
 
+	if (E) e = E;
+	if (Q) quant_bit = Q;
 	assert(len > 0 && (uint32_t)e*quant_bit <= 64);
 
-	uint32_t span = k+e-1;
-	
-	const uint64_t id_shift = (uint64_t)id<<RI_ID_SHIFT, mask = (1ULL<<32)-1, mask_events = (1ULL<<(quant_bit*e))-1, mask_quant_bit = (1ULL<<quant_bit)-1;
-
-	uint32_t n_buckets = 1UL<<quant_bit;
-
-	int sigBufFull = 0;
-	uint32_t f_pos, sigBufPos = 0, l_sigpos = 0; //last signal position
-	uint32_t f_tmpQuantSignal = 0;
-	uint64_t quantVal = 0;
-
 	rh_kv_resize(mm128_t, km, *p, p->n + len);
 
-	mm128_t sigBuf[e];
-	memset(sigBuf, 0, e*sizeof(mm128_t));
-
-    for (f_pos = 0; f_pos < len; ++f_pos) {
-        if((f_pos > 0 && fabs(s_values[f_pos] - s_values[l_sigpos]) < diff)) continue;
-
-		l_sigpos = f_pos;
-
-		f_tmpQuantSignal = dynamic_quantize(s_values[f_pos], fine_min, fine_max, fine_range, n_buckets)&mask_quant_bit;
-
-		sigBuf[sigBufPos].y = id_shift | (uint32_t)f_pos<<RI_POS_SHIFT | strand;
-		if(++sigBufPos == e) {sigBufFull = 1; sigBufPos = 0;}
-
-		quantVal = (quantVal<<quant_bit|f_tmpQuantSignal)&mask_events;
-		sigBuf[sigBufPos].x = (hash64(quantVal, mask)<<RI_HASH_SHIFT) | span;
-		
-		if(!sigBufFull) continue;
+	ri_sketch_iter_t it;
+	sketch_iter_init(&it, s_values, id, strand, len, diff, e, quant_bit, k, fine_min, fine_max, fine_range);
+	if (n > 1) sketch_iter_blend(&it, n);
+	else if (s) sketch_iter_sync(&it, s, t);
 
-		rh_kv_push(mm128_t, km, *p, sigBuf[sigBufPos]);
-    }
+	//The seeds of a block are written in place
+	while (it.f_pos < len) p->n += sketch_block<E, Q>(&it, p->a + p->n);
 }
 
 void ri_sketch(void *km,
@@ -199,6 +438,8 @@ void ri_sketch(void *km,
                int w,
                int e,
                int n,
+               int s,
+               int t,
                uint32_t quant_bit,
                int k,
                float fine_min,
@@ -206,6 +447,11 @@ void ri_sketch(void *km,
                float fine_range,
                mm128_v *p)
 {
-	if(w) ri_sketch_min(km, s_values, id, strand, len, diff, w, e, quant_bit, k, fine_min, fine_max, fine_range, p);
-	else ri_sketch_reg(km, s_values, id, strand, len, diff, e, quant_bit, k, fine_min, fine_max, fine_range, p);
+	//The combinations of the presets have their own kernels with the parameters as constants: default and fast (e=8),
+	//viral (e=6), and faster (e=11, w=3)
+	if(w == 0 && e == 8 && quant_bit == 4) ri_sketch_reg<8, 4>(km, s_values, id, strand, len, diff, s, t, e, n, quant_bit, k, fine_min, fine_max, fine_range, p);
+	else if(w == 0 && e == 6 && quant_bit == 4) ri_sketch_reg<6, 4>(km, s_values, id, strand, len, diff, s, t, e, n, quant_bit, k, fine_min, fine_max, fine_range, p);
+	else if(w == 3 && e == 11 && quant_bit == 4) ri_sketch_min<3, 11, 4>(km, s_values, id, strand, len, diff, w, e, n, quant_bit, k, fine_min, fine_max, fine_range, p);
+	else if(w) ri_sketch_min<0, 0, 0>(km, s_values, id, strand, len, diff, w, e, n, quant_bit, k, fine_min, fine_max, fine_range, p);
+	else ri_sketch_reg<0, 0>(km, s_values, id, strand, len, diff, s, t, e, n, quant_bit, k, fine_min, fine_max, fine_range, p);
 }
\ No newline at end of file
@@ -23,9 +23,13 @@ extern "C" {
  * @param len      length of $s_values
  * @param w        if w>0, find a minimizer for every $w consecutive k-mers
  * @param e        number of packed events in a single 32/64-bit hash value
- * @param n        [Currently disabled] if n>0 Enables BLEND. Number of neighbors hash values to use with SimHash.
+ * @param n        if n>1 Enables BLEND. Number of neighbors hash values to use with SimHash.
  * 				   Generates a single hash value from $n hash values; will be stored as a hash value if enabled.
- * 				   Please see the BLEND paper for details of this hash value calculation.
+ * 				   Please see the BLEND paper for details of this hash value calculation. Applies to both the
+ * 				   minimizers ($w>0) and all positions. $e+$n-1 should not be larger than 64
+ * @param s        if s>0 (and w=0, n<=1), keep only the syncmers: the windows of $e events whose smallest hash of the windows
+ * 				   of $s events (s-mers) within them is at the first or the last s-mer. Should not be larger than $e
+ * @param t        if t>=0, keep the open syncmers whose smallest s-mer is at offset $t instead (see $s)
  * @param q        most significant Q bits of normalized event values to use in the quantization step
  * @param lq       least significant lq bits within the most significant Q bits extracted from the normalized event values.
  * 				   If you want to use n as described in the RawHash manuscript, calculate lq as follows: $lq = $Q - 2 - n
@@ -47,6 +51,8 @@ void ri_sketch(void *km,
                int w,
                int e,
                int n,
+               int s,
+               int t,
                uint32_t quant_bit,
                int k,
                float fine_min,
@@ -44,6 +44,41 @@ long ri_peakrss(void)
 #endif
 }
 
+//Reads a single integer from a file such as /proc and /sys entries. Returns -1 if the file cannot be read
+static int64_t ri_read_int(const char* fn)
+{
+	long long x = -1;
+	FILE *fp = fopen(fn, "r");
+	if (fp == 0) return -1;
+	if (fscanf(fp, "%lld", &x) != 1) x = -1;
+	fclose(fp);
+	return x;
+}
+
+//Returns the number of bytes that can be allocated without swapping (MemAvailable), also bounded by the cgroup
+//memory limit on shared nodes. Returns 0 if unknown
+int64_t ri_memavail(void)
+{
+#ifdef __linux__
+	char line[256];
+	long long kb;
+	int64_t avail = 0, max, cur;
+	FILE *fp = fopen("/proc/meminfo", "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp))
+			if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) { avail = (int64_t)kb * 1024; break; }
+		fclose(fp);
+	}
+	//cgroup v2, then v1. "max" (no limit) fails to parse
+	max = ri_read_int("/sys/fs/cgroup/memory.max"), cur = ri_read_int("/sys/fs/cgroup/memory.current");
+	if (max < 0) max = ri_read_int("/sys/fs/cgroup/memory/memory.limit_in_bytes"), cur = ri_read_int("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+	if (max > 0 && cur >= 0 && (!avail || max - cur < avail)) avail = max > cur? max - cur : 1;
+	return avail;
+#else
+	return 0;
+#endif
+}
+
 char* strsep(char** stringp, const char* delim) {
     char* start = *stringp;
     char* p;
@@ -33,6 +33,7 @@ uint32_t ks_ksmall_uint32_t(size_t n, uint32_t arr[], size_t kk);
 double ri_realtime(void);
 double ri_cputime(void);
 long ri_peakrss(void);
+int64_t ri_memavail(void);
 
 void load_pore(const char* fpore, const short k, const short lev_col, ri_pore_t* pore);
 